@@ -4,8 +4,10 @@
 #include <stdlib.h>
 #include "upb/bytestream.h"
 #include "upb/def.h"
+#include "upb/handlers.h"
 #include "upb/pb/decoder.h"
 #include "upb/pb/glue.h"
+#include "upb/symtab.h"
 
 static char *input_str;
 static size_t input_len;
@@ -14,29 +16,88 @@ static upb_decoder decoder;
 static upb_stringsrc stringsrc;
 static upb_decoderplan *plan;
 
-static upb_sflow_t startsubmsg(void *_m, upb_value fval) {
-  (void)_m;
+static void *startsubmsg(void *closure, void *fval) {
   (void)fval;
-  return UPB_CONTINUE_WITH(NULL);
+  return closure;
 }
 
-static upb_flow_t value(void *closure, upb_value fval, upb_value val) {
+static size_t putstr(void *closure, void *fval, const char *buf, size_t n) {
   (void)closure;
   (void)fval;
-  (void)val;
-  return UPB_CONTINUE;
+  (void)buf;
+  return n;
 }
 
-void onfreg(void *c, upb_fhandlers *fh, const upb_fielddef *f) {
-  upb_fhandlers_setvalue(fh, &value);
-  upb_fhandlers_setstartsubmsg(fh, &startsubmsg);
+#define VALUE(type, ctype) \
+  static bool value_ ## type(void *closure, void *fval, ctype val) { \
+    (void)closure; \
+    (void)fval; \
+    (void)val; \
+    return true; \
+  }
+
+VALUE(int32, int32_t)
+VALUE(int64, int64_t)
+VALUE(uint32, uint32_t)
+VALUE(uint64, uint64_t)
+VALUE(float, float)
+VALUE(double, double)
+VALUE(bool, bool)
+#undef VALUE
+
+// Cause all messages to be read, but do nothing when they are.
+static void onmreg(void *c, upb_handlers *h) {
+  (void)c;
+  const upb_msgdef *m = upb_handlers_msgdef(h);
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, m); !upb_msg_done(&i); upb_msg_next(&i)) {
+    upb_fielddef *f = upb_msg_iter_field(&i);
+    switch (upb_fielddef_type(f)) {
+      case UPB_TYPE_INT32:
+      case UPB_TYPE_SINT32:
+      case UPB_TYPE_SFIXED32:
+      case UPB_TYPE_ENUM:
+        upb_handlers_setint32(h, f, &value_int32, NULL, NULL);
+        break;
+      case UPB_TYPE_INT64:
+      case UPB_TYPE_SINT64:
+      case UPB_TYPE_SFIXED64:
+        upb_handlers_setint64(h, f, &value_int64, NULL, NULL);
+        break;
+      case UPB_TYPE_UINT32:
+      case UPB_TYPE_FIXED32:
+        upb_handlers_setuint32(h, f, &value_uint32, NULL, NULL);
+        break;
+      case UPB_TYPE_UINT64:
+      case UPB_TYPE_FIXED64:
+        upb_handlers_setuint64(h, f, &value_uint64, NULL, NULL);
+        break;
+      case UPB_TYPE_FLOAT:
+        upb_handlers_setfloat(h, f, &value_float, NULL, NULL);
+        break;
+      case UPB_TYPE_DOUBLE:
+        upb_handlers_setdouble(h, f, &value_double, NULL, NULL);
+        break;
+      case UPB_TYPE_BOOL:
+        upb_handlers_setbool(h, f, &value_bool, NULL, NULL);
+        break;
+      case UPB_TYPE_STRING:
+      case UPB_TYPE_BYTES:
+        upb_handlers_setstring(h, f, &putstr, NULL, NULL);
+        break;
+      case UPB_TYPE_GROUP:
+      case UPB_TYPE_MESSAGE:
+        upb_handlers_setstartsubmsg(h, f, &startsubmsg, NULL, NULL);
+        break;
+    }
+  }
 }
 
 static bool initialize()
 {
   // Initialize upb state, decode descriptor.
   upb_status status = UPB_STATUS_INIT;
-  upb_symtab *s = upb_symtab_new();
+  upb_symtab *s = upb_symtab_new(&s);
   upb_load_descriptor_file_into_symtab(s, MESSAGE_DESCRIPTOR_FILE, &status);
   if(!upb_ok(&status)) {
     fprintf(stderr, "Error reading descriptor: %s\n",
@@ -44,12 +105,12 @@ static bool initialize()
     return false;
   }
 
-  def = upb_dyncast_msgdef_const(upb_symtab_lookup(s, MESSAGE_NAME, &def));
+  def = upb_symtab_lookupmsg(s, MESSAGE_NAME, &def);
   if(!def) {
     fprintf(stderr, "Error finding symbol '%s'.\n", MESSAGE_NAME);
     return false;
   }
-  upb_symtab_unref(s);
+  upb_symtab_unref(s, &s);
 
   // Read the message data itself.
   input_str = upb_readfile(MESSAGE_FILE, &input_len);
@@ -58,13 +119,12 @@ static bool initialize()
     return false;
   }
 
-  upb_handlers *handlers = upb_handlers_new();
-  // Cause all messages to be read, but do nothing when they are.
-  upb_handlers_regmsgdef(handlers, def, NULL, &upb_onfreg_hset, NULL);
+  const upb_handlers *handlers =
+      upb_handlers_newfrozen(def, &handlers, &onmreg, NULL);
   upb_decoder_init(&decoder);
   plan = upb_decoderplan_new(handlers, JIT);
-  upb_decoder_resetplan(&decoder, plan, 0);
-  upb_handlers_unref(handlers);
+  upb_decoder_resetplan(&decoder, plan);
+  upb_handlers_unref(handlers, &handlers);
   upb_stringsrc_init(&stringsrc);
   return true;
 }
@@ -72,7 +132,7 @@ static bool initialize()
 static void cleanup()
 {
   free(input_str);
-  upb_def_unref(UPB_UPCAST(def), &def);
+  upb_msgdef_unref(def, &def);
   upb_decoder_uninit(&decoder);
   upb_decoderplan_unref(plan);
   upb_stringsrc_uninit(&stringsrc);
@@ -81,13 +141,14 @@ static void cleanup()
 static size_t run(int i)
 {
   (void)i;
-  upb_status status = UPB_STATUS_INIT;
   upb_stringsrc_reset(&stringsrc, input_str, input_len);
-  upb_decoder_resetinput(&decoder, upb_stringsrc_allbytes(&stringsrc), NULL);
+  // Handlers return their closure, so it must not be NULL.
+  upb_decoder_resetinput(&decoder, upb_stringsrc_allbytes(&stringsrc), &decoder);
   if (upb_decoder_decode(&decoder) != UPB_OK) goto err;
   return input_len;
 
 err:
-  fprintf(stderr, "Decode error: %s", upb_status_getstr(&status));
+  fprintf(stderr, "Decode error: %s",
+          upb_status_getstr(upb_decoder_status(&decoder)));
   return 0;
 }
@@ -0,0 +1,74 @@
+
+#include "main.c"
+
+#include <stdlib.h>
+#include "upb/pb/varint.h"
+
+// Decodes a buffer of varints whose lengths are spread evenly from 1 to
+// VARINT_MAXBYTES bytes, either with upb_vdecode_bulk64() (if BULK is
+// defined) or with a scalar loop over upb_vdecode_<DECODER>.
+#define NUM_VARINTS (1 << 16)
+
+static char *input_str;
+static size_t input_len;
+static uint64_t *expected;
+static uint64_t *vals;
+
+static uint64_t rand_state = 1;
+static uint64_t rand_varint() {
+  rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  uint64_t r = rand_state ^ (rand_state >> 29);
+  int bytes = 1 + (rand_state >> 58) % VARINT_MAXBYTES;
+  if (bytes == 1) return r & 0x7f;
+  uint64_t low = 1ULL << (7 * (bytes - 1));
+  return low | (r & (low - 1));
+}
+
+#define PASTE(a, b) a ## b
+#define DECODER_FUNC(name) PASTE(upb_vdecode_, name)
+
+static bool decode() {
+#ifdef BULK
+  size_t n = NUM_VARINTS;
+  const char *p = upb_vdecode_bulk64(input_str, input_str + input_len, vals,
+                                     &n);
+  return p == input_str + input_len && n == NUM_VARINTS;
+#else
+  const char *p = input_str;
+  for (size_t i = 0; i < NUM_VARINTS; i++) {
+    upb_decoderet r = DECODER_FUNC(DECODER)(p);
+    vals[i] = r.val;
+    p = r.p;
+  }
+  return p == input_str + input_len;
+#endif
+}
+
+static bool initialize()
+{
+  // Padded so the scalar decoders can read a full varint past the end.
+  input_str = calloc(NUM_VARINTS * UPB_PB_VARINT_MAX_LEN + 16, 1);
+  expected = malloc(NUM_VARINTS * sizeof(uint64_t));
+  vals = malloc(NUM_VARINTS * sizeof(uint64_t));
+  if (!input_str || !expected || !vals) return false;
+  input_len = 0;
+  for (size_t i = 0; i < NUM_VARINTS; i++) {
+    expected[i] = rand_varint();
+    input_len += upb_vencode64(expected[i], input_str + input_len);
+  }
+  return decode() &&
+         memcmp(vals, expected, NUM_VARINTS * sizeof(uint64_t)) == 0;
+}
+
+static void cleanup()
+{
+  free(input_str);
+  free(expected);
+  free(vals);
+}
+
+static size_t run(int i)
+{
+  (void)i;
+  return decode() ? input_len : 0;
+}
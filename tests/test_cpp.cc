@@ -13,6 +13,7 @@
 #include "upb/bytestream.h"
 #include "upb/def.h"
 #include "upb/handlers.h"
+#include "upb/pb/decoder.h"
 #include "upb/pb/glue.h"
 #include "upb_test.h"
 #include "upb/upb.h"
@@ -41,6 +42,75 @@ static void TestByteStream() {
   free(str);
 }
 
+class SimplePrimitives {
+ public:
+  SimplePrimitives() : a_(0), b_(0), c_(0) {}
+  void set_a(uint64_t val) { a_ = val; }
+  bool set_b(uint32_t val) { b_ = val; return val != 0; }
+  void set_c(const double* scale, double val) { c_ = *scale * val; }
+
+  uint64_t a_;
+  uint32_t b_;
+  double c_;
+};
+
+static void TestTypedHandlers(const char *descriptor_file) {
+  upb::SymbolTable *s = upb::SymbolTable::New(&s);
+  upb::Status status;
+  bool ok = upb::LoadDescriptorFileIntoSymtab(s, descriptor_file, &status);
+  ASSERT(ok);
+  const upb::MessageDef *md = s->LookupMessage("SimplePrimitives", &md);
+  ASSERT(md);
+  s->Unref(&s);
+
+  upb::Handlers *h = upb::Handlers::New(md, &h);
+  ASSERT(h->SetValueHandler(md->FindFieldByNumber(1),
+                            UPB_VALUE_HANDLER(&SimplePrimitives::set_a)));
+  ASSERT(h->SetValueHandler(md->FindFieldByNumber(2),
+                            UPB_VALUE_HANDLER(&SimplePrimitives::set_b)));
+  ASSERT(h->SetValueHandler(md->FindFieldByNumber(3),
+                            UPB_VALUE_HANDLER(&SimplePrimitives::set_c),
+                            new double(2), &upb::DeletePointer<double>));
+  // The field's type must still match the handler's.
+  double unused = 0;
+  ASSERT(!h->SetValueHandler(md->FindFieldByNumber(5),
+                             UPB_VALUE_HANDLER(&SimplePrimitives::set_c),
+                             &unused, NULL));
+  ok = upb::Handlers::Freeze(&h, 1, &status);
+  ASSERT(ok);
+
+  double c = 1.25;
+  char c_bytes[8];
+  memcpy(c_bytes, &c, 8);
+  std::string input;
+  input += '\x09';  // a: fixed64 = 0x0102030405060708
+  input.append("\x08\x07\x06\x05\x04\x03\x02\x01", 8);
+  input += '\x19';  // c: double = 1.25
+  input.append(c_bytes, 8);
+  input += '\x15';  // b: fixed32 = 7
+  input.append("\x07\x00\x00\x00", 4);
+
+  for (int jit = 0; jit < 2; jit++) {
+    upb_decoderplan *p = upb_decoderplan_new(h, jit);
+    upb_decoder d;
+    upb_decoder_init(&d);
+    upb_decoder_resetplan(&d, p);
+    upb::StringSource src;
+    src.Reset(input.data(), input.size());
+    SimplePrimitives msg;
+    upb_decoder_resetinput(&d, src.AllBytes(), &msg);
+    ASSERT(upb_decoder_decode(&d) == UPB_OK);
+    ASSERT(msg.a_ == 0x0102030405060708ULL);
+    ASSERT(msg.b_ == 7);
+    ASSERT(msg.c_ == 2.5);
+    upb_decoder_uninit(&d);
+    upb_decoderplan_unref(p);
+  }
+
+  h->Unref(&h);
+  md->Unref(&md);
+}
+
 extern "C" {
 
 int run_tests(int argc, char *argv[]) {
@@ -50,6 +120,7 @@ int run_tests(int argc, char *argv[]) {
   }
   TestSymbolTable(argv[1]);
   TestByteStream();
+  TestTypedHandlers(argv[1]);
   return 0;
 }
 
@@ -7,15 +7,13 @@
  * input, with buffer breaks in arbitrary places.
  *
  * Tests to add:
- * - string/bytes
- * - unknown field handler called appropriately
+ * - bytes
  * - unknown fields can be inserted in random places
  * - fuzzing of valid input
  * - resource limits (max stack depth, max string len)
  * - testing of groups
  * - more throrough testing of sequences
  * - test skipping of submessages
- * - test suspending the decoder
  * - buffers that are close enough to the end of the address space that
  *   pointers overflow (this might be difficult).
  * - a few "kitchen sink" examples (one proto that uses all types, lots
@@ -28,15 +26,21 @@
 
 #include <inttypes.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "upb/handlers.h"
 #include "upb/pb/decoder.h"
+#include "upb/pb/encoder.h"
+#include "upb/pb/parallel.h"
 #include "upb/pb/varint.h"
+#include "upb/sink.h"
+#include "upb/stdc/io.h"
 #include "upb/upb.h"
 #include "upb_test.h"
 #include "third_party/upb/tests/test_decoder_schema.upb.h"
+#include "third_party/upb/tests/test_decoder_schema.upbdec.h"
 
 uint32_t filter_hash = 0;
 
@@ -270,11 +274,75 @@ void endmsg(void *closure, upb_status *status) {
   output.append(">\n");
 }
 
+#define NOP_FIELD 40
+#define LAZY_FIELD 41
+#define UNKNOWN_FIELD 666
+// An unknown field whose handler returns false.
+#define REJECTED_UNKNOWN_FIELD 668
+
+// String views are kept until the end of each parse (see run_decoder()), to
+// check that their bytes stay valid after the decoder has moved on.
+#define MAX_VIEWS 256
+upb_strview views[MAX_VIEWS];
+int num_views = 0;
+
+// Prints the string as startstr/value_string/endstr would.
+bool value_strview(void *closure, void *fval, upb_strview *view) {
+  indent(closure);
+  uint32_t *num = static_cast<uint32_t*>(fval);
+  output.appendf("%" PRIu32 ":(%zu)\"", *num, view->size());
+  output.append(view->data(), view->size());
+  output.append("\"\n");
+  ASSERT(num_views < MAX_VIEWS);
+  views[num_views++] = *view;
+  return true;
+}
+
+// Prints the submessage's bytes, and keeps its view until the end of the parse
+// like value_strview().  Rejects empty submessages, so that aborting from the
+// handler is tested.
+bool value_lazy(void *closure, void *fval, upb_strview *view) {
+  indent(closure);
+  uint32_t *num = static_cast<uint32_t*>(fval);
+  output.appendf("%" PRIu32 ":lazy(%zu)\"", *num, view->size());
+  output.append(view->data(), view->size());
+  output.append("\"\n");
+  ASSERT(num_views < MAX_VIEWS);
+  views[num_views++] = *view;
+  return view->size() > 0;
+}
+
+bool reject_strview(void *closure, void *fval, upb_strview *view) {
+  (void)closure;
+  (void)fval;
+  upb_strview_release(view);
+  return false;
+}
+
+bool value_unknown(void *closure, uint32_t tag, upb_byteregion *bytes) {
+  indent(closure);
+  // All of the value's bytes must be available to the handler.
+  ASSERT(upb_byteregion_fetchofs(bytes) == upb_byteregion_endofs(bytes));
+  output.appendf("%" PRIu32 ":?(%" PRIu64 ")\n", tag >> 3,
+                 upb_byteregion_len(bytes));
+  return (tag >> 3) != REJECTED_UNKNOWN_FIELD;
+}
+
 void free_uint32(void *val) {
   uint32_t *u32 = static_cast<uint32_t*>(val);
   delete u32;
 }
 
+// Prints each value as the value handler "F" would, so that registering array
+// handlers does not change the output.
+template<class T, typename upb::Handlers::Value<T>::Handler *F>
+bool value_array(void *closure, void *fval, const T *vals, size_t n) {
+  ASSERT(n > 0);
+  for (size_t i = 0; i < n; i++)
+    F(closure, fval, vals[i]);
+  return true;
+}
+
 template<class T>
 void doreg(upb_handlers *h, uint32_t num,
            typename upb::Handlers::Value<T>::Handler *handler) {
@@ -295,9 +363,6 @@ uint32_t rep_fn(uint32_t fn) {
   return (UPB_MAX_FIELDNUMBER - 1000) + fn;
 }
 
-#define NOP_FIELD 40
-#define UNKNOWN_FIELD 666
-
 template <class T>
 void reg(upb_handlers *h, upb_fieldtype_t type,
          typename upb::Handlers::Value<T>::Handler *handler) {
@@ -341,9 +406,54 @@ void reg_str(upb_handlers *h, uint32_t num) {
       f, &value_string, new uint32_t(num), free_uint32));
 }
 
+// Replaces the value handler of the repeated field for "type" with an array
+// handler.
+template<class T, typename upb::Handlers::Value<T>::Handler *F>
+void reg_array(upb_handlers *h, upb_fieldtype_t type) {
+  uint32_t num = rep_fn(type);
+  const upb_fielddef *f = upb_msgdef_itof(upb_handlers_msgdef(h), num);
+  ASSERT(f);
+  ASSERT(h->SetValueHandler<T>(f, NULL, NULL, NULL));
+  ASSERT(h->SetArrayHandler<T>(
+      f, &value_array<T, F>, new uint32_t(num), free_uint32));
+  // Array handlers are only for repeated fields.
+  const upb_fielddef *nonrep = upb_msgdef_itof(upb_handlers_msgdef(h), type);
+  ASSERT(!h->SetArrayHandler<T>(nonrep, &value_array<T, F>, NULL, NULL));
+}
+
+// Replaces the string handlers of the field "num" with a string view handler.
+void reg_strview(upb_handlers *h, uint32_t num) {
+  const upb_fielddef *f = upb_msgdef_itof(upb_handlers_msgdef(h), num);
+  ASSERT(f);
+  ASSERT(h->SetStringViewHandler(
+      f, &value_strview, new uint32_t(num), free_uint32));
+  // String views are only for string fields.
+  const upb_fielddef *i = upb_msgdef_itof(upb_handlers_msgdef(h),
+                                          UPB_TYPE(INT32));
+  ASSERT(!h->SetStringViewHandler(i, &value_strview, NULL, NULL));
+}
+
+void reg_arrayhandlers(upb_handlers *h) {
+  reg_array<double,   &value_double>(h, UPB_TYPE(DOUBLE));
+  reg_array<float,    &value_float> (h, UPB_TYPE(FLOAT));
+  reg_array<int64_t,  &value_int64> (h, UPB_TYPE(INT64));
+  reg_array<uint64_t, &value_uint64>(h, UPB_TYPE(UINT64));
+  reg_array<int32_t,  &value_int32> (h, UPB_TYPE(INT32));
+  reg_array<uint64_t, &value_uint64>(h, UPB_TYPE(FIXED64));
+  reg_array<uint32_t, &value_uint32>(h, UPB_TYPE(FIXED32));
+  reg_array<bool,     &value_bool>  (h, UPB_TYPE(BOOL));
+  reg_array<uint32_t, &value_uint32>(h, UPB_TYPE(UINT32));
+  reg_array<int32_t,  &value_int32> (h, UPB_TYPE(ENUM));
+  reg_array<int32_t,  &value_int32> (h, UPB_TYPE(SFIXED32));
+  reg_array<int64_t,  &value_int64> (h, UPB_TYPE(SFIXED64));
+  reg_array<int32_t,  &value_int32> (h, UPB_TYPE(SINT32));
+  reg_array<int64_t,  &value_int64> (h, UPB_TYPE(SINT64));
+}
+
 void reghandlers(upb_handlers *h) {
   upb_handlers_setstartmsg(h, &startmsg);
   upb_handlers_setendmsg(h, &endmsg);
+  upb_handlers_setunknown(h, &value_unknown);
 
   // Register handlers for each type.
   reg<double>  (h, UPB_TYPE(DOUBLE),   &value_double);
@@ -371,6 +481,11 @@ void reghandlers(upb_handlers *h) {
   reg_subm(h, UPB_TYPE(MESSAGE));
   reg_subm(h, rep_fn(UPB_TYPE(MESSAGE)));
 
+  const upb_fielddef *f = upb_msgdef_itof(upb_handlers_msgdef(h), LAZY_FIELD);
+  ASSERT(f);
+  ASSERT(h->SetLazySubMessageHandler(
+      f, &value_lazy, new uint32_t(LAZY_FIELD), free_uint32));
+
   // For NOP_FIELD we register no handlers, so we can pad a proto freely without
   // changing the output.
 }
@@ -382,7 +497,13 @@ typedef struct {
   upb_bytesrc bytesrc;
   const char *str;
   size_t len, seam1, seam2;
+  // If true, the first fetch at each seam returns WOULDBLOCK.
+  bool suspend;
+  bool blocked1, blocked2;
   upb_byteregion byteregion;
+  // Regions can only be pinned within one buffer, so that both pinned and
+  // copied string views are tested.
+  int pins;
 } upb_seamsrc;
 
 size_t upb_seamsrc_avail(const upb_seamsrc *src, size_t ofs) {
@@ -398,6 +519,14 @@ upb_bytesuccess_t upb_seamsrc_fetch(void *_src, uint64_t ofs, size_t *read) {
     upb_status_seteof(&src->bytesrc.status);
     return UPB_BYTE_EOF;
   }
+  if (src->suspend && ofs == src->seam1 && !src->blocked1) {
+    src->blocked1 = true;
+    return UPB_BYTE_WOULDBLOCK;
+  }
+  if (src->suspend && ofs == src->seam2 && !src->blocked2) {
+    src->blocked2 = true;
+    return UPB_BYTE_WOULDBLOCK;
+  }
   *read = upb_seamsrc_avail(src, ofs);
   return UPB_BYTE_OK;
 }
@@ -420,33 +549,57 @@ const char *upb_seamsrc_getptr(const void *_s, uint64_t ofs, size_t *len) {
   return src->str + ofs;
 }
 
+bool upb_seamsrc_pin(void *_s, uint64_t ofs, size_t len) {
+  upb_seamsrc *src = (upb_seamsrc*)_s;
+  if (len > upb_seamsrc_avail(src, ofs)) return false;
+  src->pins++;
+  return true;
+}
+
+void upb_seamsrc_unpin(void *_s, uint64_t ofs, size_t len) {
+  upb_seamsrc *src = (upb_seamsrc*)_s;
+  (void)ofs;
+  (void)len;
+  ASSERT(src->pins > 0);
+  src->pins--;
+}
+
 void upb_seamsrc_init(upb_seamsrc *s, const char *str, size_t len) {
   static upb_bytesrc_vtbl vtbl = {
     &upb_seamsrc_fetch,
     &upb_seamsrc_discard,
     &upb_seamsrc_copy,
     &upb_seamsrc_getptr,
+    &upb_seamsrc_pin,
+    &upb_seamsrc_unpin,
   };
   upb_bytesrc_init(&s->bytesrc, &vtbl);
   s->seam1 = 0;
   s->seam2 = 0;
+  s->suspend = false;
   s->str = str;
   s->len = len;
+  s->pins = 0;
   s->byteregion.bytesrc = &s->bytesrc;
   s->byteregion.toplevel = true;
   s->byteregion.start = 0;
   s->byteregion.end = len;
 }
 
-void upb_seamsrc_resetseams(upb_seamsrc *s, size_t seam1, size_t seam2) {
+void upb_seamsrc_resetseams(upb_seamsrc *s, size_t seam1, size_t seam2,
+                            bool suspend) {
   assert(seam1 <= seam2);
+  assert(s->pins == 0);
   s->seam1 = seam1;
   s->seam2 = seam2;
+  s->suspend = suspend;
+  s->blocked1 = false;
+  s->blocked2 = false;
   s->byteregion.discard = 0;
   s->byteregion.fetch = 0;
 }
 
-void upb_seamsrc_uninit(upb_seamsrc *s) { (void)s; }
+void upb_seamsrc_uninit(upb_seamsrc *s) { ASSERT(s->pins == 0); }
 
 upb_bytesrc *upb_seamsrc_bytesrc(upb_seamsrc *s) {
   return &s->bytesrc;
@@ -473,7 +626,10 @@ uint32_t Hash(const buffer& proto, const buffer* expected_output) {
 }
 
 #define LINE(x) x "\n"
-void run_decoder(const buffer& proto, const buffer* expected_output) {
+// If "records" is set, "proto" is decoded as a stream of length-delimited
+// records.
+void run_decoder(const buffer& proto, const buffer* expected_output,
+                 bool records = false) {
   testhash = Hash(proto, expected_output);
   if (filter_hash && testhash != filter_hash) return;
   upb_seamsrc src;
@@ -481,13 +637,25 @@ void run_decoder(const buffer& proto, const buffer* expected_output) {
   upb_decoder d;
   upb_decoder_init(&d);
   upb_decoder_resetplan(&d, plan);
+  for (int suspend = 0; suspend < 2; suspend++) {
   for (size_t i = 0; i < proto.len(); i++) {
     for (size_t j = i; j < UPB_MIN(proto.len(), i + 5); j++) {
-      upb_seamsrc_resetseams(&src, i, j);
+      upb_seamsrc_resetseams(&src, i, j, suspend);
       upb_byteregion *input = upb_seamsrc_allbytes(&src);
       output.clear();
-      upb_decoder_resetinput(&d, input, &closures[0]);
-      upb_success_t success = upb_decoder_decode(&d);
+      if (records) {
+        upb_decoder_resetrecords(&d, input, &closures[0]);
+      } else {
+        upb_decoder_resetinput(&d, input, &closures[0]);
+      }
+      upb_success_t success;
+      int suspensions = 0;
+      // Each seam suspends at most once; resuming must pick up where the
+      // decoder left off without repeating or losing any output.
+      while ((success = upb_decoder_decode(&d)) == UPB_SUSPENDED) {
+        ASSERT(suspend);
+        ASSERT(++suspensions <= 2);
+      }
       ASSERT(upb_ok(upb_decoder_status(&d)) == (success == UPB_OK));
       if (expected_output) {
         ASSERT_STATUS(success == UPB_OK, upb_decoder_status(&d));
@@ -503,8 +671,16 @@ void run_decoder(const buffer& proto, const buffer* expected_output) {
       } else {
         ASSERT(success == UPB_ERROR);
       }
+      // The views' bytes must still be valid now that the decoder is done.
+      for (int k = 0; k < num_views; k++) {
+        ASSERT(memmem(output.buf(), output.len(),
+                      views[k].data(), views[k].size()));
+        views[k].Release();
+      }
+      num_views = 0;
     }
   }
+  }
   upb_decoder_uninit(&d);
   upb_seamsrc_uninit(&src);
   testhash = 0;
@@ -720,6 +896,16 @@ void test_invalid() {
   // EOF inside an unknown group.
   assert_does_not_parse_at_eof( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_START_GROUP) );
 
+  // EOF inside a group nested in an unknown group.
+  assert_does_not_parse_at_eof(
+      cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_START_GROUP),
+           tag(UNKNOWN_FIELD + 1, UPB_WIRE_TYPE_START_GROUP) ));
+
+  // Unknown group closed by the wrong END_GROUP tag.
+  assert_does_not_parse(
+      cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_START_GROUP),
+           tag(UNKNOWN_FIELD + 1, UPB_WIRE_TYPE_END_GROUP) ));
+
   // End group that we are not currently in.
   assert_does_not_parse( tag(4, UPB_WIRE_TYPE_END_GROUP) );
 
@@ -771,6 +957,93 @@ void test_valid() {
       LINE("]")
       LINE(">"), repfl_fn, repfl_fn, repdb_fn, repdb_fn);
 
+  // Unknown fields are delivered with their raw value bytes.
+  assert_successful_parse(
+      cat( cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_VARINT), varint(300) ),
+           cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_64BIT), uint64(5) ),
+           cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_DELIMITED),
+                delim(buffer("abc")) ) ),
+      LINE("<")
+      LINE("%u:?(2)")
+      LINE("%u:?(8)")
+      LINE("%u:?(4)")
+      LINE(">"), UNKNOWN_FIELD, UNKNOWN_FIELD, UNKNOWN_FIELD);
+
+  // An unknown field handler that returns false aborts the parse.
+  assert_does_not_parse(
+      cat( tag(REJECTED_UNKNOWN_FIELD, UPB_WIRE_TYPE_VARINT), varint(1),
+           tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_VARINT), varint(2) ));
+
+  // Unknown groups (including nested groups) are skipped as a single value.
+  buffer nested_group = cat(
+      tag(UNKNOWN_FIELD + 1, UPB_WIRE_TYPE_START_GROUP),
+      tag(2, UPB_WIRE_TYPE_DELIMITED), delim(buffer("xyz")),
+      tag(UNKNOWN_FIELD + 1, UPB_WIRE_TYPE_END_GROUP) );
+  buffer unknown_group = cat(
+      tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_START_GROUP),
+      tag(1, UPB_WIRE_TYPE_VARINT), varint(1),
+      nested_group,
+      tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_END_GROUP) );
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  assert_successful_parse(
+      cat( unknown_group, tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ),
+      LINE("<")
+      LINE("%u:?(%u)")
+      LINE("%u:7")
+      LINE(">"), UNKNOWN_FIELD, (unsigned)unknown_group.len() - 2, int32_fn);
+
+  // Lazy submessages are delivered as a string view without being parsed (the
+  // bytes inside would not parse as a DecoderTest).
+  assert_successful_parse(
+      cat( submsg(LAZY_FIELD, buffer("\xff\xff\xff")),
+           tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ),
+      LINE("<")
+      LINE("%u:lazy(3)\"\xff\xff\xff\"")
+      LINE("%u:7")
+      LINE(">"), LAZY_FIELD, int32_fn);
+
+  // A lazy submessage handler that returns false aborts the parse.
+  assert_does_not_parse(
+      cat( submsg(LAZY_FIELD, buffer()),
+           tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ));
+
+  // String tests (buffer seams and suspensions can fall mid-string).
+  uint32_t str_fn = UPB_TYPE(STRING);
+  assert_successful_parse(
+      cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED), delim(buffer("abcdefgh")) ),
+      LINE("<")
+      LINE("%u:(8)\"abcdefgh\"")
+      LINE(">"), str_fn);
+
+  // A packed run that is longer than one chunk of array values.
+  uint32_t repi_fn = rep_fn(UPB_TYPE(INT32));
+  buffer packed;
+  buffer packedtext;
+  packedtext.appendf("<\n%u:[\n", repi_fn);
+  for (int i = 0; i < 300; i++) {
+    packed.append(varint(i % 100));
+    packedtext.appendf("  %u:%d\n", repi_fn, i % 100);
+  }
+  packedtext.append("]\n>\n");
+  assert_successful_parse(
+      cat( tag(repi_fn, UPB_WIRE_TYPE_DELIMITED), delim(packed) ),
+      "%s", packedtext.buf());
+
+  // The same for a fixed-size type, whose values can be delivered straight
+  // from the buffer.
+  uint32_t repf_fn = rep_fn(UPB_TYPE(FIXED64));
+  buffer packedfixed;
+  buffer packedfixedtext;
+  packedfixedtext.appendf("<\n%u:[\n", repf_fn);
+  for (int i = 0; i < 300; i++) {
+    packedfixed.append(uint64(i % 100));
+    packedfixedtext.appendf("  %u:%d\n", repf_fn, i % 100);
+  }
+  packedfixedtext.append("]\n>\n");
+  assert_successful_parse(
+      cat( tag(repf_fn, UPB_WIRE_TYPE_DELIMITED), delim(packedfixed) ),
+      "%s", packedfixedtext.buf());
+
   // Submessage tests.
   uint32_t msg_fn = UPB_TYPE(MESSAGE);
   assert_successful_parse(
@@ -832,9 +1105,740 @@ void test_valid() {
   assert_successful_parse(buf, "%s", textbuf.buf());
 }
 
+void test_projection(const upb_handlers *h, bool allowjit) {
+  // Only f_int32 is decoded; every other field (including the submessage and
+  // the string, which would otherwise produce output) is skipped.
+  const char *paths[] = {"f_int32"};
+  upb_status status;
+  upb_decoderplan *full = plan;
+  plan = upb_decoderplan_newprojection(h, paths, 1, allowjit, &status);
+  ASSERT_STATUS(plan, &status);
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  assert_successful_parse(
+      cat( tag(UPB_TYPE(STRING), UPB_WIRE_TYPE_DELIMITED), delim(buffer("abc")),
+           submsg(UPB_TYPE(MESSAGE), cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT),
+                                          varint(5) )),
+           cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ),
+           cat( tag(UPB_TYPE(FIXED64), UPB_WIRE_TYPE_64BIT), uint64(33) )),
+      LINE("<")
+      LINE("%u:7")
+      LINE(">"), int32_fn);
+  upb_decoderplan_unref(plan);
+
+  // Skipped values that run past the end of their submessage are errors, even
+  // though they end inside the buffer.
+  const char *sub_paths[] = {"f_message.f_int32"};
+  plan = upb_decoderplan_newprojection(h, sub_paths, 1, allowjit, &status);
+  ASSERT_STATUS(plan, &status);
+  uint32_t msg_fn = UPB_TYPE(MESSAGE);
+  buffer after = cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) );
+  assert_does_not_parse(
+      cat( submsg(msg_fn, cat( tag(UPB_TYPE(FIXED64), UPB_WIRE_TYPE_64BIT),
+                               uint32(1) )),
+           uint32(2), after ));
+  assert_does_not_parse(
+      cat( submsg(msg_fn, cat( tag(UPB_TYPE(STRING), UPB_WIRE_TYPE_DELIMITED),
+                               varint(4), buffer("ab") )),
+           buffer("cd"), after ));
+  upb_decoderplan_unref(plan);
+
+  // A path that does not name a field is an error.
+  const char *bad_paths[] = {"f_message.nonexistent"};
+  plan = upb_decoderplan_newprojection(h, bad_paths, 1, allowjit, &status);
+  ASSERT(!plan);
+  ASSERT(!upb_ok(&status));
+  plan = full;
+}
+
+void test_unknown_skipping(const upb_msgdef *md, bool allowjit) {
+  // Without an unknown field handler, unknown fields are skipped silently.
+  upb_handlers *h = upb_handlers_new(md, &h);
+  reghandlers(h);
+  upb_handlers_setunknown(h, NULL);
+  bool ok = upb_handlers_freeze(&h, 1, NULL);
+  ASSERT(ok);
+  upb_decoderplan *full = plan;
+  plan = upb_decoderplan_new(h, allowjit);
+  upb_handlers_unref(h, &h);
+
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  uint32_t msg_fn = UPB_TYPE(MESSAGE);
+  uint32_t repi_fn = rep_fn(int32_fn);
+  buffer unknown = cat(
+      cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_VARINT), varint(300) ),
+      cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_64BIT), uint64(5) ),
+      cat( tag(UNKNOWN_FIELD, UPB_WIRE_TYPE_32BIT), uint32(6) ),
+      cat( tag(UNKNOWN_FIELD + 100000, UPB_WIRE_TYPE_DELIMITED),
+           delim(buffer("abc")) ) );
+  // Known fields (including ones with large field numbers) around the
+  // unknown ones, also inside a submessage.
+  assert_successful_parse(
+      cat( cat( unknown, tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ),
+           submsg(msg_fn, cat( unknown, tag(repi_fn, UPB_WIRE_TYPE_VARINT),
+                               varint(8), unknown )),
+           cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(9) ),
+           unknown ),
+      LINE("<")
+      LINE("%u:7")
+      LINE("%u:{")
+      LINE("  <")
+      LINE("  %u:[")
+      LINE("    %u:8")
+      LINE("  ]")
+      LINE("  >")
+      LINE("}")
+      LINE("%u:[")
+      LINE("  %u:9")
+      LINE("]")
+      LINE(">"), int32_fn, msg_fn, repi_fn, repi_fn, repi_fn, repi_fn);
+
+  // An unknown value that runs past the end of its submessage.
+  assert_does_not_parse(
+      cat( submsg(msg_fn, cat( unknown, tag(UNKNOWN_FIELD,
+                                            UPB_WIRE_TYPE_DELIMITED) )),
+           varint(1), buffer("x"), unknown ));
+
+  // Field number zero is invalid even though we skip unknown fields.
+  assert_does_not_parse(
+      cat( unknown, tag(0, UPB_WIRE_TYPE_VARINT), varint(1), unknown ));
+
+  upb_decoderplan_unref(plan);
+  plan = full;
+}
+
+// A string view handler that returns false aborts the parse.
+void test_strview_abort(const upb_msgdef *md, bool allowjit) {
+  upb_handlers *h = upb_handlers_new(md, &h);
+  reghandlers(h);
+  uint32_t str_fn = UPB_TYPE(STRING);
+  ASSERT(h->SetStringViewHandler(
+      upb_msgdef_itof(md, str_fn), &reject_strview, NULL, NULL));
+  bool ok = upb_handlers_freeze(&h, 1, NULL);
+  ASSERT(ok);
+  upb_decoderplan *full = plan;
+  plan = upb_decoderplan_new(h, allowjit);
+  upb_handlers_unref(h, &h);
+
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  assert_does_not_parse(
+      cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED), delim(buffer("abc")),
+           tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ));
+
+  upb_decoderplan_unref(plan);
+  plan = full;
+}
+
+void write_buffer(FILE *f, const buffer& buf) {
+  ASSERT(fwrite(buf.buf(), 1, buf.len(), f) == buf.len());
+}
+
+// Decodes string views from a file, which upb_stdio reads in fixed-size
+// buffers.  The first string and a lazy submessage are pinned in the first
+// buffer, which has to stay valid while the buffers after it are read,
+// discarded and reused; the last string spans two buffers, so it is copied.
+void test_stdio_views() {
+  uint32_t str_fn = UPB_TYPE(STRING);
+  const size_t padding = 110000;
+  buffer big;
+  for (int i = 0; i < 3000; i++)
+    big.appendf("%09d\n", i);
+
+  FILE *f = tmpfile();
+  ASSERT(f);
+  write_buffer(f, cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED),
+                       delim(buffer("abc")),
+                       submsg(LAZY_FIELD, buffer("\xff\xff\xff")),
+                       tag(NOP_FIELD, UPB_WIRE_TYPE_DELIMITED),
+                       varint(padding) ));
+  buffer zeros(1000);
+  for (size_t i = 0; i < padding / zeros.len(); i++)
+    write_buffer(f, zeros);
+  write_buffer(f, cat( tag(str_fn, UPB_WIRE_TYPE_DELIMITED), delim(big) ));
+  rewind(f);
+
+  upb_stdio stdio;
+  upb_stdio_init(&stdio);
+  upb_stdio_reset(&stdio, f);
+  upb_decoder d;
+  upb_decoder_init(&d);
+  upb_decoder_resetplan(&d, plan);
+  upb_decoder_resetinput(&d, upb_stdio_allbytes(&stdio), &closures[0]);
+  output.clear();
+  upb_success_t success = upb_decoder_decode(&d);
+  ASSERT_STATUS(success == UPB_OK, upb_decoder_status(&d));
+
+  ASSERT(num_views == 3);
+  ASSERT(views[0].pinned_src == upb_stdio_bytesrc(&stdio));
+  ASSERT(views[0].size() == 3 && memcmp(views[0].data(), "abc", 3) == 0);
+  ASSERT(views[1].pinned_src == upb_stdio_bytesrc(&stdio));
+  ASSERT(views[1].size() == 3);
+  ASSERT(memcmp(views[1].data(), "\xff\xff\xff", 3) == 0);
+  ASSERT(views[2].pinned_src == NULL);
+  ASSERT(views[2].size() == big.len());
+  ASSERT(memcmp(views[2].data(), big.buf(), big.len()) == 0);
+  for (int i = 0; i < num_views; i++)
+    views[i].Release();
+  num_views = 0;
+
+  upb_decoder_uninit(&d);
+  upb_stdio_uninit(&stdio);
+  fclose(f);
+}
+
+void test_plancache(const upb_handlers *h) {
+  // While a plan is alive, building one for the same handlers returns it.
+  upb_decoderplan *p1 = upb_decoderplan_new(h, true);
+  upb_decoderplan *p2 = upb_decoderplan_new(h, true);
+  ASSERT(p1 == p2);
+  upb_decoderplan *nojit = upb_decoderplan_new(h, false);
+  ASSERT(nojit != p1);
+  ASSERT(!upb_decoderplan_hasjitcode(nojit));
+  ASSERT(!upb_decoderplan_hasbytecode(nojit));
+  upb_decoderplan_ref(nojit);
+  upb_decoderplan_unref(nojit);
+  ASSERT(upb_decoderplan_new(h, false) == nojit);
+  upb_decoderplan_unref(nojit);
+  upb_decoderplan_unref(nojit);
+
+  // Projections are never shared.
+  const char *paths[] = {"f_int32"};
+  upb_status status;
+  upb_decoderplan *proj = upb_decoderplan_newprojection(h, paths, 1, true,
+                                                        &status);
+  ASSERT_STATUS(proj, &status);
+  ASSERT(proj != p1);
+  upb_decoderplan_unref(proj);
+
+  // The plan stays usable until its last ref is dropped.
+  upb_decoderplan_unref(p1);
+  upb_decoderplan *full = plan;
+  plan = p2;
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  assert_successful_parse(
+      cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7) ),
+      LINE("<")
+      LINE("%u:7")
+      LINE(">"), int32_fn);
+  plan = full;
+  upb_decoderplan_unref(p2);
+}
+
+struct StoreMsg {
+  uint8_t has[2];
+  int32_t i32;
+  int64_t i64;
+  uint32_t u32;
+  uint64_t u64;
+  double dbl;
+  float flt;
+  bool b;
+  int32_t s32;
+  uint64_t f64;
+};
+
+void setstore(upb_handlers *h, uint32_t num, size_t ofs, int32_t hasbit) {
+  const upb_fielddef *f = upb_msgdef_itof(upb_handlers_msgdef(h), num);
+  ASSERT(f);
+  bool ok = upb_handlers_setstore(h, f, ofs, hasbit);
+  ASSERT(ok);
+}
+
+// Returns a plan for frozen handlers on "md" that skip unknown fields and
+// have the handlers registered by "reg".  The JIT needs handlers for every
+// submessage, so submessages get these same handlers.
+upb_decoderplan *newstoreplan(const upb_msgdef *md,
+                              void (*reg)(upb_handlers *h), bool allowjit) {
+  upb_handlers *h = upb_handlers_new(md, &h);
+  upb_handlers_setunknown(h, NULL);
+  reg(h);
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, md); !upb_msg_done(&i); upb_msg_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (upb_fielddef_issubmsg(f)) upb_handlers_setsubhandlers(h, f, h);
+  }
+  bool ok = upb_handlers_freeze(&h, 1, NULL);
+  ASSERT(ok);
+  upb_decoderplan *p = upb_decoderplan_new(h, allowjit);
+  upb_handlers_unref(h, &h);
+  return p;
+}
+
+// Decodes "proto" into a zeroed StoreMsg with buffer seams in every position,
+// passing each result to "check".
+void decode_store(upb_decoderplan *p, const buffer& proto,
+                  void (*check)(const StoreMsg *msg)) {
+  upb_seamsrc src;
+  upb_seamsrc_init(&src, proto.buf(), proto.len());
+  upb_decoder d;
+  upb_decoder_init(&d);
+  upb_decoder_resetplan(&d, p);
+  for (size_t i = 0; i < proto.len(); i++) {
+    upb_seamsrc_resetseams(&src, i, i, false);
+    StoreMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    upb_decoder_resetinput(&d, upb_seamsrc_allbytes(&src), &msg);
+    upb_success_t success = upb_decoder_decode(&d);
+    ASSERT_STATUS(success == UPB_OK, upb_decoder_status(&d));
+    check(&msg);
+  }
+  upb_decoder_uninit(&d);
+  upb_seamsrc_uninit(&src);
+}
+
+void store_reg(upb_handlers *h) {
+  setstore(h, UPB_TYPE(INT32), offsetof(StoreMsg, i32), 0);
+  setstore(h, UPB_TYPE(INT64), offsetof(StoreMsg, i64), 1);
+  setstore(h, UPB_TYPE(UINT32), offsetof(StoreMsg, u32), 2);
+  setstore(h, UPB_TYPE(UINT64), offsetof(StoreMsg, u64), 3);
+  setstore(h, UPB_TYPE(DOUBLE), offsetof(StoreMsg, dbl), 4);
+  setstore(h, UPB_TYPE(FLOAT), offsetof(StoreMsg, flt), 5);
+  setstore(h, UPB_TYPE(BOOL), offsetof(StoreMsg, b), -1);
+  setstore(h, UPB_TYPE(SINT32), offsetof(StoreMsg, s32), 9);
+  setstore(h, UPB_TYPE(FIXED64), offsetof(StoreMsg, f64), 10);
+}
+
+void store_check(const StoreMsg *msg) {
+  ASSERT(msg->has[0] == 0x1f);
+  ASSERT(msg->has[1] == 0x06);
+  ASSERT(msg->i32 == -5);
+  ASSERT(msg->i64 == 1LL << 40);
+  ASSERT(msg->u32 == 0xfffffffe);
+  ASSERT(msg->u64 == UINT64_MAX);
+  ASSERT(msg->dbl == 2.5);
+  ASSERT(msg->flt == 0);
+  ASSERT(msg->b);
+  ASSERT(msg->s32 == -77);
+  ASSERT(msg->f64 == 12345);
+}
+
+void test_store(const upb_msgdef *md, bool allowjit) {
+  upb_decoderplan *p = newstoreplan(md, &store_reg, allowjit);
+
+  // FLOAT is deliberately absent so its hasbit stays clear.
+  buffer head = cat(
+      cat( tag(UPB_TYPE(INT32), UPB_WIRE_TYPE_VARINT), varint(-5) ),
+      cat( tag(UPB_TYPE(INT64), UPB_WIRE_TYPE_VARINT), varint(1ULL << 40) ),
+      cat( tag(UPB_TYPE(UINT32), UPB_WIRE_TYPE_VARINT), varint(0xfffffffe) ),
+      cat( tag(UPB_TYPE(UINT64), UPB_WIRE_TYPE_VARINT), varint(UINT64_MAX) ),
+      cat( tag(UPB_TYPE(DOUBLE), UPB_WIRE_TYPE_64BIT), dbl(2.5) ) );
+  buffer proto = cat(
+      head,
+      cat( tag(UPB_TYPE(BOOL), UPB_WIRE_TYPE_VARINT), varint(1) ),
+      cat( tag(UPB_TYPE(SINT32), UPB_WIRE_TYPE_VARINT), zz32(-77) ),
+      cat( tag(UPB_TYPE(FIXED64), UPB_WIRE_TYPE_64BIT), uint64(12345) ),
+      thirty_byte_nop );
+
+  decode_store(p, proto, &store_check);
+  upb_decoderplan_unref(p);
+}
+
+static const upb_fieldlayout store_fields[] = {
+  {UPB_TYPE(INT32), offsetof(StoreMsg, i32), 0},
+  {UPB_TYPE(INT64), offsetof(StoreMsg, i64), 1},
+  {UPB_TYPE(DOUBLE), offsetof(StoreMsg, dbl), 4},
+  {UPB_TYPE(BOOL), offsetof(StoreMsg, b), -1},
+  {UPB_TYPE(SINT32), offsetof(StoreMsg, s32), 9},
+};
+static const upb_msglayout store_layout = {
+  store_fields, sizeof(store_fields) / sizeof(store_fields[0])
+};
+
+// Checks that the whole struct was filled in by the time the message ends.
+void layout_endmsg(void *c, upb_status *status) {
+  UPB_UNUSED(status);
+  StoreMsg *msg = (StoreMsg*)c;
+  ASSERT(msg->has[0] == 0x13);
+  ASSERT(msg->has[1] == 0x02);
+  ASSERT(msg->i32 == -5);
+  ASSERT(msg->i64 == 1LL << 40);
+  ASSERT(msg->dbl == 2.5);
+  ASSERT(msg->b);
+  ASSERT(msg->s32 == -77);
+  msg->u32 = 1;  // Tells the test that we were called.
+}
+
+void layout_reg(upb_handlers *h) {
+  upb_handlers_setendmsg(h, &layout_endmsg);
+  ASSERT(upb_handlers_setlayout(h, &store_layout));
+}
+
+void layout_check(const StoreMsg *msg) { ASSERT(msg->u32 == 1); }
+
+void test_layout(const upb_msgdef *md, bool allowjit) {
+  upb_decoderplan *p = newstoreplan(md, &layout_reg, allowjit);
+  buffer proto = cat(
+      cat( tag(UPB_TYPE(INT32), UPB_WIRE_TYPE_VARINT), varint(-5) ),
+      cat( tag(UPB_TYPE(INT64), UPB_WIRE_TYPE_VARINT), varint(1ULL << 40) ),
+      cat( tag(UPB_TYPE(DOUBLE), UPB_WIRE_TYPE_64BIT), dbl(2.5) ),
+      cat( tag(UPB_TYPE(BOOL), UPB_WIRE_TYPE_VARINT), varint(1) ),
+      cat( tag(UPB_TYPE(SINT32), UPB_WIRE_TYPE_VARINT), zz32(-77) ) );
+  decode_store(p, proto, &layout_check);
+  upb_decoderplan_unref(p);
+
+  // Fields must be primitive fields of the message, and a bad field leaves
+  // the handlers unchanged, even for the good fields before it.
+  static const upb_fieldlayout bad_fields[] = {
+    {UPB_TYPE(INT32), offsetof(StoreMsg, i32), 0},
+    {UPB_TYPE(STRING), 0, -1},
+  };
+  static const upb_msglayout bad_layout = {bad_fields, 2};
+  upb_handlers *h = upb_handlers_new(md, &h);
+  ASSERT(!upb_handlers_setlayout(h, &bad_layout));
+  upb_selector_t sel;
+  ASSERT(upb_getselector(upb_msgdef_itof(md, UPB_TYPE(INT32)),
+                         UPB_HANDLER_INT32, &sel));
+  ASSERT(upb_handlers_getstore(h, sel) == NULL);
+  upb_handlers_unref(h, &h);
+}
+
+// Decodes "proto" into a upb_encoder and checks that it re-encodes to
+// "expected", with buffer seams in every position.
+void assert_reencodes(upb_decoderplan *p, const buffer& proto,
+                      const buffer& expected) {
+  upb_seamsrc src;
+  upb_seamsrc_init(&src, proto.buf(), proto.len());
+  upb_decoder d;
+  upb_decoder_init(&d);
+  upb_decoder_resetplan(&d, p);
+  upb_encoder *e = upb_encoder_new();
+  upb_stringsink sink;
+  upb_stringsink_init(&sink);
+  for (size_t i = 0; i < proto.len(); i++) {
+    upb_seamsrc_resetseams(&src, i, i, true);
+    upb_stringsink_reset(&sink, (char*)malloc(16), 16);
+    upb_encoder_reset(e, upb_stringsink_bytesink(&sink));
+    upb_decoder_resetinput(&d, upb_seamsrc_allbytes(&src), e);
+    upb_success_t success;
+    while ((success = upb_decoder_decode(&d)) == UPB_SUSPENDED)
+      ;
+    ASSERT_STATUS(success == UPB_OK, upb_decoder_status(&d));
+    ASSERT_STATUS(upb_ok(upb_encoder_status(e)), upb_encoder_status(e));
+    ASSERT(buffer(sink.str, sink.len).eql(expected));
+  }
+  upb_stringsink_uninit(&sink);
+  upb_encoder_free(e);
+  upb_decoder_uninit(&d);
+  upb_seamsrc_uninit(&src);
+}
+
+void test_encoder(const upb_msgdef *md, bool allowjit) {
+  const upb_handlers *h = upb_encoder_newhandlers(&h, md);
+  upb_decoderplan *p = upb_decoderplan_new(h, allowjit);
+  upb_handlers_unref(h, &h);
+
+  uint32_t msg_fn = UPB_TYPE(MESSAGE);
+  uint32_t repi_fn = rep_fn(UPB_TYPE(INT32));
+  uint32_t reps_fn = rep_fn(UPB_TYPE(STRING));
+  float f = 1.5;
+  buffer head = cat(
+      cat( tag(UPB_TYPE(DOUBLE), UPB_WIRE_TYPE_64BIT), dbl(2.5),
+           tag(UPB_TYPE(FLOAT), UPB_WIRE_TYPE_32BIT), flt(f) ),
+      cat( tag(UPB_TYPE(INT64), UPB_WIRE_TYPE_VARINT), varint(1ULL << 40),
+           tag(UPB_TYPE(UINT64), UPB_WIRE_TYPE_VARINT), varint(UINT64_MAX) ),
+      cat( tag(UPB_TYPE(INT32), UPB_WIRE_TYPE_VARINT), varint(-5),
+           tag(UPB_TYPE(FIXED64), UPB_WIRE_TYPE_64BIT), uint64(12345) ),
+      cat( tag(UPB_TYPE(FIXED32), UPB_WIRE_TYPE_32BIT), uint32(0xfffffffe),
+           tag(UPB_TYPE(BOOL), UPB_WIRE_TYPE_VARINT), varint(1) ),
+      cat( tag(UPB_TYPE(UINT32), UPB_WIRE_TYPE_VARINT), varint(0xfffffffe),
+           tag(UPB_TYPE(ENUM), UPB_WIRE_TYPE_VARINT), varint(-1) ));
+  buffer scalars = cat(
+      head,
+      cat( tag(UPB_TYPE(SFIXED32), UPB_WIRE_TYPE_32BIT), uint32(-3),
+           tag(UPB_TYPE(SFIXED64), UPB_WIRE_TYPE_64BIT), uint64(-4) ),
+      cat( tag(UPB_TYPE(SINT32), UPB_WIRE_TYPE_VARINT), zz32(-77),
+           tag(UPB_TYPE(SINT64), UPB_WIRE_TYPE_VARINT), zz64(INT64_MIN) ),
+      cat( tag(UPB_TYPE(STRING), UPB_WIRE_TYPE_DELIMITED), delim(buffer("abc")),
+           tag(UPB_TYPE(BYTES), UPB_WIRE_TYPE_DELIMITED), delim(buffer(200)) ));
+
+  // Canonical input is reproduced exactly, including submessages whose
+  // parents have more data after them and strings nested inside them.
+  buffer canonical = cat(
+      scalars,
+      submsg(msg_fn, cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(1),
+                          submsg(msg_fn, scalars),
+                          tag(reps_fn, UPB_WIRE_TYPE_DELIMITED),
+                          delim(buffer(300)) )),
+      submsg(rep_fn(msg_fn), buffer()),
+      cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(2) ));
+  assert_reencodes(p, canonical, canonical);
+
+  // Packed input is written back unpacked.
+  assert_reencodes(
+      p,
+      cat( tag(repi_fn, UPB_WIRE_TYPE_DELIMITED),
+           delim(cat( varint(3), varint(-4) )) ),
+      cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(3),
+           tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(-4) ));
+
+  // Enough top-level data that it is flushed before the message ends.
+  buffer big;
+  for (int i = 0; i < 1000; i++) {
+    big.append(cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(i) ));
+  }
+  upb_stringsrc src;
+  upb_stringsrc_init(&src);
+  upb_stringsrc_reset(&src, big.buf(), big.len());
+  upb_decoder d;
+  upb_decoder_init(&d);
+  upb_decoder_resetplan(&d, p);
+  upb_encoder *e = upb_encoder_new();
+  upb_stringsink sink;
+  upb_stringsink_init(&sink);
+  upb_stringsink_reset(&sink, (char*)malloc(16), 16);
+  upb_encoder_reset(e, upb_stringsink_bytesink(&sink));
+  upb_decoder_resetinput(&d, upb_stringsrc_allbytes(&src), e);
+  ASSERT_STATUS(upb_decoder_decode(&d) == UPB_OK, upb_decoder_status(&d));
+  ASSERT(buffer(sink.str, sink.len).eql(big));
+  upb_stringsink_uninit(&sink);
+  upb_encoder_free(e);
+  upb_decoder_uninit(&d);
+  upb_stringsrc_uninit(&src);
+
+  upb_decoderplan_unref(p);
+}
+
+size_t count_bytes(void *c, void *d, const char *buf, size_t n) {
+  UPB_UNUSED(d);
+  UPB_UNUSED(buf);
+  *(size_t*)c += n;
+  return n;
+}
+
+// The selector-based upb_sink functions should reach the same handlers as the
+// ones that take a field.
+void test_sink_sel(const upb_msgdef *md) {
+  upb_handlers *h = upb_handlers_new(md, &h);
+  setstore(h, UPB_TYPE(INT32), offsetof(StoreMsg, i32), 0);
+  setstore(h, UPB_TYPE(DOUBLE), offsetof(StoreMsg, dbl), 4);
+  const upb_fielddef *str_f = upb_msgdef_itof(md, UPB_TYPE(STRING));
+  upb_handlers_setstring(h, str_f, &count_bytes, NULL, NULL);
+  bool ok = upb_handlers_freeze(&h, 1, NULL);
+  ASSERT(ok);
+
+  const upb_fielddef *i32_f = upb_msgdef_itof(md, UPB_TYPE(INT32));
+  const upb_fielddef *dbl_f = upb_msgdef_itof(md, UPB_TYPE(DOUBLE));
+  upb_selector_t i32_sel, dbl_sel, str_sel;
+  ASSERT(upb_getselector(i32_f, UPB_HANDLER_INT32, &i32_sel));
+  ASSERT(upb_getselector(dbl_f, UPB_HANDLER_DOUBLE, &dbl_sel));
+  ASSERT(upb_getselector(str_f, UPB_HANDLER_STRING, &str_sel));
+
+  upb_sink sink;
+  upb_sink_init(&sink, h);
+  StoreMsg msg;
+  memset(&msg, 0, sizeof(msg));
+  upb_sink_reset(&sink, &msg);
+  ASSERT(upb_sink_putint32_sel(&sink, i32_sel, -9));
+  ASSERT(upb_sink_putdouble_sel(&sink, dbl_sel, 0.5));
+  ASSERT(msg.i32 == -9 && msg.dbl == 0.5 && msg.has[0] == 0x11);
+  ASSERT(upb_sink_putint32(&sink, i32_f, 7));
+  ASSERT(msg.i32 == 7);
+  // Fields without a handler are ignored.
+  const upb_fielddef *i64_f = upb_msgdef_itof(md, UPB_TYPE(INT64));
+  upb_selector_t i64_sel;
+  ASSERT(upb_getselector(i64_f, UPB_HANDLER_INT64, &i64_sel));
+  ASSERT(upb_sink_putint64_sel(&sink, i64_sel, 1));
+  ASSERT(msg.i64 == 0);
+
+  size_t bytes = 0;
+  upb_sink_reset(&sink, &bytes);
+  ASSERT(upb_sink_putstring_sel(&sink, str_sel, "abc", 3) == 3);
+  ASSERT(upb_sink_putstring(&sink, str_f, "de", 2) == 2);
+  ASSERT(bytes == 5);
+
+  upb_sink_uninit(&sink);
+  upb_handlers_unref(h, &h);
+}
+
+void test_records() {
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  uint32_t msg_fn = UPB_TYPE(MESSAGE);
+  uint32_t repi_fn = rep_fn(int32_fn);
+  buffer rec1 = cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(7),
+                     submsg(msg_fn, cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT),
+                                         varint(8) )) );
+  // A repeated field that is still open when its record ends.
+  buffer rec2 = cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(1),
+                     tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(2) );
+  const char *rec1_text =
+      LINE("<")
+      LINE("%u:7")
+      LINE("%u:{")
+      LINE("  <")
+      LINE("  %u:8")
+      LINE("  >")
+      LINE("}")
+      LINE(">");
+  const char *rec2_text =
+      LINE("<")
+      LINE("%u:[")
+      LINE("  %u:1")
+      LINE("  %u:2")
+      LINE("]")
+      LINE(">");
+
+  // Each record (including an empty one) is its own startmsg/endmsg pair.
+  // The last record is padded so that the earlier ones are in JIT range.
+  buffer stream = cat( delim(rec1), delim(rec2), delim(empty), delim(rec1),
+                       delim(cat( rec2, thirty_byte_nop )) );
+  buffer expected;
+  expected.appendf(rec1_text, int32_fn, msg_fn, int32_fn);
+  expected.appendf(rec2_text, repi_fn, repi_fn, repi_fn);
+  expected.append(LINE("<") LINE(">"));
+  expected.appendf(rec1_text, int32_fn, msg_fn, int32_fn);
+  expected.appendf(rec2_text, repi_fn, repi_fn, repi_fn);
+  run_decoder(stream, &expected, true);
+
+  // An empty stream has no records.
+  run_decoder(empty, &empty, true);
+
+  // The stream may not end inside a record or its length.
+  run_decoder(cat( delim(rec1), varint(rec2.len() + 1), rec2 ), NULL, true);
+  run_decoder(cat( delim(rec1), buffer("\x80") ), NULL, true);
+
+  // A value may not cross the end of its record.
+  buffer truncated(rec2.buf(), rec2.len() - 1);
+  run_decoder(cat( delim(truncated), delim(rec1) ), NULL, true);
+}
+
+struct RecordChunk {
+  uint64_t first_record;
+  size_t num_records;
+  uint64_t records;
+  int64_t sum;
+};
+
+struct ParallelRun {
+  RecordChunk chunks[1024];
+  size_t delivered;
+  bool ordered;
+  bool expect_error;
+};
+
+// These are called on the worker threads, so they do not count assertions.
+void *parallel_startchunk(void *ud, size_t chunk, uint64_t first_record,
+                          size_t num_records) {
+  RecordChunk *c = &static_cast<ParallelRun*>(ud)->chunks[chunk];
+  c->first_record = first_record;
+  c->num_records = num_records;
+  c->records = 0;
+  c->sum = 0;
+  return c;
+}
+
+bool parallel_startmsg(void *c) {
+  static_cast<RecordChunk*>(c)->records++;
+  return true;
+}
+
+bool parallel_int32(void *c, void *d, int32_t val) {
+  UPB_UNUSED(d);
+  static_cast<RecordChunk*>(c)->sum += val;
+  return true;
+}
+
+void parallel_endchunk(void *ud, size_t chunk, void *closure,
+                       const upb_status *status) {
+  ParallelRun *run = static_cast<ParallelRun*>(ud);
+  ASSERT(closure == &run->chunks[chunk]);
+  if (!run->expect_error) ASSERT_STATUS(upb_ok(status), status);
+  if (run->ordered) ASSERT(chunk == run->delivered);
+  run->delivered++;
+}
+
+void parallel_reg(upb_handlers *h) {
+  const upb_msgdef *md = upb_handlers_msgdef(h);
+  upb_handlers_setstartmsg(h, &parallel_startmsg);
+  ASSERT(upb_handlers_setint32(h, upb_msgdef_itof(md, UPB_TYPE(INT32)),
+                               &parallel_int32, NULL, NULL));
+  ASSERT(upb_handlers_setint32(h, upb_msgdef_itof(md, rep_fn(UPB_TYPE(INT32))),
+                               &parallel_int32, NULL, NULL));
+}
+
+void test_parallel(const upb_msgdef *md, bool allowjit) {
+  upb_decoderplan *p = newstoreplan(md, &parallel_reg, allowjit);
+  uint32_t int32_fn = UPB_TYPE(INT32);
+  uint32_t repi_fn = rep_fn(int32_fn);
+
+  // Record i holds i once as a singular and once as a repeated field, plus 1.
+  const int num_records = 500;
+  buffer stream;
+  for (int i = 0; i < num_records; i++) {
+    stream.append(delim(cat( tag(int32_fn, UPB_WIRE_TYPE_VARINT), varint(i),
+                             tag(repi_fn, UPB_WIRE_TYPE_VARINT), varint(i),
+                             cat( tag(repi_fn, UPB_WIRE_TYPE_VARINT),
+                                  varint(1) ) )));
+  }
+  int64_t expected_sum = (int64_t)num_records * (num_records - 1) + num_records;
+
+  upb_parallel_opts opts;
+  upb_parallel_opts_init(&opts);
+  opts.startchunk = &parallel_startchunk;
+  opts.endchunk = &parallel_endchunk;
+  size_t chunk_sizes[] = {1, 100, 64 * 1024};
+  for (int threads = 1; threads <= 4; threads += 3) {
+  for (int ordered = 0; ordered < 2; ordered++) {
+  for (size_t j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); j++) {
+    ParallelRun run;
+    run.delivered = 0;
+    run.ordered = ordered;
+    run.expect_error = false;
+    opts.num_threads = threads;
+    opts.ordered = ordered;
+    opts.chunk_bytes = chunk_sizes[j];
+    opts.ud = &run;
+    upb_status status;
+    bool ok = upb_decode_records_parallel(p, stream.buf(), stream.len(),
+                                          &opts, &status);
+    ASSERT_STATUS(ok, &status);
+
+    // The chunks cover every record once, in order.
+    uint64_t covered = 0;
+    int64_t sum = 0;
+    size_t n = 0;
+    for (; covered < (uint64_t)num_records; n++) {
+      RecordChunk *c = &run.chunks[n];
+      ASSERT(c->first_record == covered);
+      ASSERT(c->records == c->num_records);
+      covered += c->num_records;
+      sum += c->sum;
+    }
+    ASSERT(run.delivered == n);
+    ASSERT(sum == expected_sum);
+  }
+  }
+  }
+
+  // A stream whose last record is cut short is rejected before decoding.
+  ParallelRun run;
+  run.delivered = 0;
+  run.ordered = true;
+  run.expect_error = true;
+  opts.num_threads = 4;
+  opts.chunk_bytes = 100;
+  opts.ud = &run;
+  upb_status status;
+  buffer truncated(stream.buf(), stream.len() - 1);
+  ASSERT(!upb_decode_records_parallel(p, truncated.buf(), truncated.len(),
+                                      &opts, &status));
+  ASSERT(!upb_ok(&status));
+  ASSERT(run.delivered == 0);
+
+  // A record that does not decode fails the whole stream.
+  upb_status_clear(&status);
+  buffer bad =
+      cat( stream, delim(tag(int32_fn, UPB_WIRE_TYPE_VARINT)), stream );
+  ASSERT(!upb_decode_records_parallel(p, bad.buf(), bad.len(), &opts,
+                                      &status));
+  ASSERT(!upb_ok(&status));
+  ASSERT(run.delivered > 0);
+
+  upb_decoderplan_unref(p);
+}
+
 void run_tests() {
   test_invalid();
   test_valid();
+  test_records();
 }
 
 extern "C" {
@@ -856,23 +1860,89 @@ int run_tests(int argc, char *argv[]) {
   upb_decoderplan_unref(plan);
 
   // Construct decoder plan.
-  h = upb_handlers_new(UPB_TEST_DECODER_DECODERTEST, &h);
+  const upb_msgdef *md = UPB_TEST_DECODER_DECODERTEST;
+  h = upb_handlers_new(md, &h);
   reghandlers(h);
   ok = upb_handlers_freeze(&h, 1, NULL);
 
+  test_plancache(h);
+  test_sink_sel(md);
+
   // Test without JIT.
   plan = upb_decoderplan_new(h, false);
   ASSERT(!upb_decoderplan_hasjitcode(plan));
   run_tests();
+  test_projection(h, false);
+  test_unknown_skipping(md, false);
+  test_store(md, false);
+  test_layout(md, false);
+  test_encoder(md, false);
+  test_parallel(md, false);
   upb_decoderplan_unref(plan);
 
-#ifdef UPB_USE_JIT_X64
-  // Test JIT.
+  // Test JIT, or bytecode where the JIT is not available.
   plan = upb_decoderplan_new(h, true);
+#ifdef UPB_USE_JIT_X64
   ASSERT(upb_decoderplan_hasjitcode(plan));
+#else
+  ASSERT(upb_decoderplan_hasbytecode(plan));
+#endif
   run_tests();
+  test_projection(h, true);
+  test_unknown_skipping(md, true);
+  test_store(md, true);
+  test_layout(md, true);
+  test_encoder(md, true);
+  test_parallel(md, true);
+  upb_decoderplan_unref(plan);
+
+  // Test with array handlers for the repeated primitive fields; the output
+  // should be the same.
+  upb_handlers *arrayh = upb_handlers_new(md, &arrayh);
+  reghandlers(arrayh);
+  reg_arrayhandlers(arrayh);
+  ok = upb_handlers_freeze(&arrayh, 1, NULL);
+  ASSERT(ok);
+  plan = upb_decoderplan_new(arrayh, false);
+  run_tests();
+  upb_decoderplan_unref(plan);
+  plan = upb_decoderplan_new(arrayh, true);
+  run_tests();
+  upb_decoderplan_unref(plan);
+  upb_handlers_unref(arrayh, &arrayh);
+
+  // Test with string view handlers for the string fields; the output should
+  // be the same.
+  upb_handlers *viewh = upb_handlers_new(md, &viewh);
+  reghandlers(viewh);
+  reg_strview(viewh, UPB_TYPE(STRING));
+  reg_strview(viewh, UPB_TYPE(BYTES));
+  reg_strview(viewh, rep_fn(UPB_TYPE(STRING)));
+  reg_strview(viewh, rep_fn(UPB_TYPE(BYTES)));
+  ok = upb_handlers_freeze(&viewh, 1, NULL);
+  ASSERT(ok);
+  plan = upb_decoderplan_new(viewh, false);
+  run_tests();
+  test_stdio_views();
+  upb_decoderplan_unref(plan);
+  plan = upb_decoderplan_new(viewh, true);
+  run_tests();
+  test_strview_abort(md, false);
+  test_strview_abort(md, true);
+  test_stdio_views();
+  upb_decoderplan_unref(plan);
+  upb_handlers_unref(viewh, &viewh);
+
+  // Test the precompiled decoder that upbc generated for DecoderTest.  This
+  // comes last because registration is permanent: from here on every plan
+  // that allows generated code for DecoderTest will use it.
+  upb_aot_register(UPB_TEST_DECODER_DECODERTEST_DECODER);
+  plan = upb_decoderplan_new(h, true);
+  ASSERT(upb_decoderplan_hasaot(plan));
+  run_tests();
+  test_unknown_skipping(md, true);
+  test_store(md, true);
   upb_decoderplan_unref(plan);
-#endif
 
   plan = NULL;
   printf("All tests passed, %d assertions.\n", num_assertions);
@@ -8,6 +8,7 @@
  */
 
 #include "upb/def.h"
+#include "upb/handlers.h"
 #include "upb/pb/glue.h"
 #include "upb_test.h"
 #include <stdlib.h>
@@ -256,6 +257,58 @@ static void test_partial_freeze() {
   upb_msgdef_unref(m3, &m3);
 }
 
+static void count_handlers(void *closure, upb_handlers *h) {
+  UPB_UNUSED(h);
+  (*(int*)closure)++;
+}
+
+static const upb_handlers *getsub(const upb_handlers *h, const char *name) {
+  const upb_fielddef *f = upb_msgdef_ntof(upb_handlers_msgdef(h), name);
+  ASSERT(f);
+  return upb_handlers_getsubhandlers(h, f);
+}
+
+static void test_handlerscache() {
+  upb_symtab *s = load_test_proto(&s);
+  const upb_msgdef *a = upb_symtab_lookupmsg(s, "A", &a);
+  const upb_msgdef *d = upb_symtab_lookupmsg(s, "D", &d);
+  const upb_msgdef *f = upb_symtab_lookupmsg(s, "F", &f);
+  upb_symtab_unref(s, &s);
+
+  int count = 0;
+  upb_handlerscache *c = upb_handlerscache_new(&count_handlers, &count);
+  ASSERT(c);
+
+  // F -> E.
+  const upb_handlers *fh = upb_handlerscache_get(c, f, &fh);
+  ASSERT(fh && upb_handlers_isfrozen(fh));
+  ASSERT(count == 2);
+
+  // D reaches A, B, C, D and E, but E was already built for F.
+  const upb_handlers *dh = upb_handlerscache_get(c, d, &dh);
+  ASSERT(dh && upb_handlers_isfrozen(dh));
+  ASSERT(count == 6);
+  ASSERT(getsub(dh, "e") == getsub(fh, "e"));
+  ASSERT(getsub(dh, "d") == dh);
+
+  // A was built as part of D's graph.
+  const upb_handlers *ah = upb_handlerscache_get(c, a, &ah);
+  ASSERT(count == 6);
+  ASSERT(ah == getsub(dh, "a"));
+
+  // The handlers outlive the cache.
+  upb_handlerscache_free(c);
+  const upb_handlers *ch = getsub(getsub(ah, "b"), "c");
+  ASSERT(getsub(ch, "d") == dh);
+  ASSERT(getsub(ch, "a") == ah);
+  upb_handlers_unref(fh, &fh);
+  upb_handlers_unref(dh, &dh);
+  upb_handlers_unref(ah, &ah);
+  upb_msgdef_unref(a, &a);
+  upb_msgdef_unref(d, &d);
+  upb_msgdef_unref(f, &f);
+}
+
 int run_tests(int argc, char *argv[]) {
   if (argc < 2) {
     fprintf(stderr, "Usage: test_def <test.proto.pb>\n");
@@ -269,5 +322,6 @@ int run_tests(int argc, char *argv[]) {
   test_replacement();
   test_freeze_free();
   test_partial_freeze();
+  test_handlerscache();
   return 0;
 }
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "upb/pb/varint.h"
 #include "upb_test.h"
 
@@ -91,11 +92,155 @@ TEST_VARINT_DECODER(check2_branch64);
 TEST_VARINT_DECODER(check2_wright);
 TEST_VARINT_DECODER(check2_massimino);
 
+// Encodes a mix of varint lengths, including runs of one-byte varints long
+// enough to take the 16-at-a-time path.
+static size_t encode_bulk_input(char *buf, uint64_t *nums, size_t count) {
+  size_t len = 0;
+  uint64_t big = 5;
+  for (size_t i = 0; i < count; i++) {
+    if ((i / 20) % 2 == 0) {
+      nums[i] = i % 128;
+    } else {
+      big = (big * 1.5 > big) ? big * 1.5 : 5;
+      nums[i] = big;
+    }
+    len += upb_vencode64(nums[i], buf + len);
+  }
+  return len;
+}
+
+// Deterministic pseudo-random values whose varints are 1 to "maxbytes" bytes
+// long, spread evenly over the lengths.
+static uint64_t rand_state = 1;
+static uint64_t rand_varint(int maxbytes) {
+  rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  uint64_t r = rand_state ^ (rand_state >> 29);
+  int bytes = 1 + (rand_state >> 58) % maxbytes;
+  if (bytes == 1) return r & 0x7f;
+  uint64_t low = 1ULL << (7 * (bytes - 1));
+  return low | (r & (low - 1));
+}
+
+static size_t encode_rand_input(char *buf, uint64_t *nums, size_t count,
+                                int maxbytes) {
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++) {
+    nums[i] = rand_varint(maxbytes);
+    len += upb_vencode64(nums[i], buf + len);
+  }
+  return len;
+}
+
+// Decodes all of [buf, buf+len) in bulk in chunks of "chunk" values.
+static void check_bulk(const char *buf, size_t len, const uint64_t *nums,
+                       size_t count, size_t chunk) {
+  const char *p = buf;
+  size_t total = 0;
+  uint64_t vals64[64];
+  uint32_t vals32[64];
+  ASSERT(chunk <= 64);
+  while (total < count) {
+    size_t n64 = chunk;
+    size_t n32 = chunk;
+    const char *p64 = upb_vdecode_bulk64(p, buf + len, vals64, &n64);
+    const char *p32 = upb_vdecode_bulk32(p, buf + len, vals32, &n32);
+    ASSERT(p64 != NULL);
+    ASSERT(p64 == p32);
+    ASSERT(n64 == n32);
+    ASSERT(n64 == UPB_MIN(chunk, count - total));
+    for (size_t i = 0; i < n64; i++) {
+      ASSERT(vals64[i] == nums[total + i]);
+      ASSERT(vals32[i] == (uint32_t)nums[total + i]);
+    }
+    total += n64;
+    p = p64;
+  }
+  ASSERT(p == buf + len);
+}
+
+static void test_bulk() {
+  printf("Testing bulk varint decoder...");
+  fflush(stdout);
+  enum { COUNT = 200 };
+  char buf[COUNT * UPB_PB_VARINT_MAX_LEN];
+  uint64_t nums[COUNT];
+  size_t len = encode_bulk_input(buf, nums, COUNT);
+
+  // Every prefix of the input, decoded in chunks of several sizes: the values
+  // that fit must be decoded and a varint cut off by "end" must be left alone.
+  // Each prefix is copied to a buffer of exactly its size, so that reading
+  // past "end" is caught by memory checkers.
+  for (size_t end = 0; end <= len; end++) {
+    char *prefix = malloc(end + 1);
+    memcpy(prefix, buf, end);
+    for (size_t chunk = 1; chunk <= 40; chunk += 13) {
+      const char *p = prefix;
+      size_t total = 0;
+      uint64_t vals64[40];
+      uint32_t vals32[40];
+      while (1) {
+        size_t n64 = chunk;
+        size_t n32 = chunk;
+        const char *p64 = upb_vdecode_bulk64(p, prefix + end, vals64, &n64);
+        const char *p32 = upb_vdecode_bulk32(p, prefix + end, vals32, &n32);
+        ASSERT(p64 != NULL);
+        ASSERT(p64 == p32);
+        ASSERT(n64 == n32);
+        ASSERT(n64 <= chunk);
+        for (size_t i = 0; i < n64; i++) {
+          ASSERT(vals64[i] == nums[total + i]);
+          ASSERT(vals32[i] == (uint32_t)nums[total + i]);
+        }
+        total += n64;
+        p = p64;
+        if (n64 < chunk) break;
+      }
+      // We stopped at "end" or just before a varint that crosses it.
+      size_t consumed = 0;
+      char tmp[UPB_PB_VARINT_MAX_LEN];
+      for (size_t i = 0; i < total; i++)
+        consumed += upb_vencode64(nums[i], tmp);
+      ASSERT(p == prefix + consumed);
+      ASSERT(total == COUNT ||
+             consumed + upb_vencode64(nums[total], tmp) > end);
+    }
+    free(prefix);
+  }
+
+  // Unterminated (11-byte) varints are errors, wherever they appear.
+  char bad[48];
+  memset(bad, 0, sizeof(bad));
+  memset(bad + 20, 0x80, 11);
+  uint64_t vals[48];
+  size_t n = 48;
+  ASSERT(upb_vdecode_bulk64(bad, bad + sizeof(bad), vals, &n) == NULL);
+  n = 48;
+  ASSERT(upb_vdecode_bulk64(bad + 20, bad + 32, vals, &n) == NULL);
+  // ...but fewer than ten continuation bytes cut off by "end" are just
+  // incomplete.
+  n = 48;
+  ASSERT(upb_vdecode_bulk64(bad, bad + 29, vals, &n) == bad + 20);
+  ASSERT(n == 20);
+
+  // Random mixes of lengths, so that every arrangement of short varints in a
+  // window is likely to be seen.
+  for (int maxbytes = 1; maxbytes <= 6; maxbytes++) {
+    enum { RCOUNT = 2000 };
+    char rbuf[RCOUNT * UPB_PB_VARINT_MAX_LEN];
+    uint64_t rnums[RCOUNT];
+    size_t rlen = encode_rand_input(rbuf, rnums, RCOUNT, maxbytes);
+    for (size_t chunk = 1; chunk <= 64; chunk += 7)
+      check_bulk(rbuf, rlen, rnums, RCOUNT, chunk);
+  }
+  printf("ok.\n");
+}
+
 int run_tests() {
   test_check2_branch32();
   test_check2_branch64();
   test_check2_wright();
   test_check2_massimino();
+  test_bulk();
   return 0;
 }
 
@@ -0,0 +1,247 @@
+--[[
+
+  upb - a minimalist implementation of protocol buffers.
+
+  Copyright (c) 2012 Google Inc.  See LICENSE for details.
+  Author: Josh Haberman <jhaberman@gmail.com>
+
+  Routines for generating precompiled decoders (see upb_aotdecoder in
+  upb/pb/decoder.h) for the messages in a symtab.
+
+  Each message gets a function that decodes its primitive fields straight
+  from the buffer.  Like the JIT it expects fields to arrive in field number
+  order: after each value it compares the next bytes against the tag of the
+  next field (or of the same field again, if it is repeated) and jumps
+  straight to that field's code, and only decodes the tag and switches on it
+  when the prediction misses.  Everything else (strings, submessages,
+  unknown fields, packed fields) is left to the decoder.
+
+--]]
+
+local upb = require "upb"
+local export = {}
+
+-- How to decode and deliver a value of each primitive type:
+--   {wire type, handler name, C type, conversion of the decoded value}
+-- For varints the decoded value is "r.val"; fixed-size values are copied
+-- straight into a variable of the C type.
+local types = {
+  [upb.TYPE_DOUBLE]   = {1, "double", "double"},
+  [upb.TYPE_FLOAT]    = {5, "float",  "float"},
+  [upb.TYPE_INT64]    = {0, "int64",  "int64_t",  "(int64_t)r.val"},
+  [upb.TYPE_UINT64]   = {0, "uint64", "uint64_t", "r.val"},
+  [upb.TYPE_INT32]    = {0, "int32",  "int32_t",  "(int32_t)r.val"},
+  [upb.TYPE_FIXED64]  = {1, "uint64", "uint64_t"},
+  [upb.TYPE_FIXED32]  = {5, "uint32", "uint32_t"},
+  [upb.TYPE_BOOL]     = {0, "bool",   "bool",     "r.val != 0"},
+  [upb.TYPE_UINT32]   = {0, "uint32", "uint32_t", "(uint32_t)r.val"},
+  [upb.TYPE_ENUM]     = {0, "int32",  "int32_t",  "(int32_t)r.val"},
+  [upb.TYPE_SFIXED32] = {5, "int32",  "int32_t"},
+  [upb.TYPE_SFIXED64] = {1, "int64",  "int64_t"},
+  [upb.TYPE_SINT32]   = {0, "int32",  "int32_t",
+                         "upb_zzdec_32((uint32_t)r.val)"},
+  [upb.TYPE_SINT64]   = {0, "int64",  "int64_t",  "upb_zzdec_64(r.val)"},
+}
+
+local fixed_size = {[1] = 8, [5] = 4}
+
+-- upb.TYPE_INT32 -> "UPB_TYPE_INT32"
+local function type_const(t)
+  for k, v in pairs(upb) do
+    if v == t and string.find(k, "^TYPE_") then
+      return "UPB_" .. k
+    end
+  end
+  assert(false, "Couldn't find constant")
+end
+
+local function to_cident(name)
+  return (string.gsub(name, "%.", "_"))
+end
+
+local function to_preproc(name)
+  return string.upper(to_cident(name))
+end
+
+-- The bytes of a varint, as an array of numbers.
+local function varint_bytes(val)
+  local bytes = {}
+  repeat
+    local byte = val % 128
+    val = (val - byte) / 128
+    if val > 0 then byte = byte + 128 end
+    bytes[#bytes + 1] = byte
+  until val == 0
+  return bytes
+end
+
+-- A C expression that is true if the bytes at "p" are the tag of "field".
+local function tag_matches(field)
+  local conds = {}
+  for i, byte in ipairs(field.tag_bytes) do
+    conds[#conds + 1] = string.format("(uint8_t)p[%d] == 0x%02x", i - 1, byte)
+  end
+  return table.concat(conds, " && ")
+end
+
+-- Emits a jump to "field" if its tag is next.
+local function emit_prediction(append, field)
+  append("  if (%s) {\n", tag_matches(field))
+  append("    p += %d;\n", #field.tag_bytes)
+  append("    goto f%d;\n", field.index)
+  append("  }\n")
+end
+
+local function sorted_fields(msg)
+  local fields = {}
+  for field in msg:fields() do
+    fields[#fields + 1] = field
+  end
+  table.sort(fields, function(a, b) return a:number() < b:number() end)
+  return fields
+end
+
+local function dump_msg_c(msg, append)
+  local cident = to_cident(msg:full_name())
+  local fields = sorted_fields(msg)
+
+  -- The fields we decode ourselves, with their index in "fields" (which is
+  -- also their index in upb_decoder_aotfields()).
+  local handled = {}
+  for i, f in ipairs(fields) do
+    local t = types[f:type()]
+    if t then
+      handled[#handled + 1] = {
+        index = i - 1,
+        def = f,
+        type = t,
+        tag = f:number() * 8 + t[1],
+        tag_bytes = varint_bytes(f:number() * 8 + t[1]),
+      }
+    end
+  end
+
+  if #fields > 0 then
+    append("static const upb_aotfield %s_fields[] = {\n", cident)
+    for _, f in ipairs(fields) do
+      append("  {%d, %s},\n", f:number(), type_const(f:type()))
+    end
+    append("};\n\n")
+  end
+
+  append("static const char *%s_decode(upb_decoder *d, const char *p,\n",
+         cident)
+  append("    const char *end) {\n")
+  if #handled == 0 then
+    append("  (void)d;\n")
+    append("  (void)end;\n")
+    append("  return p;\n")
+    append("}\n\n")
+    return
+  end
+
+  append("  upb_decoderplan_field *const *f = upb_decoder_aotfields(d);\n")
+  append("  const char *tagp = p;  // Where we return if we can't go on.\n")
+  append("  upb_decoderet r;\n")
+  emit_prediction(append, handled[1])
+  append("  goto dispatch;\n\n")
+
+  for i, field in ipairs(handled) do
+    local t = field.type
+    append("  // %s = %d\n", field.def:name(), field.def:number())
+    append("f%d:\n", field.index)
+    append("  if (!upb_decoder_aotcanput(d, f[%d])) return tagp;\n",
+           field.index)
+    if t[1] == 0 then
+      append("  r = upb_vdecode_fast(p);\n")
+      append("  if (!r.p) return tagp;\n")
+      append("  p = r.p;\n")
+      append("  upb_decoder_aotput%s(d, f[%d], %s);\n",
+             t[2], field.index, t[4])
+    else
+      append("  {\n")
+      append("    %s val;\n", t[3])
+      append("    memcpy(&val, p, %d);\n", fixed_size[t[1]])
+      append("    p += %d;\n", fixed_size[t[1]])
+      append("    upb_decoder_aotput%s(d, f[%d], val);\n", t[2], field.index)
+      append("  }\n")
+    end
+    append("  if (p >= end) return p;\n")
+    append("  tagp = p;\n")
+    if field.def:label() == upb.LABEL_REPEATED then
+      emit_prediction(append, field)
+    end
+    if handled[i + 1] then
+      emit_prediction(append, handled[i + 1])
+    end
+    append("  goto dispatch;\n\n")
+  end
+
+  append("dispatch:\n")
+  append("  r = upb_vdecode_fast(p);\n")
+  append("  if (!r.p) return tagp;\n")
+  append("  p = r.p;\n")
+  append("  switch (r.val) {\n")
+  for _, field in ipairs(handled) do
+    append("    case %d: goto f%d;\n", field.tag, field.index)
+  end
+  append("    default: return tagp;\n")
+  append("  }\n")
+  append("}\n\n")
+end
+
+local function emit_file_warning(append)
+  append('// This file was generated by upbc (the upb compiler).\n')
+  append('// Do not edit -- your changes will be discarded when the file is\n')
+  append('// regenerated.\n\n')
+end
+
+local function dump_decoders_c(symtab, hfilename, append)
+  emit_file_warning(append)
+  append('#include <string.h>\n')
+  append('#include "%s"\n', hfilename)
+  append('#include "upb/pb/varint.h"\n\n')
+  for _, msg in ipairs(symtab:getdefs(upb.DEF_MSG)) do
+    local cident = to_cident(msg:full_name())
+    dump_msg_c(msg, append)
+    local fields = "NULL"
+    if #msg > 0 then fields = cident .. "_fields" end
+    append('const upb_aotdecoder %s_decoder = {\n', cident)
+    append('  "%s", %s, %d, &%s_decode\n', msg:full_name(), fields, #msg,
+           cident)
+    append('};\n\n')
+  end
+end
+
+local function dump_decoders_h(symtab, basename, append)
+  local ucase_basename = string.upper(basename)
+  emit_file_warning(append)
+  append('#ifndef %s_UPBDEC_H_\n', ucase_basename)
+  append('#define %s_UPBDEC_H_\n\n', ucase_basename)
+  append('#include "upb/pb/decoder.h"\n\n')
+  append('#ifdef __cplusplus\n')
+  append('extern "C" {\n')
+  append('#endif\n\n')
+
+  append("// Register these with upb_aot_register().\n")
+  for _, msg in ipairs(symtab:getdefs(upb.DEF_MSG)) do
+    local cident = to_cident(msg:full_name())
+    append("extern const upb_aotdecoder %s_decoder;\n", cident)
+    append("#define %s_DECODER (&%s_decoder)\n",
+           to_preproc(msg:full_name()), cident)
+  end
+  append("\n")
+
+  append('#ifdef __cplusplus\n')
+  append('};  // extern "C"\n')
+  append('#endif\n\n')
+  append('#endif  // %s_UPBDEC_H_\n', ucase_basename)
+end
+
+-- "hfilename" is the name that the C file should #include the header by.
+function export.dump_decoders(symtab, basename, hfilename, append_h, append_c)
+  dump_decoders_h(symtab, basename, append_h)
+  dump_decoders_c(symtab, hfilename, append_c)
+end
+
+return export
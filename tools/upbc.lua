@@ -6,21 +6,27 @@
   Author: Josh Haberman <jhaberman@gmail.com>
 
   The upb compiler.  Unlike the proto2 compiler, this does
-  not output any parsing code or generated classes or anything
-  specific to the protobuf binary format at all.  At the moment
-  it only dumps C initializers for upb_defs, so that a .proto
-  file can be represented in a .o file.
+  not output any generated classes.  It dumps C initializers for
+  upb_defs, so that a .proto file can be represented in a .o file.
+
+  With --decoders it also generates precompiled decoders for the
+  messages (see upb_aotdecoder in upb/pb/decoder.h) into
+  <outbase>.upbdec.h and <outbase>.upbdec.c.
 
 --]]
 
 local dump_cinit = require "dump_cinit"
+local dump_decoders = require "dump_decoders"
 local upb = require "upb"
 
 local src = arg[1]
 local outbase = arg[2]
 local basename = arg[3]
+local gen_decoders = arg[4] == "--decoders"
 local hfilename = outbase .. ".upb.h"
 local cfilename = outbase .. ".upb.c"
+local dec_hfilename = outbase .. ".upbdec.h"
+local dec_cfilename = outbase .. ".upbdec.c"
 
 if os.getenv("UPBC_VERBOSE") then
   print("upbc:")
@@ -48,3 +54,14 @@ dump_cinit.dump_defs(symtab, basename, happend, cappend)
 
 hfile:close()
 cfile:close()
+
+-- Dump decoders
+if gen_decoders then
+  hfile = assert(io.open(dec_hfilename, "w"), "couldn't open " .. dec_hfilename)
+  cfile = assert(io.open(dec_cfilename, "w"), "couldn't open " .. dec_cfilename)
+  dump_decoders.dump_decoders(symtab, basename, dec_hfilename,
+                              dump_cinit.file_appender(hfile),
+                              dump_cinit.file_appender(cfile))
+  hfile:close()
+  cfile:close()
+end
@@ -63,17 +63,58 @@ void upb_byteregion_reset(upb_byteregion *r, const upb_byteregion *src,
   r->fetch = UPB_MIN(src->fetch, r->end);
 }
 
+void upb_byteregion_release(upb_byteregion *r) {
+  // A byteregion holds nothing of its own: spans that have to outlive it are
+  // pinned separately with upb_byteregion_getview().
+  UPB_UNUSED(r);
+}
+
+bool upb_byteregion_getview(const upb_byteregion *r, uint64_t ofs, size_t len,
+                            upb_strview *view) {
+  assert(len <= upb_byteregion_available(r, ofs));
+  size_t avail;
+  const char *ptr = upb_byteregion_getptr(r, ofs, &avail);
+  if (avail >= len && upb_bytesrc_pin(r->bytesrc, ofs, len)) {
+    view->ptr = ptr;
+    view->pinned_src = r->bytesrc;
+    view->pinned_ofs = ofs;
+  } else {
+    // The span is not contiguous or cannot be pinned.
+    char *copy = malloc(len > 0 ? len : 1);
+    if (!copy) return false;
+    upb_byteregion_copy(r, ofs, len, copy);
+    view->ptr = copy;
+    view->pinned_src = NULL;
+    view->pinned_ofs = 0;
+  }
+  view->len = len;
+  return true;
+}
+
 upb_bytesuccess_t upb_byteregion_fetch(upb_byteregion *r) {
   uint64_t fetchable = upb_byteregion_remaining(r, r->fetch);
   if (fetchable == 0) return UPB_BYTE_EOF;
   size_t fetched;
   upb_bytesuccess_t ret = upb_bytesrc_fetch(r->bytesrc, r->fetch, &fetched);
-  if (ret != UPB_BYTE_OK) return false;
+  if (ret != UPB_BYTE_OK) return ret;
   r->fetch += UPB_MIN(fetched, fetchable);
   return UPB_BYTE_OK;
 }
 
 
+/* upb_strview ****************************************************************/
+
+void upb_strview_release(upb_strview *v) {
+  if (v->pinned_src) {
+    upb_bytesrc_unpin(v->pinned_src, v->pinned_ofs, v->len);
+  } else {
+    free((char*)v->ptr);
+  }
+  v->ptr = NULL;
+  v->len = 0;
+}
+
+
 /* upb_stringsrc **************************************************************/
 
 upb_bytesuccess_t upb_stringsrc_fetch(void *_src, uint64_t ofs, size_t *read) {
@@ -105,20 +146,43 @@ const char *upb_stringsrc_getptr(const void *_s, uint64_t ofs, size_t *len) {
   return src->str + ofs;
 }
 
+// The string is never discarded, so pinning only has to keep the stringsrc
+// from being reset.
+bool upb_stringsrc_pin(void *_src, uint64_t ofs, size_t len) {
+  upb_stringsrc *src = _src;
+  assert(ofs + len <= src->len);
+  UPB_UNUSED(ofs);
+  UPB_UNUSED(len);
+  src->pins++;
+  return true;
+}
+
+void upb_stringsrc_unpin(void *_src, uint64_t ofs, size_t len) {
+  upb_stringsrc *src = _src;
+  UPB_UNUSED(ofs);
+  UPB_UNUSED(len);
+  assert(src->pins > 0);
+  src->pins--;
+}
+
 void upb_stringsrc_init(upb_stringsrc *s) {
   static upb_bytesrc_vtbl vtbl = {
     &upb_stringsrc_fetch,
     &upb_stringsrc_discard,
     &upb_stringsrc_copy,
     &upb_stringsrc_getptr,
+    &upb_stringsrc_pin,
+    &upb_stringsrc_unpin,
   };
   upb_bytesrc_init(&s->bytesrc, &vtbl);
   s->str = NULL;
+  s->pins = 0;
   s->byteregion.bytesrc = &s->bytesrc;
   s->byteregion.toplevel = true;
 }
 
 void upb_stringsrc_reset(upb_stringsrc *s, const char *str, size_t len) {
+  assert(s->pins == 0);
   s->str = str;
   s->len = len;
   s->byteregion.start = 0;
@@ -127,7 +191,10 @@ void upb_stringsrc_reset(upb_stringsrc *s, const char *str, size_t len) {
   s->byteregion.end = len;
 }
 
-void upb_stringsrc_uninit(upb_stringsrc *s) { (void)s; }
+void upb_stringsrc_uninit(upb_stringsrc *s) {
+  assert(s->pins == 0);
+  UPB_UNUSED(s);
+}
 
 /* upb_stringsink *************************************************************/
 
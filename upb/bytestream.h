@@ -108,11 +108,15 @@ typedef upb_bytesuccess_t upb_bytesrc_fetch_func(void*, uint64_t, size_t*);
 typedef void upb_bytesrc_discard_func(void*, uint64_t);
 typedef void upb_bytesrc_copy_func(const void*, uint64_t, size_t, char*);
 typedef const char *upb_bytesrc_getptr_func(const void*, uint64_t, size_t*);
+typedef bool upb_bytesrc_pin_func(void*, uint64_t, size_t);
+typedef void upb_bytesrc_unpin_func(void*, uint64_t, size_t);
 typedef struct _upb_bytesrc_vtbl {
   upb_bytesrc_fetch_func     *fetch;
   upb_bytesrc_discard_func   *discard;
   upb_bytesrc_copy_func      *copy;
   upb_bytesrc_getptr_func    *getptr;
+  upb_bytesrc_pin_func       *pin;     // NULL if pinning is not supported.
+  upb_bytesrc_unpin_func     *unpin;
 } upb_bytesrc_vtbl;
 
 typedef struct {
@@ -139,8 +143,7 @@ INLINE upb_bytesuccess_t upb_bytesrc_fetch(upb_bytesrc *src, uint64_t ofs,
   return src->vtbl->fetch(src, ofs, read);
 }
 
-// Discards all data prior to ofs (except data that is pinned, if pinning
-// support is added -- see TODO below).
+// Discards all data prior to ofs (except data that is pinned, see below).
 INLINE void upb_bytesrc_discard(upb_bytesrc *src, uint64_t ofs) {
   src->vtbl->discard(src, ofs);
 }
@@ -162,25 +165,25 @@ INLINE const char *upb_bytesrc_getptr(const upb_bytesrc *src, uint64_t ofs,
   return src->vtbl->getptr(src, ofs, len);
 }
 
-// TODO: Add if/when there is a demonstrated need:
-//
-// // When the caller pins a region (which must not be already discarded), it
-// // is guaranteed that the region will not be discarded (nor will the bytesrc
-// // be destroyed) until the region is unpinned.  However, not all bytesrc's
-// // support pinning; a false return indicates that a pin was not possible.
-// INLINE bool upb_bytesrc_pin(upb_bytesrc *src, uint64_t ofs, size_t len) {
-//   return src->vtbl->refregion(src, ofs, len);
-// }
-//
-// // Releases some number of pinned bytes from the beginning of a pinned
-// // region (which may be fewer than the total number of bytes pinned).
-// INLINE void upb_bytesrc_unpin(upb_bytesrc *src, uint64_t ofs, size_t len,
-//                               size_t bytes_to_release) {
-//   src->vtbl->unpin(src, ofs, len);
-// }
-//
-// Adding pinning support would also involve adding a "pin_ofs" parameter to
-// upb_bytesrc_fetch, so that the fetch can extend an already-pinned region.
+// Pins the region [ofs, ofs+len), which must be fetched and not discarded.
+// While it is pinned, the region will not be discarded and the buffer returned
+// by upb_bytesrc_getptr() for it stays valid, even after the bytes are
+// discarded; the bytesrc must not be reset or destroyed until it is unpinned.
+// Not all bytesrc's support pinning, and some can only pin regions that lie in
+// a single buffer; a false return indicates that a pin was not possible.
+INLINE bool upb_bytesrc_pin(upb_bytesrc *src, uint64_t ofs, size_t len) {
+  return src->vtbl->pin && src->vtbl->pin(src, ofs, len);
+}
+
+// Releases a region pinned with upb_bytesrc_pin(); "ofs" and "len" must be
+// the same as for the pin.
+INLINE void upb_bytesrc_unpin(upb_bytesrc *src, uint64_t ofs, size_t len) {
+  src->vtbl->unpin(src, ofs, len);
+}
+
+// TODO: pinning a region that has not been fetched yet would involve adding a
+// "pin_ofs" parameter to upb_bytesrc_fetch, so that the fetch can extend an
+// already-pinned region.
 
 
 /* upb_byteregion *************************************************************/
@@ -345,6 +348,12 @@ INLINE const char *upb_byteregion_getptr(const upb_byteregion *r,
 // //
 // // void upb_byteregion_pin(upb_byteregion *r);
 
+// Returns a upb_strview of the "len" bytes at "ofs", which must be available.
+// The bytes are pinned in the bytesrc if possible, otherwise they are copied
+// into a new buffer.  Returns false if memory allocation failed.
+bool upb_byteregion_getview(const upb_byteregion *r, uint64_t ofs, size_t len,
+                            upb_strview *view);
+
 // Convenience functions for creating and destroying a byteregion with a simple
 // string as its data.  These are relatively inefficient compared with creating
 // your own bytesrc (they call malloc() and copy the string data) so should not
@@ -362,6 +371,45 @@ void upb_byteregion_free(upb_byteregion *r);
 char *upb_byteregion_strdup(const upb_byteregion *r);
 
 
+/* upb_strview ****************************************************************/
+
+// A upb_strview is a contiguous span of string data that stays valid until it
+// is released, even if the bytesrc it came from has moved on.  It is usually
+// pinned in its bytesrc, so creating one does not copy the data.
+
+#ifdef __cplusplus
+}  // extern "C"
+
+class upb::StringView {
+ public:
+  const char *data() const;
+  size_t size() const;
+
+  // Releases the span; data() is invalid afterwards.  Every view obtained
+  // from upb_byteregion_getview() or a string view handler must be released
+  // exactly once (copies of the object share the same span).
+  void Release();
+
+#else
+struct upb_strview {
+#endif
+  const char *ptr;
+  size_t len;
+
+  // Private: where the span is pinned, or NULL if "ptr" was malloc()'d.
+  upb_bytesrc *pinned_src;
+  uint64_t pinned_ofs;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+INLINE const char *upb_strview_ptr(const upb_strview *v) { return v->ptr; }
+INLINE size_t upb_strview_len(const upb_strview *v) { return v->len; }
+void upb_strview_release(upb_strview *v);
+
+
 /* upb_bytesink ***************************************************************/
 
 // A bytesink is an interface that allows the caller to push byte-wise data.
@@ -458,7 +506,8 @@ class upb::StringSource {
   ~StringSource();
 
   // Resets the stringsrc to a state where it will vend the given string.  The
-  // string data must be valid until the stringsrc is reset again or destroyed.
+  // string data must be valid until the stringsrc is reset again or destroyed,
+  // which may not happen while any of its bytes are pinned.
   void Reset(const char* data, size_t len);
   template <typename T> void Reset(const T& str);
 
@@ -475,6 +524,7 @@ struct upb_stringsrc {
   const char *str;
   size_t len;
   upb_byteregion byteregion;
+  uint32_t pins;  // The string may not be reset while this is nonzero.
 };
 
 #ifdef __cplusplus
@@ -589,6 +639,10 @@ template <typename T> void ByteRegion::AssignToString(T* str) {
   }
 }
 
+inline const char *StringView::data() const { return upb_strview_ptr(this); }
+inline size_t StringView::size() const { return upb_strview_len(this); }
+inline void StringView::Release() { upb_strview_release(this); }
+
 template <> inline ByteRegion* GetValue<ByteRegion*>(Value v) {
   return static_cast<ByteRegion*>(upb_value_getbyteregion(v));
 }
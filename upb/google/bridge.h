@@ -64,8 +64,10 @@ namespace google {
 // Returns a upb::Handlers object that can be used to populate a proto2::Message
 // object of the same type as "m."
 //
-// TODO(haberman): Add handler caching functionality so that we don't use
-// O(n^2) memory in the worst case when incrementally building handlers.
+// TODO(haberman): each call builds new defs, so handlers cannot be shared
+// between calls yet and incrementally building handlers uses O(n^2) memory in
+// the worst case.  Once the defs are shared, build the handlers through one
+// upb_handlerscache (see upb/handlers.h).
 const upb::Handlers* NewWriteHandlers(const proto2::Message& m, void *owner);
 const upb::Handlers* NewWriteHandlers(const ::google::protobuf::Message& m,
                                       void *owner);
@@ -14,32 +14,16 @@
 // UPB_NO_CLOSURE.
 char _upb_noclosure;
 
-typedef struct {
-  upb_func *handler;
-
-  // Could put either or both of these in a separate table to save memory when
-  // they are sparse.
-  void *data;
-  upb_handlerfree *cleanup;
-
-  // TODO(haberman): this is wasteful; only the first "fieldhandler" of a
-  // submessage field needs this.  To reduce memory footprint we should either:
-  // - put the subhandlers in a separate "fieldhandler", stored as part of
-  //   a union with one of the above fields.
-  // - count selector offsets by individual pointers instead of by whole
-  //   fieldhandlers.
-  const upb_handlers *subhandlers;
-} fieldhandler;
-
-static const fieldhandler *getfh(
+static const upb_fieldhandler *getfh(
     const upb_handlers *h, upb_selector_t selector) {
   assert(selector < upb_handlers_msgdef(h)->selector_count);
-  fieldhandler* fhbase = (void*)&h->fh_base;
+  upb_fieldhandler *fhbase = (void*)&h->fh_base;
   return &fhbase[selector];
 }
 
-static fieldhandler *getfh_mutable(upb_handlers *h, upb_selector_t selector) {
-  return (fieldhandler*)getfh(h, selector);
+static upb_fieldhandler *getfh_mutable(upb_handlers *h,
+                                       upb_selector_t selector) {
+  return (upb_fieldhandler*)getfh(h, selector);
 }
 
 bool upb_handlers_isfrozen(const upb_handlers *h) {
@@ -52,8 +36,9 @@ uint32_t upb_handlers_selectorbaseoffset(const upb_fielddef *f) {
 
 uint32_t upb_handlers_selectorcount(const upb_fielddef *f) {
   uint32_t ret = 1;
-  if (upb_fielddef_isstring(f)) ret += 2;  // STARTSTR/ENDSTR
+  if (upb_fielddef_isstring(f)) ret += 3;  // STARTSTR/ENDSTR/STRINGVIEW
   if (upb_fielddef_isseq(f)) ret += 2;  // STARTSEQ/ENDSEQ
+  if (upb_fielddef_isseq(f) && upb_fielddef_isprimitive(f)) ret += 1;  // ARRAY
   if (upb_fielddef_issubmsg(f)) ret += 2;  // STARTSUBMSG/ENDSUBMSG
   return ret;
 }
@@ -131,6 +116,20 @@ bool upb_getselector(
       if (!upb_fielddef_issubmsg(f)) return false;
       *s = f->selector_base + 2;
       break;
+    case UPB_HANDLER_LAZYSUBMSG:
+      // Submessages have no value handler, so this uses the value slot.
+      if (upb_fielddef_type(f) != UPB_TYPE_MESSAGE) return false;
+      *s = f->selector_base;
+      break;
+    case UPB_HANDLER_ARRAY:
+      // Primitive fields only use the value slot, so this uses the one after.
+      if (!upb_fielddef_isseq(f) || !upb_fielddef_isprimitive(f)) return false;
+      *s = f->selector_base + 1;
+      break;
+    case UPB_HANDLER_STRINGVIEW:
+      if (!upb_fielddef_isstring(f)) return false;
+      *s = f->selector_base + 3;
+      break;
   }
   assert(*s < upb_fielddef_msgdef(f)->selector_count);
   return true;
@@ -157,7 +156,7 @@ static void do_cleanup(upb_handlers* h, const upb_fielddef *f,
                        upb_handlertype_t type) {
   upb_selector_t selector;
   if (!upb_getselector(f, type, &selector)) return;
-  fieldhandler *fh = getfh_mutable(h, selector);
+  upb_fieldhandler *fh = getfh_mutable(h, selector);
   if (fh->cleanup) fh->cleanup(fh->data);
   fh->cleanup = NULL;
   fh->data = NULL;
@@ -190,7 +189,7 @@ static void visithandlers(const upb_refcounted *r, upb_refcounted_visit *visit,
 upb_handlers *upb_handlers_new(const upb_msgdef *md, const void *owner) {
   assert(upb_msgdef_isfrozen(md));
   static const struct upb_refcounted_vtbl vtbl = {visithandlers, freehandlers};
-  size_t fhandlers_size = sizeof(fieldhandler) * md->selector_count;
+  size_t fhandlers_size = sizeof(upb_fieldhandler) * md->selector_count;
   upb_handlers *h = calloc(sizeof(*h) - sizeof(void*) + fhandlers_size, 1);
   if (!h) return NULL;
   h->msg = md;
@@ -230,7 +229,16 @@ upb_endmsg_handler *upb_handlers_getendmsg(const upb_handlers *h) {
   return h->endmsg;
 }
 
-// For now we stuff the subhandlers pointer into the fieldhandlers*
+void upb_handlers_setunknown(upb_handlers *h, upb_unknown_handler *handler) {
+  assert(!upb_handlers_isfrozen(h));
+  h->unknown = handler;
+}
+
+upb_unknown_handler *upb_handlers_getunknown(const upb_handlers *h) {
+  return h->unknown;
+}
+
+// For now we stuff the subhandlers pointer into the upb_fieldhandler
 // corresponding to the UPB_HANDLER_STARTSUBMSG handler.
 static const upb_handlers **subhandlersptr(upb_handlers *h,
                                            const upb_fielddef *f) {
@@ -273,7 +281,7 @@ const upb_handlers *upb_handlers_getsubhandlers(const upb_handlers *h,
     bool ok = upb_getselector(f, handlertype, &selector); \
     if (!ok) return false; \
     do_cleanup(h, f, handlertype); \
-    fieldhandler *fh = getfh_mutable(h, selector); \
+    upb_fieldhandler *fh = getfh_mutable(h, selector); \
     fh->handler = (upb_func*)val; \
     fh->data = (upb_func*)data; \
     fh->cleanup = (upb_func*)cleanup; \
@@ -290,12 +298,49 @@ SETTER(bool,        upb_bool_handler*,        UPB_HANDLER_BOOL);
 SETTER(startstr,    upb_startstr_handler*,    UPB_HANDLER_STARTSTR);
 SETTER(string,      upb_string_handler*,      UPB_HANDLER_STRING);
 SETTER(endstr,      upb_endfield_handler*,    UPB_HANDLER_ENDSTR);
+SETTER(stringview,  upb_stringview_handler*,  UPB_HANDLER_STRINGVIEW);
 SETTER(startseq,    upb_startfield_handler*,  UPB_HANDLER_STARTSEQ);
 SETTER(startsubmsg, upb_startfield_handler*,  UPB_HANDLER_STARTSUBMSG);
 SETTER(endsubmsg,   upb_endfield_handler*,    UPB_HANDLER_ENDSUBMSG);
 SETTER(endseq,      upb_endfield_handler*,    UPB_HANDLER_ENDSEQ);
+SETTER(lazysubmsg,  upb_lazysubmsg_handler*,  UPB_HANDLER_LAZYSUBMSG);
 #undef SETTER
 
+// Array handlers share one selector, so the setters also check the value type.
+#define ARRAYSETTER(name, handlerctype, valuetype) \
+  bool upb_handlers_set ## name ## array(upb_handlers *h, \
+                                         const upb_fielddef *f, \
+                                         handlerctype val, void *data, \
+                                         upb_handlerfree *cleanup) { \
+    assert(!upb_handlers_isfrozen(h)); \
+    if (upb_handlers_msgdef(h) != upb_fielddef_msgdef(f)) return false; \
+    if (!upb_fielddef_isprimitive(f) || \
+        upb_handlers_getprimitivehandlertype(f) != valuetype) \
+      return false; \
+    upb_selector_t selector; \
+    bool ok = upb_getselector(f, UPB_HANDLER_ARRAY, &selector); \
+    if (!ok) return false; \
+    do_cleanup(h, f, UPB_HANDLER_ARRAY); \
+    upb_fieldhandler *fh = getfh_mutable(h, selector); \
+    fh->handler = (upb_func*)val; \
+    fh->data = (upb_func*)data; \
+    fh->cleanup = (upb_func*)cleanup; \
+    return true; \
+  } \
+
+ARRAYSETTER(int32,  upb_int32array_handler*,  UPB_HANDLER_INT32);
+ARRAYSETTER(int64,  upb_int64array_handler*,  UPB_HANDLER_INT64);
+ARRAYSETTER(uint32, upb_uint32array_handler*, UPB_HANDLER_UINT32);
+ARRAYSETTER(uint64, upb_uint64array_handler*, UPB_HANDLER_UINT64);
+ARRAYSETTER(float,  upb_floatarray_handler*,  UPB_HANDLER_FLOAT);
+ARRAYSETTER(double, upb_doublearray_handler*, UPB_HANDLER_DOUBLE);
+ARRAYSETTER(bool,   upb_boolarray_handler*,   UPB_HANDLER_BOOL);
+#undef ARRAYSETTER
+
+const upb_fieldhandler *upb_handlers_fieldhandlers(const upb_handlers *h) {
+  return (const upb_fieldhandler*)&h->fh_base;
+}
+
 upb_func *upb_handlers_gethandler(const upb_handlers *h, upb_selector_t s) {
   return getfh(h, s)->handler;
 }
@@ -304,19 +349,29 @@ void *upb_handlers_gethandlerdata(const upb_handlers *h, upb_selector_t s) {
   return getfh(h, s)->data;
 }
 
-typedef struct {
-  upb_inttable tab;  // maps upb_msgdef* -> upb_handlers*.
+struct upb_handlerscache {
+  upb_inttable tab;  // maps upb_msgdef* -> frozen upb_handlers*, one ref each.
   upb_handlers_callback *callback;
   void *closure;
+};
+
+typedef struct {
+  upb_handlerscache *cache;
+  upb_inttable tab;  // maps upb_msgdef* -> upb_handlers* created by this walk.
 } dfs_state;
 
-static upb_handlers *newformsg(const upb_msgdef *m, const void *owner,
-                               dfs_state *s) {
-  upb_handlers *h = upb_handlers_new(m, owner);
+// Creates handlers for "m" and for each of its submessages that do not have
+// handlers yet, either in the cache or from earlier in this walk.  The new
+// handlers are owned by "s" until they are frozen.
+static upb_handlers *newformsg(const upb_msgdef *m, dfs_state *s) {
+  upb_handlers *h = upb_handlers_new(m, s);
   if (!h) return NULL;
-  if (!upb_inttable_insertptr(&s->tab, m, upb_value_ptr(h))) goto oom;
+  if (!upb_inttable_insertptr(&s->tab, m, upb_value_ptr(h))) {
+    upb_handlers_unref(h, s);
+    return NULL;
+  }
 
-  s->callback(s->closure, h);
+  s->cache->callback(s->cache->closure, h);
 
   // For each submessage field, get or create a handlers object and set it as
   // the subhandlers.
@@ -327,40 +382,90 @@ static upb_handlers *newformsg(const upb_msgdef *m, const void *owner,
 
     const upb_msgdef *subdef = upb_downcast_msgdef(upb_fielddef_subdef(f));
     const upb_value *subm_ent = upb_inttable_lookupptr(&s->tab, subdef);
+    if (!subm_ent) subm_ent = upb_inttable_lookupptr(&s->cache->tab, subdef);
     if (subm_ent) {
       upb_handlers_setsubhandlers(h, f, upb_value_getptr(*subm_ent));
     } else {
-      upb_handlers *sub_mh = newformsg(subdef, &sub_mh, s);
-      if (!sub_mh) goto oom;
+      upb_handlers *sub_mh = newformsg(subdef, s);
+      if (!sub_mh) return NULL;  // Our caller cleans up.
       upb_handlers_setsubhandlers(h, f, sub_mh);
-      upb_handlers_unref(sub_mh, &sub_mh);
     }
   }
   return h;
+}
 
-oom:
-  upb_handlers_unref(h, owner);
-  return NULL;
+upb_handlerscache *upb_handlerscache_new(upb_handlers_callback *callback,
+                                         void *closure) {
+  upb_handlerscache *c = malloc(sizeof(*c));
+  if (!c) return NULL;
+  if (!upb_inttable_init(&c->tab, UPB_CTYPE_PTR)) {
+    free(c);
+    return NULL;
+  }
+  c->callback = callback;
+  c->closure = closure;
+  return c;
+}
+
+void upb_handlerscache_free(upb_handlerscache *c) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &c->tab);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    const upb_handlers *h = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_handlers_unref(h, c);
+  }
+  upb_inttable_uninit(&c->tab);
+  free(c);
+}
+
+const upb_handlers *upb_handlerscache_get(upb_handlerscache *c,
+                                          const upb_msgdef *m,
+                                          const void *owner) {
+  const upb_value *ent = upb_inttable_lookupptr(&c->tab, m);
+  if (ent) {
+    const upb_handlers *h = upb_value_getptr(*ent);
+    upb_handlers_ref(h, owner);
+    return h;
+  }
+
+  dfs_state state;
+  state.cache = c;
+  if (!upb_inttable_init(&state.tab, UPB_CTYPE_PTR)) return NULL;
+  upb_handlers *ret = newformsg(m, &state);
+  bool ok = ret != NULL;
+  if (ok) {
+    // The new handlers are all reachable from "ret", so this freezes them all.
+    upb_status status = UPB_STATUS_INIT;
+    ok = upb_handlers_freeze(&ret, 1, &status);
+    upb_status_uninit(&status);
+  }
+  if (ok) upb_handlers_ref(ret, owner);
+
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &state.tab);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_handlers *h = upb_value_getptr(upb_inttable_iter_value(&i));
+    // If the cache cannot take a handlers object, it stays alive as long as
+    // whatever points at it, but later walks will build it again.
+    if (ok && upb_inttable_insertptr(&c->tab, upb_handlers_msgdef(h),
+                                     upb_value_ptr(h))) {
+      upb_handlers_donateref(h, &state, c);
+    } else {
+      upb_handlers_unref(h, &state);
+    }
+  }
+  upb_inttable_uninit(&state.tab);
+  return ok ? ret : NULL;
 }
 
 const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
                                            const void *owner,
                                            upb_handlers_callback *callback,
                                            void *closure) {
-  dfs_state state;
-  state.callback = callback;
-  state.closure = closure;
-  if (!upb_inttable_init(&state.tab, UPB_CTYPE_PTR)) return NULL;
-
-  upb_handlers *ret = newformsg(m, owner, &state);
-  if (!ret) return NULL;
-  upb_refcounted *r = upb_upcast(ret);
-  upb_status status = UPB_STATUS_INIT;
-  bool ok = upb_refcounted_freeze(&r, 1, &status);
-  UPB_ASSERT_VAR(ok, ok);
-  upb_status_uninit(&status);
-
-  upb_inttable_uninit(&state.tab);
+  upb_handlerscache *c = upb_handlerscache_new(callback, closure);
+  if (!c) return NULL;
+  const upb_handlers *ret = upb_handlerscache_get(c, m, owner);
+  upb_handlerscache_free(c);
   return ret;
 }
 
@@ -369,7 +474,7 @@ const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
     assert(_m != NULL);                                                       \
     const upb_stdmsg_fval *f = fval;                                          \
     uint8_t *m = _m;                                                          \
-    if (f->hasbit > 0)                                                        \
+    if (f->hasbit >= 0)                                                       \
       *(uint8_t*)&m[f->hasbit / 8] |= 1 << (f->hasbit % 8);                   \
     *(ctype*)&m[f->offset] = val;                                             \
     return true;                                                              \
@@ -383,3 +488,92 @@ STDMSG_WRITER(uint32, uint32_t)
 STDMSG_WRITER(uint64, uint64_t)
 STDMSG_WRITER(bool, bool)
 #undef STDMSG_WRITER
+
+// Sets the store handler for "f", taking ownership of "fval" if it succeeds.
+static bool upb_handlers_setstorefval(upb_handlers *h, const upb_fielddef *f,
+                                      upb_stdmsg_fval *fval) {
+  bool ok = false;
+  switch (upb_handlers_getprimitivehandlertype(f)) {
+    case UPB_HANDLER_INT32:
+      ok = upb_handlers_setint32(h, f, &upb_stdmsg_setint32, fval, &free);
+      break;
+    case UPB_HANDLER_INT64:
+      ok = upb_handlers_setint64(h, f, &upb_stdmsg_setint64, fval, &free);
+      break;
+    case UPB_HANDLER_UINT32:
+      ok = upb_handlers_setuint32(h, f, &upb_stdmsg_setuint32, fval, &free);
+      break;
+    case UPB_HANDLER_UINT64:
+      ok = upb_handlers_setuint64(h, f, &upb_stdmsg_setuint64, fval, &free);
+      break;
+    case UPB_HANDLER_FLOAT:
+      ok = upb_handlers_setfloat(h, f, &upb_stdmsg_setfloat, fval, &free);
+      break;
+    case UPB_HANDLER_DOUBLE:
+      ok = upb_handlers_setdouble(h, f, &upb_stdmsg_setdouble, fval, &free);
+      break;
+    case UPB_HANDLER_BOOL:
+      ok = upb_handlers_setbool(h, f, &upb_stdmsg_setbool, fval, &free);
+      break;
+    default:
+      break;
+  }
+  return ok;
+}
+
+bool upb_handlers_setstore(upb_handlers *h, const upb_fielddef *f,
+                           size_t offset, int32_t hasbit) {
+  if (!upb_fielddef_isprimitive(f)) return false;
+  upb_stdmsg_fval *fval = malloc(sizeof(*fval));
+  if (!fval) return false;
+  fval->offset = offset;
+  fval->hasbit = hasbit;
+  bool ok = upb_handlers_setstorefval(h, f, fval);
+  if (!ok) free(fval);
+  return ok;
+}
+
+bool upb_handlers_setlayout(upb_handlers *h, const upb_msglayout *l) {
+  assert(!upb_handlers_isfrozen(h));
+  // Check every entry and allocate every store before setting any of them,
+  // so that a failure leaves the handlers unchanged.
+  for (size_t i = 0; i < l->field_count; i++) {
+    const upb_fielddef *f = upb_msgdef_itof(h->msg, l->fields[i].number);
+    if (!f || !upb_fielddef_isprimitive(f)) return false;
+  }
+  upb_stdmsg_fval **fvals = malloc(l->field_count * sizeof(*fvals));
+  if (l->field_count > 0 && !fvals) return false;
+  for (size_t i = 0; i < l->field_count; i++) {
+    upb_stdmsg_fval *fval = malloc(sizeof(*fval));
+    if (!fval) {
+      while (i > 0) free(fvals[--i]);
+      free(fvals);
+      return false;
+    }
+    fval->offset = l->fields[i].offset;
+    fval->hasbit = l->fields[i].hasbit;
+    fvals[i] = fval;
+  }
+  for (size_t i = 0; i < l->field_count; i++) {
+    const upb_fielddef *f = upb_msgdef_itof(h->msg, l->fields[i].number);
+    bool ok = upb_handlers_setstorefval(h, f, fvals[i]);
+    UPB_ASSERT_VAR(ok, ok);
+  }
+  free(fvals);
+  return true;
+}
+
+const upb_stdmsg_fval *upb_handlers_getstore(const upb_handlers *h,
+                                             upb_selector_t s) {
+  upb_func *handler = upb_handlers_gethandler(h, s);
+  if (handler == (upb_func*)&upb_stdmsg_setint32 ||
+      handler == (upb_func*)&upb_stdmsg_setint64 ||
+      handler == (upb_func*)&upb_stdmsg_setuint32 ||
+      handler == (upb_func*)&upb_stdmsg_setuint64 ||
+      handler == (upb_func*)&upb_stdmsg_setfloat ||
+      handler == (upb_func*)&upb_stdmsg_setdouble ||
+      handler == (upb_func*)&upb_stdmsg_setbool) {
+    return upb_handlers_gethandlerdata(h, s);
+  }
+  return NULL;
+}
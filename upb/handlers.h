@@ -25,7 +25,10 @@
 #include "upb/def.h"
 
 #ifdef __cplusplus
-namespace upb { class Handlers; }
+namespace upb {
+class Handlers;
+template <class T, class D> class TypedValueHandler;
+}
 typedef upb::Handlers upb_handlers;
 #else
 struct upb_handlers;
@@ -49,9 +52,12 @@ typedef enum {
   UPB_HANDLER_ENDSUBMSG,
   UPB_HANDLER_STARTSEQ,
   UPB_HANDLER_ENDSEQ,
+  UPB_HANDLER_LAZYSUBMSG,
+  UPB_HANDLER_ARRAY,
+  UPB_HANDLER_STRINGVIEW,
 } upb_handlertype_t;
 
-#define UPB_HANDLER_MAX (UPB_HANDLER_ENDSEQ+1)
+#define UPB_HANDLER_MAX (UPB_HANDLER_STRINGVIEW+1)
 
 #define UPB_BREAK NULL
 
@@ -63,6 +69,22 @@ extern char _upb_noclosure;
 // (for example: the STARTSUBMSG handler for field "field15").
 typedef uint32_t upb_selector_t;
 
+// Where a message's primitive fields live in a C struct, for setting all of
+// their store handlers at once (see upb_handlers_setlayout()).  Each field's
+// value is stored at "offset" bytes from the message's closure, as the
+// field's native C type, and if "hasbit" is non-negative that bit (counting
+// from the closure's first byte) is set.
+typedef struct {
+  uint32_t number;  // Field number.
+  uint32_t offset;
+  int32_t hasbit;
+} upb_fieldlayout;
+
+typedef struct {
+  const upb_fieldlayout *fields;
+  size_t field_count;
+} upb_msglayout;
+
 #ifdef __cplusplus
 
 // A upb::Handlers object represents the set of handlers associated with a
@@ -80,15 +102,22 @@ class upb::Handlers {
 
   typedef bool   StartMessageHandler(void* closure);
   typedef void   EndMessageHandler(void* closure, Status* status);
+  typedef bool   UnknownHandler(void* closure, uint32_t tag, ByteRegion* bytes);
   typedef void*  StartFieldHandler(void* closure, void* data);
   typedef bool   EndFieldHandler(void *closure, void *data);
   typedef void*  StartStringHandler(void *c, void *d, size_t size_hint);
   typedef size_t StringHandler(void *c, void *d, const char *buf, size_t len);
+  typedef bool   LazySubMessageHandler(void *c, void *d, StringView* view);
+  typedef bool   StringViewHandler(void *c, void *d, StringView* view);
 
   template <class T> struct Value {
     typedef bool Handler(void* closure, void* data, T val);
   };
 
+  template <class T> struct Array {
+    typedef bool Handler(void* closure, void* data, const T* vals, size_t n);
+  };
+
   typedef Value<int32_t>::Handler     Int32Handler;
   typedef Value<int64_t>::Handler     Int64Handler;
   typedef Value<uint32_t>::Handler    Uint32Handler;
@@ -97,6 +126,14 @@ class upb::Handlers {
   typedef Value<double>::Handler      DoubleHandler;
   typedef Value<bool>::Handler        BoolHandler;
 
+  typedef Array<int32_t>::Handler     Int32ArrayHandler;
+  typedef Array<int64_t>::Handler     Int64ArrayHandler;
+  typedef Array<uint32_t>::Handler    Uint32ArrayHandler;
+  typedef Array<uint64_t>::Handler    Uint64ArrayHandler;
+  typedef Array<float>::Handler       FloatArrayHandler;
+  typedef Array<double>::Handler      DoubleArrayHandler;
+  typedef Array<bool>::Handler        BoolArrayHandler;
+
   // Any function pointer can be converted to this and converted back to its
   // correct type.
   typedef void GenericFunction();
@@ -115,7 +152,8 @@ class upb::Handlers {
   // graph of msgdefs for some message.  For "m" and all its children a new set
   // of handlers will be created and the given callback will be invoked,
   // allowing the client to register handlers for this message.  Note that any
-  // subhandlers set by the callback will be overwritten.
+  // subhandlers set by the callback will be overwritten.  To share handlers
+  // between the graphs of several roots, use a upb_handlerscache instead.
   static const Handlers* NewFrozen(const MessageDef *m, const void *owner,
                                    HandlersCallback *callback, void *closure);
 
@@ -155,6 +193,26 @@ class upb::Handlers {
   void SetEndMessageHandler(EndMessageHandler *handler);
   EndMessageHandler *GetEndMessageHandler() const;
 
+  // Sets the unknown field handler for the message, which is defined as
+  // follows:
+  //
+  //   bool unknown(void *closure, uint32_t tag, upb_byteregion *bytes) {
+  //     // Called for each field that is not part of the msgdef (or whose
+  //     // wire type does not match its msgdef).  "tag" is the raw tag
+  //     // ((fieldnum << 3) | wire_type) and "bytes" is the field's value
+  //     // exactly as it appeared on the wire: the length prefix and data for
+  //     // delimited fields, or everything up to and including the matching
+  //     // END_GROUP tag for groups.  "bytes" is fully fetched and refers
+  //     // directly to the input's buffers; it is only valid until the
+  //     // callback returns.  Returns false to abort decoding with an error.
+  //     return true;
+  //   }
+  //
+  // If no unknown handler is set, unknown fields are skipped without being
+  // copied or (for delimited fields) even fetched.
+  void SetUnknownHandler(UnknownHandler *handler);
+  UnknownHandler *GetUnknownHandler() const;
+
   // Sets the value handler for the given field, which is defined as follows
   // (this is for an int32 field; other field types will pass their native
   // C/C++ type for "val"):
@@ -221,10 +279,93 @@ class upb::Handlers {
   bool SetEndStringHandler(const FieldDef* f, EndFieldHandler* h,
                            void* d, Free* fr);
 
+  // Sets the string view handler for a string field, which is defined as
+  // follows:
+  //
+  //   bool strview(void *closure, void *data, upb_strview *view) {
+  //     // Called with the whole string value.  The handler takes ownership
+  //     // of the view, even if it returns false: its bytes stay valid, even
+  //     // after the parser has moved on, until upb_strview_release() is
+  //     // called on it (or on a copy of *view).  Returns false to abort
+  //     // decoding with an error.
+  //     return true;
+  //   }
+  //
+  // When this handler is set, the startstr/string/endstr handlers for the
+  // field are not called.  The decoder pins the string in its bytesrc when
+  // the bytesrc supports it, so that no copy is made; otherwise it copies the
+  // string into a buffer that the release frees.
+  //
+  // Returns "false" if "f" does not belong to this message or is not a
+  // string field.
+  bool SetStringViewHandler(const FieldDef* f, StringViewHandler* h,
+                            void* d, Free* fr);
+
   // A setter that is templated on the type of the value.
   template<class T> bool SetValueHandler(
       const FieldDef* f, typename Value<T>::Handler* h, void* d, Free* fr);
 
+  // Setters for value handlers that call a member function of the closure,
+  // generated at compile time by UPB_VALUE_HANDLER():
+  //
+  //   class MyClass {
+  //    public:
+  //     void set_foo(int32_t val);  // May also return bool.
+  //     bool add_bar(const BarData* data, double val);
+  //   };
+  //
+  //   h->SetValueHandler(foo_f, UPB_VALUE_HANDLER(&MyClass::set_foo));
+  //   h->SetValueHandler(bar_f, UPB_VALUE_HANDLER(&MyClass::add_bar),
+  //                      bar_data, &upb::DeletePointer<BarData>);
+  //
+  // The value type (and the data type, if any) come from the member
+  // function, so a mismatched handler or data pointer fails to compile.  The
+  // field's type is still checked against the value type as usual.
+  template<class T> bool SetValueHandler(
+      const FieldDef* f, const TypedValueHandler<T, void>& h);
+  template<class T, class D> bool SetValueHandler(
+      const FieldDef* f, const TypedValueHandler<T, D>& h, D* d, Free* fr);
+
+  // Sets the array handler for a repeated field of a primitive type, which is
+  // defined as follows (this is for an int32 field; other field types will
+  // pass their native C/C++ type for "vals"):
+  //
+  //   bool array(void *closure, void *d, const int32_t *vals, size_t n) {
+  //     // Called with "n" consecutive values of the field.  "vals" is only
+  //     // valid until the callback returns.  Returns true if processing
+  //     // should continue.
+  //     return true;
+  //   }
+  //
+  // When this handler is set it receives all of the field's values and the
+  // value handler is not called.  Packed values are decoded in bulk and
+  // delivered in chunks of up to a few hundred values; values that are not
+  // packed on the wire are delivered one at a time.  The chunk boundaries are
+  // arbitrary, so the handler must not assume that one call covers a whole
+  // packed run.
+  //
+  // The value type must exactly match f->type(), as for SetValueHandler().
+  //
+  // Returns "false" if "f" does not belong to this message, is not repeated,
+  // or has the wrong type for this handler.
+  template<class T> bool SetArrayHandler(
+      const FieldDef* f, typename Array<T>::Handler* h, void* d, Free* fr);
+
+  // Sets the value handler for a primitive field to store each value at
+  // "offset" bytes from the closure and, if "hasbit" is non-negative, to set
+  // that bit (counting from the closure's first byte).  Decoders do this
+  // without calling a function (the JIT emits the store inline), so this is
+  // the fastest way to decode into a struct.
+  //
+  // Returns "false" if "f" does not belong to this message or is not a
+  // primitive field.
+  bool SetStoreHandler(const FieldDef* f, size_t offset, int32_t hasbit);
+
+  // Calls SetStoreHandler() for every field in a struct layout; the layout
+  // itself is not kept.  Returns "false" without changing the handlers if one
+  // of its fields is not a primitive field of this message.
+  bool SetLayout(const upb_msglayout* l);
+
   // Sets the startseq handler, which is defined as follows:
   //
   //   void *startseq(void *closure, void *data) {
@@ -275,6 +416,35 @@ class upb::Handlers {
   bool SetEndSubMessageHandler(const FieldDef* f, EndFieldHandler *handler,
                                void* data, Free* cleanup);
 
+  // Sets the lazy submessage handler for the given field, which is defined as
+  // follows:
+  //
+  //   bool lazysubmsg(void *closure, void *data, upb_strview *view) {
+  //     // Called with the serialized submessage instead of parsing it.
+  //     // "view" covers the submessage's data (without the length prefix).
+  //     // As with the string view handler, the handler takes ownership of
+  //     // the view, even if it returns false: the bytes stay valid until
+  //     // upb_strview_release() is called on it, so the submessage can be
+  //     // parsed later, only if it is needed (for example by resetting a
+  //     // upb_stringsrc to the view's bytes and decoding that).  Returns
+  //     // false to abort decoding with an error.
+  //     return true;
+  //   }
+  //
+  // When this handler is set, the startsubmsg/endsubmsg handlers and
+  // subhandlers for the field are not used: the decoder fetches the
+  // submessage's bytes but does not parse them.  The bytes are pinned in the
+  // bytesrc when it supports it; otherwise they are copied.
+  //
+  // "data" is the data that will be bound to this callback and passed to it.
+  // If "cleanup" is non-NULL it will be run when the data is no longer needed.
+  //
+  // Returns "false" if "f" does not belong to this message or is not a
+  // submessage field (groups are not delimited, so cannot be lazy).
+  bool SetLazySubMessageHandler(const FieldDef* f,
+                                LazySubMessageHandler *handler,
+                                void* data, Free* cleanup);
+
   // Starts the endsubseq handler for the given field, which is defined as
   // follows:
   //
@@ -337,6 +507,7 @@ struct upb_handlers {
   const upb_msgdef *msg;
   bool (*startmsg)(void*);
   void (*endmsg)(void*, upb_status*);
+  bool (*unknown)(void*, uint32_t, upb_byteregion*);
   void *fh_base[1];  // Start of dynamically-sized field handler array.
 };
 
@@ -346,6 +517,7 @@ extern "C" {
 #endif
 typedef bool upb_startmsg_handler(void *c);
 typedef void upb_endmsg_handler(void *c, upb_status *status);
+typedef bool upb_unknown_handler(void *c, uint32_t tag, upb_byteregion *bytes);
 typedef void* upb_startfield_handler(void *closure, void *d);
 typedef bool upb_endfield_handler(void *closure, void *d);
 typedef void upb_handlers_callback(void *closure, upb_handlers *h);
@@ -361,6 +533,23 @@ typedef bool upb_double_handler(void *c, void *d, double val);
 typedef bool upb_bool_handler(void *c, void *d, bool val);
 typedef void* upb_startstr_handler(void *closure, void *d, size_t size_hint);
 typedef size_t upb_string_handler(void *c, void *d, const char *buf, size_t n);
+typedef bool upb_lazysubmsg_handler(void *c, void *d, upb_strview *view);
+typedef bool upb_stringview_handler(void *c, void *d, upb_strview *view);
+
+typedef bool upb_int32array_handler(void *c, void *d, const int32_t *vals,
+                                    size_t n);
+typedef bool upb_int64array_handler(void *c, void *d, const int64_t *vals,
+                                    size_t n);
+typedef bool upb_uint32array_handler(void *c, void *d, const uint32_t *vals,
+                                     size_t n);
+typedef bool upb_uint64array_handler(void *c, void *d, const uint64_t *vals,
+                                     size_t n);
+typedef bool upb_floatarray_handler(void *c, void *d, const float *vals,
+                                    size_t n);
+typedef bool upb_doublearray_handler(void *c, void *d, const double *vals,
+                                     size_t n);
+typedef bool upb_boolarray_handler(void *c, void *d, const bool *vals,
+                                   size_t n);
 
 upb_handlers *upb_handlers_new(const upb_msgdef *m, const void *owner);
 const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
@@ -368,6 +557,28 @@ const upb_handlers *upb_handlers_newfrozen(const upb_msgdef *m,
                                            upb_handlers_callback *callback,
                                            void *closure);
 
+// A cache of frozen handlers for one callback/closure pair, keyed by msgdef.
+// upb_handlers_newfrozen() builds handlers for every message reachable from
+// "m", so building handlers for many roots one at a time duplicates the
+// handlers of the messages they share (O(n^2) memory in the worst case).  A
+// cache builds handlers only for messages it has not seen before, and the new
+// handlers point at the cached ones for the rest.  Every handlers object the
+// cache built holds a ref until the cache is freed.
+//
+// The callback is called exactly once per msgdef over the cache's lifetime,
+// so it must not depend on which root was requested.  A cache is not
+// thread-safe, but the handlers it returns are frozen and may be shared.
+typedef struct upb_handlerscache upb_handlerscache;
+upb_handlerscache *upb_handlerscache_new(upb_handlers_callback *callback,
+                                         void *closure);
+void upb_handlerscache_free(upb_handlerscache *c);
+
+// Returns frozen handlers for "m", with a ref for "owner", or NULL if memory
+// allocation failed.
+const upb_handlers *upb_handlerscache_get(upb_handlerscache *c,
+                                          const upb_msgdef *m,
+                                          const void *owner);
+
 // From upb_refcounted.
 void upb_handlers_unref(const upb_handlers *h, const void *owner);
 bool upb_handlers_isfrozen(const upb_handlers *h);
@@ -382,6 +593,8 @@ void upb_handlers_setstartmsg(upb_handlers *h, upb_startmsg_handler *handler);
 upb_startmsg_handler *upb_handlers_getstartmsg(const upb_handlers *h);
 void upb_handlers_setendmsg(upb_handlers *h, upb_endmsg_handler *handler);
 upb_endmsg_handler *upb_handlers_getendmsg(const upb_handlers *h);
+void upb_handlers_setunknown(upb_handlers *h, upb_unknown_handler *handler);
+upb_unknown_handler *upb_handlers_getunknown(const upb_handlers *h);
 bool upb_handlers_setint32(
     upb_handlers *h, const upb_fielddef *f, upb_int32_handler *handler,
     void *d, upb_handlerfree *fr);
@@ -412,6 +625,9 @@ bool upb_handlers_setstring(
 bool upb_handlers_setendstr(
     upb_handlers *h, const upb_fielddef *f, upb_endfield_handler *handler,
     void *d, upb_handlerfree *fr);
+bool upb_handlers_setstringview(
+    upb_handlers *h, const upb_fielddef *f, upb_stringview_handler *handler,
+    void *d, upb_handlerfree *fr);
 bool upb_handlers_setstartseq(
     upb_handlers *h, const upb_fielddef *f, upb_startfield_handler *handler,
     void *d, upb_handlerfree *fr);
@@ -424,6 +640,30 @@ bool upb_handlers_setendsubmsg(
 bool upb_handlers_setendseq(
     upb_handlers *h, const upb_fielddef *f, upb_endfield_handler *handler,
     void *d, upb_handlerfree *fr);
+bool upb_handlers_setlazysubmsg(
+    upb_handlers *h, const upb_fielddef *f, upb_lazysubmsg_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setint32array(
+    upb_handlers *h, const upb_fielddef *f, upb_int32array_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setint64array(
+    upb_handlers *h, const upb_fielddef *f, upb_int64array_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setuint32array(
+    upb_handlers *h, const upb_fielddef *f, upb_uint32array_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setuint64array(
+    upb_handlers *h, const upb_fielddef *f, upb_uint64array_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setfloatarray(
+    upb_handlers *h, const upb_fielddef *f, upb_floatarray_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setdoublearray(
+    upb_handlers *h, const upb_fielddef *f, upb_doublearray_handler *handler,
+    void *d, upb_handlerfree *fr);
+bool upb_handlers_setboolarray(
+    upb_handlers *h, const upb_fielddef *f, upb_boolarray_handler *handler,
+    void *d, upb_handlerfree *fr);
 bool upb_handlers_setsubhandlers(
     upb_handlers *h, const upb_fielddef *f, const upb_handlers *sub);
 const upb_handlers *upb_handlers_getsubhandlers(
@@ -438,6 +678,30 @@ size_t upb_gethandleroffset(upb_selector_t s);
 // Internal-only.
 uint32_t upb_handlers_selectorbaseoffset(const upb_fielddef *f);
 uint32_t upb_handlers_selectorcount(const upb_fielddef *f);
+
+// Internal-only: the handlers table has one of these per selector.  A handler
+// and its data are adjacent, so calling a handler touches a single cache line.
+// upb_sink caches a pointer to the table so that its selector-based put
+// functions can be inline.
+typedef struct {
+  upb_func *handler;
+
+  // Could put either or both of these in a separate table to save memory when
+  // they are sparse.
+  void *data;
+  upb_handlerfree *cleanup;
+
+  // TODO(haberman): this is wasteful; only the first "fieldhandler" of a
+  // submessage field needs this.  To reduce memory footprint we should either:
+  // - put the subhandlers in a separate "fieldhandler", stored as part of
+  //   a union with one of the above fields.
+  // - count selector offsets by individual pointers instead of by whole
+  //   fieldhandlers.
+  const upb_handlers *subhandlers;
+} upb_fieldhandler;
+
+// Returns the table, which is indexed by selector.
+const upb_fieldhandler *upb_handlers_fieldhandlers(const upb_handlers *h);
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -460,19 +724,30 @@ DEFINE_NAME_SETTER(bool, upb_bool_handler*);
 DEFINE_NAME_SETTER(startstr, upb_startstr_handler*);
 DEFINE_NAME_SETTER(string, upb_string_handler*);
 DEFINE_NAME_SETTER(endstr, upb_endfield_handler*);
+DEFINE_NAME_SETTER(stringview, upb_stringview_handler*);
 DEFINE_NAME_SETTER(startseq, upb_startfield_handler*);
 DEFINE_NAME_SETTER(startsubmsg, upb_startfield_handler*);
 DEFINE_NAME_SETTER(endsubmsg, upb_endfield_handler*);
 DEFINE_NAME_SETTER(endseq, upb_endfield_handler*);
+DEFINE_NAME_SETTER(lazysubmsg, upb_lazysubmsg_handler*);
+DEFINE_NAME_SETTER(int32array, upb_int32array_handler*);
+DEFINE_NAME_SETTER(int64array, upb_int64array_handler*);
+DEFINE_NAME_SETTER(uint32array, upb_uint32array_handler*);
+DEFINE_NAME_SETTER(uint64array, upb_uint64array_handler*);
+DEFINE_NAME_SETTER(floatarray, upb_floatarray_handler*);
+DEFINE_NAME_SETTER(doublearray, upb_doublearray_handler*);
+DEFINE_NAME_SETTER(boolarray, upb_boolarray_handler*);
 #undef DEFINE_NAME_SETTER
 
 // Value writers for every in-memory type: write the data to a known offset
 // from the closure "c."  These depend on the fval being a pointer to a
-// structure that is (or begins with) the upb_stdmsg_fval type.
+// structure that is (or begins with) the upb_stdmsg_fval type.  If hasbit is
+// non-negative, that bit (counting from the closure's first byte) is set too.
 //
-// TODO(haberman): These are hacky; remove them and replace with an API that
-// lets you set a simple "writer" handler in a way that can generate
-// specialized code right then.
+// Rather than registering these directly, prefer upb_handlers_setstore(),
+// which says what the handler does declaratively.  Decoders recognize these
+// writers and store values themselves instead of calling them (the JIT emits
+// the store inline).
 
 typedef struct upb_stdmsg_fval {
 #ifdef __cplusplus
@@ -488,6 +763,25 @@ typedef struct upb_stdmsg_fval {
 #ifdef __cplusplus
 extern "C" {
 #endif
+// Sets the value handler for primitive field "f" to store each value at
+// "offset" from the closure, and to set "hasbit" (if non-negative).  Returns
+// false if "f" does not belong to this message or is not a primitive field.
+bool upb_handlers_setstore(upb_handlers *h, const upb_fielddef *f,
+                           size_t offset, int32_t hasbit);
+
+// Returns the offset and hasbit if the handler for selector "s" just stores
+// the value (as set by upb_handlers_setstore() or with one of the writers
+// below), or NULL otherwise.
+const upb_stdmsg_fval *upb_handlers_getstore(const upb_handlers *h,
+                                             upb_selector_t s);
+
+// Calls upb_handlers_setstore() for every field in "l"; this is only a
+// shorthand for describing a whole struct at once, and "l" is not kept.
+// Strings and submessages keep their normal handlers.  Returns false without
+// changing the handlers if a field is not a primitive field of this message
+// or memory runs out.
+bool upb_handlers_setlayout(upb_handlers *h, const upb_msglayout *l);
+
 bool upb_stdmsg_setint32(void *c, void *d, int32_t val);
 bool upb_stdmsg_setint64(void *c, void *d, int64_t val);
 bool upb_stdmsg_setuint32(void *c, void *d, uint32_t val);
@@ -541,6 +835,9 @@ inline void Handlers::SetEndMessageHandler(
     Handlers::EndMessageHandler *handler) {
   upb_handlers_setendmsg(this, handler);
 }
+inline void Handlers::SetUnknownHandler(Handlers::UnknownHandler *handler) {
+  upb_handlers_setunknown(this, handler);
+}
 inline bool Handlers::SetInt32Handler(
     const FieldDef *f, Handlers::Int32Handler *handler,
     void *d, Handlers::Free *fr) {
@@ -591,6 +888,18 @@ inline bool Handlers::SetStringHandler(
     void *d, Handlers::Free *fr) {
   return upb_handlers_setstring(this, f, handler, d, fr);
 }
+inline bool Handlers::SetStringViewHandler(
+    const FieldDef* f, Handlers::StringViewHandler* handler,
+    void* d, Handlers::Free* fr) {
+  return upb_handlers_setstringview(this, f, handler, d, fr);
+}
+inline bool Handlers::SetStoreHandler(
+    const FieldDef* f, size_t offset, int32_t hasbit) {
+  return upb_handlers_setstore(this, f, offset, hasbit);
+}
+inline bool Handlers::SetLayout(const upb_msglayout* l) {
+  return upb_handlers_setlayout(this, l);
+}
 inline bool Handlers::SetStartSequenceHandler(
     const FieldDef* f, Handlers::StartFieldHandler *handler,
     void *d, Handlers::Free *fr) {
@@ -606,6 +915,11 @@ inline bool Handlers::SetEndSubMessageHandler(
     void *d, Handlers::Free *fr) {
   return upb_handlers_setendsubmsg(this, f, handler, d, fr);
 }
+inline bool Handlers::SetLazySubMessageHandler(
+    const FieldDef* f, Handlers::LazySubMessageHandler *handler,
+    void *d, Handlers::Free *fr) {
+  return upb_handlers_setlazysubmsg(this, f, handler, d, fr);
+}
 inline bool Handlers::SetEndSequenceHandler(
     const FieldDef* f, Handlers::EndFieldHandler *handler,
     void *d, Handlers::Free *fr) {
@@ -621,6 +935,9 @@ inline Handlers::StartMessageHandler *Handlers::GetStartMessageHandler() const {
 inline Handlers::EndMessageHandler *Handlers::GetEndMessageHandler() const {
   return upb_handlers_getendmsg(this);
 }
+inline Handlers::UnknownHandler *Handlers::GetUnknownHandler() const {
+  return upb_handlers_getunknown(this);
+}
 inline const Handlers* Handlers::GetSubHandlers(
     const FieldDef* f) const {
   return upb_handlers_getsubhandlers(this, f);
@@ -657,8 +974,111 @@ SET_VALUE_HANDLER(int32, int32_t);
 SET_VALUE_HANDLER(bool, bool);
 #undef SET_VALUE_HANDLER
 
+#define SET_ARRAY_HANDLER(type, ctype) \
+    template<> \
+    inline bool Handlers::SetArrayHandler<ctype>( \
+        const FieldDef* f, \
+        typename Handlers::Array<ctype>::Handler* handler, \
+        void* data, Handlers::Free* cleanup) { \
+      return upb_handlers_set ## type ## array(this, f, handler, data, \
+                                               cleanup); \
+    }
+SET_ARRAY_HANDLER(double, double);
+SET_ARRAY_HANDLER(float, float);
+SET_ARRAY_HANDLER(uint64, uint64_t);
+SET_ARRAY_HANDLER(uint32, uint32_t);
+SET_ARRAY_HANDLER(int64, int64_t);
+SET_ARRAY_HANDLER(int32, int32_t);
+SET_ARRAY_HANDLER(bool, bool);
+#undef SET_ARRAY_HANDLER
+
 template <class T> void DeletePointer(void *p) { delete static_cast<T*>(p); }
 
+// A value handler whose value type T and data type D (void if it takes no
+// data) are known at compile time.  Made by UPB_VALUE_HANDLER().
+template <class T, class D> class TypedValueHandler {
+ public:
+  typedef typename Handlers::Value<T>::Handler Func;
+  explicit TypedValueHandler(Func* func) : func_(func) {}
+  Func* func() const { return func_; }
+
+ private:
+  Func* func_;
+};
+
+template<class T> inline bool Handlers::SetValueHandler(
+    const FieldDef* f, const TypedValueHandler<T, void>& h) {
+  return SetValueHandler<T>(f, h.func(), NULL, NULL);
+}
+template<class T, class D> inline bool Handlers::SetValueHandler(
+    const FieldDef* f, const TypedValueHandler<T, D>& h, D* d, Free* fr) {
+  return SetValueHandler<T>(f, h.func(), d, fr);
+}
+
+// UPB_VALUE_HANDLER(&C::f) makes a TypedValueHandler whose function calls
+// member function "f" on the closure.  "f" is a template argument of that
+// function, so the call is direct and can be inlined: the decoder (JIT or
+// not) makes its one indirect call per value straight into the body of "f",
+// with no hand-written trampoline or cast in between.  C++ cannot deduce a
+// non-type template argument from a function argument, hence the macro: the
+// first use of "f" deduces its type and the second binds its value.
+#define UPB_VALUE_HANDLER(f) upb::MatchValueHandler(f).Thunk<f>()
+
+// Implementation of UPB_VALUE_HANDLER(), one class per kind of member function.
+// Handlers for member functions that return void always continue.
+template <class R, class C, class T> struct MemberValueHandler {
+  template <R (C::*F)(T)> static bool Call(void* c, void* d, T val) {
+    UPB_UNUSED(d);
+    return (static_cast<C*>(c)->*F)(val);
+  }
+  template <R (C::*F)(T)> TypedValueHandler<T, void> Thunk() const {
+    return TypedValueHandler<T, void>(&Call<F>);
+  }
+};
+
+template <class C, class T> struct MemberValueHandler<void, C, T> {
+  template <void (C::*F)(T)> static bool Call(void* c, void* d, T val) {
+    UPB_UNUSED(d);
+    (static_cast<C*>(c)->*F)(val);
+    return true;
+  }
+  template <void (C::*F)(T)> TypedValueHandler<T, void> Thunk() const {
+    return TypedValueHandler<T, void>(&Call<F>);
+  }
+};
+
+template <class R, class C, class D, class T> struct MemberValueDataHandler {
+  template <R (C::*F)(const D*, T)>
+  static bool Call(void* c, void* d, T val) {
+    return (static_cast<C*>(c)->*F)(static_cast<const D*>(d), val);
+  }
+  template <R (C::*F)(const D*, T)> TypedValueHandler<T, D> Thunk() const {
+    return TypedValueHandler<T, D>(&Call<F>);
+  }
+};
+
+template <class C, class D, class T>
+struct MemberValueDataHandler<void, C, D, T> {
+  template <void (C::*F)(const D*, T)>
+  static bool Call(void* c, void* d, T val) {
+    (static_cast<C*>(c)->*F)(static_cast<const D*>(d), val);
+    return true;
+  }
+  template <void (C::*F)(const D*, T)> TypedValueHandler<T, D> Thunk() const {
+    return TypedValueHandler<T, D>(&Call<F>);
+  }
+};
+
+template <class R, class C, class T>
+inline MemberValueHandler<R, C, T> MatchValueHandler(R (C::*)(T)) {
+  return MemberValueHandler<R, C, T>();
+}
+template <class R, class C, class D, class T>
+inline MemberValueDataHandler<R, C, D, T> MatchValueHandler(
+    R (C::*)(const D*, T)) {
+  return MemberValueDataHandler<R, C, D, T>();
+}
+
 template <class T>
 void SetStoreValueHandler(
     const FieldDef* f, size_t offset, int32_t hasbit, Handlers* h);
@@ -669,9 +1089,7 @@ void SetStoreValueHandler(
     template <> \
     inline void SetStoreValueHandler<ctype>(const FieldDef* f, size_t offset, \
                                             int32_t hasbit, Handlers* h) { \
-      h->SetValueHandler<ctype>( \
-          f, upb_stdmsg_set ## type, new upb_stdmsg_fval(offset, hasbit), \
-          &upb::DeletePointer<upb_stdmsg_fval>); \
+      h->SetStoreHandler(f, offset, hasbit); \
     }
 
 SET_STORE_VALUE_HANDLER(double, double);
@@ -8,6 +8,7 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include "upb/bytestream.h"
 #include "upb/pb/decoder.h"
 #include "upb/pb/varint.h"
@@ -39,8 +40,23 @@ static const upb_decoder_typeinfo upb_decoder_types[] = {
   {UPB_WIRE_TYPE_VARINT,      true},   // SINT64
 };
 
+// The most values we deliver to an array handler at once.
+#define UPB_DECODER_MAXARRAY 256
+
 /* upb_decoderplan ************************************************************/
 
+static upb_decoderplan_msg *upb_decoderplan_getmsg(const upb_decoderplan *p,
+                                                   const upb_handlers *h) {
+  const upb_value *v = upb_inttable_lookupptr(&p->msgs, h);
+  return v ? upb_value_getptr(*v) : NULL;
+}
+
+static const upb_decoderplan_field *upb_decoderplan_getfield(
+    const upb_decoderplan_msg *m, uint32_t fieldnum) {
+  const upb_value *v = upb_inttable_lookup32(&m->dispatch, fieldnum);
+  return v ? upb_value_getptr(*v) : NULL;
+}
+
 #ifdef UPB_USE_JIT_X64
 // These defines are necessary for DynASM codegen.
 // See dynasm/dasm_proto.h for more info.
@@ -54,30 +70,465 @@ static const upb_decoder_typeinfo upb_decoder_types[] = {
 #define DASM_CHECKS
 #endif
 
+// Delivers "n" fixed-size values of "pf" that start at "p" to its array
+// handler, and returns the end of the values.  Defined with the decoder's
+// other array routines below.
+typedef const char *upb_decoder_putarrayfunc(upb_decoder *d,
+                                             const upb_decoderplan_field *pf,
+                                             const char *p, size_t n);
+static upb_decoder_putarrayfunc *upb_decoder_getputarray(upb_fieldtype_t type);
+
 #include "dynasm/dasm_proto.h"
 #include "upb/pb/decoder_x64.h"
 #endif
 
-upb_decoderplan *upb_decoderplan_new(const upb_handlers *h, bool allowjit) {
-  UPB_UNUSED(allowjit);
+static bool upb_decoderplan_initfields(upb_decoderplan *p,
+                                       upb_decoderplan_msg *m);
+static void upb_decoderplan_makebytecode(upb_decoderplan *p);
+static bool upb_decoderplan_findaot(upb_decoderplan *p);
+
+// Creates a upb_decoderplan_msg for "h" and every message reachable from it.
+// Their dispatch tables are filled in by upb_decoderplan_initfields() once all
+// of the messages exist.  Returns false if memory could not be allocated; the
+// messages created so far are freed with the plan.
+static bool upb_decoderplan_addmsgs(upb_decoderplan *p,
+                                    const upb_handlers *h) {
+  if (upb_decoderplan_getmsg(p, h)) return true;
+  upb_decoderplan_msg *m = malloc(sizeof(*m));
+  if (!m) return false;
+  m->h = h;
+  m->fields = NULL;
+  m->fields_bynum = NULL;
+  m->field_count = 0;
+  m->bc_ofs = 0;
+  m->aot = NULL;
+  if (!upb_inttable_init(&m->dispatch, UPB_CTYPE_PTR)) {
+    free(m);
+    return false;
+  }
+  if (!upb_inttable_insertptr(&p->msgs, h, upb_value_ptr(m))) {
+    upb_inttable_uninit(&m->dispatch);
+    free(m);
+    return false;
+  }
+
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, upb_handlers_msgdef(h));
+      !upb_msg_done(&i);
+      upb_msg_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (!upb_fielddef_issubmsg(f)) continue;
+    const upb_handlers *subh = upb_handlers_getsubhandlers(h, f);
+    if (subh && !upb_decoderplan_addmsgs(p, subh)) return false;
+  }
+  return true;
+}
+
+static void upb_decoderplan_free(upb_decoderplan *p) {
+  upb_handlers_unref(p->handlers, p);
+#ifdef UPB_USE_JIT_X64
+  if (p->jit_code) upb_decoderplan_freejit(p);
+#endif
+  free(p->bc_code);
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+    upb_inttable_uninit(&m->dispatch);
+    free(m->fields);
+    free(m->fields_bynum);
+    free(m);
+  }
+  upb_inttable_uninit(&p->msgs);
+  free(p);
+}
+
+// Returns NULL if memory could not be allocated.
+static upb_decoderplan *upb_decoderplan_alloc(const upb_handlers *h) {
   upb_decoderplan *p = malloc(sizeof(*p));
+  if (!p) return NULL;
   assert(upb_handlers_isfrozen(h));
+  p->refcount = 1;
+  p->cached = false;
   p->handlers = h;
-  upb_handlers_ref(h, p);
+  p->bc_code = NULL;
+  p->bc_size = 0;
+  p->has_aot = false;
 #ifdef UPB_USE_JIT_X64
   p->jit_code = NULL;
-  if (allowjit) upb_decoderplan_makejit(p);
 #endif
+  if (!upb_inttable_init(&p->msgs, UPB_CTYPE_PTR)) {
+    free(p);
+    return NULL;
+  }
+  upb_handlers_ref(h, p);
+  if (!upb_decoderplan_addmsgs(p, h)) goto err;
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+    if (!upb_decoderplan_initfields(p, m)) goto err;
+  }
   return p;
+
+err:
+  upb_decoderplan_free(p);
+  return NULL;
 }
 
-void upb_decoderplan_unref(upb_decoderplan *p) {
-  // TODO: make truly refcounted.
-  upb_handlers_unref(p->handlers, p);
+// Chooses the field each field's tag prediction points to.  This must wait
+// until the plan's projection (if any) is known, since values of skipped
+// fields have to go through upb_decode_tag().
+static void upb_decoderplan_predict(upb_decoderplan *p) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+    for (int j = 0; j < m->field_count; j++) {
+      upb_decoderplan_field *pf = m->fields_bynum[j];
+      upb_decoderplan_field *next = NULL;
+      if (upb_fielddef_isseq(pf->f)) {
+        next = pf;
+      } else if (j + 1 < m->field_count) {
+        next = m->fields_bynum[j + 1];
+      }
+      pf->next = NULL;
+      pf->next_tag_len = 0;
+      if (!next || next->skip) continue;
+      char buf[UPB_PB_VARINT_MAX_LEN];
+      size_t len = upb_vencode64(next->native_tag, buf);
+      if (len > sizeof(pf->next_tag)) continue;
+      pf->next = next;
+      memcpy(pf->next_tag, buf, len);
+      pf->next_tag_len = len;
+    }
+  }
+}
+
+static void upb_decoderplan_finish(upb_decoderplan *p, bool allowjit) {
+  upb_decoderplan_predict(p);
+  if (allowjit && upb_decoderplan_findaot(p)) return;
 #ifdef UPB_USE_JIT_X64
-  if (p->jit_code) upb_decoderplan_freejit(p);
+  if (allowjit) upb_decoderplan_makejit(p);
 #endif
-  free(p);
+  if (allowjit && !upb_decoderplan_hasjitcode(p))
+    upb_decoderplan_makebytecode(p);
+}
+
+/* Plan cache ****************************************************************/
+
+// Plans are cached per (handlers, allowjit), since frozen handlers always
+// produce the same plan.  The cache does not own a ref: a plan leaves the
+// cache when its last ref is dropped, so callers who want plans to be reused
+// should keep a ref.  Refcounts are atomic; upb's global lock (upb_lock())
+// is only taken to look up, add or remove cache entries, and also guards the
+// registry of precompiled decoders and the JIT's registrations with debuggers
+// and profilers.  A plan whose refcount has reached zero is being freed, so
+// lookups treat it as missing and a new plan may take its place.
+
+// Maps upb_handlers* -> upb_decoderplan*, indexed by allowjit.
+static upb_inttable upb_plancache[2];
+static size_t upb_plancache_count = 0;
+
+// Must be called with the lock held.
+static upb_decoderplan *upb_plancache_get(const upb_handlers *h,
+                                          bool allowjit) {
+  if (upb_plancache_count == 0) return NULL;
+  const upb_value *v = upb_inttable_lookupptr(&upb_plancache[allowjit], h);
+  if (!v) return NULL;
+  upb_decoderplan *p = upb_value_getptr(*v);
+  return upb_atomic_incnonzero(&p->refcount) ? p : NULL;
+}
+
+// Must be called with the lock held.
+static void upb_plancache_remove(upb_decoderplan *p) {
+  upb_inttable_removeptr(&upb_plancache[p->allowjit], p->handlers, NULL);
+  p->cached = false;
+  if (--upb_plancache_count == 0) {
+    upb_inttable_uninit(&upb_plancache[false]);
+    upb_inttable_uninit(&upb_plancache[true]);
+  }
+}
+
+// Must be called with the lock held.  Replaces any plan for the same
+// handlers that is being freed.  If memory could not be allocated the plan
+// is simply not cached.
+static void upb_plancache_add(upb_decoderplan *p, bool allowjit) {
+  if (upb_plancache_count > 0) {
+    const upb_value *v =
+        upb_inttable_lookupptr(&upb_plancache[allowjit], p->handlers);
+    if (v) upb_plancache_remove(upb_value_getptr(*v));
+  }
+  if (upb_plancache_count == 0) {
+    if (!upb_inttable_init(&upb_plancache[false], UPB_CTYPE_PTR)) return;
+    if (!upb_inttable_init(&upb_plancache[true], UPB_CTYPE_PTR)) {
+      upb_inttable_uninit(&upb_plancache[false]);
+      return;
+    }
+  }
+  if (!upb_inttable_insertptr(&upb_plancache[allowjit], p->handlers,
+                              upb_value_ptr(p))) {
+    if (upb_plancache_count == 0) {
+      upb_inttable_uninit(&upb_plancache[false]);
+      upb_inttable_uninit(&upb_plancache[true]);
+    }
+    return;
+  }
+  upb_plancache_count++;
+  p->cached = true;
+  p->allowjit = allowjit;
+}
+
+upb_decoderplan *upb_decoderplan_new(const upb_handlers *h, bool allowjit) {
+  upb_lock();
+  upb_decoderplan *p = upb_plancache_get(h, allowjit);
+  upb_unlock();
+  if (p) return p;
+
+  // Build the plan without holding the lock, since JIT-ting can be slow.
+  p = upb_decoderplan_alloc(h);
+  if (!p) return NULL;
+  upb_decoderplan_finish(p, allowjit);
+
+  upb_lock();
+  upb_decoderplan *existing = upb_plancache_get(h, allowjit);
+  if (!existing) upb_plancache_add(p, allowjit);
+  upb_unlock();
+  if (existing) {
+    // Another thread built the same plan while we were building ours.
+    upb_decoderplan_unref(p);
+    return existing;
+  }
+  return p;
+}
+
+void upb_decoderplan_ref(upb_decoderplan *p) { upb_atomic_inc(&p->refcount); }
+
+void upb_decoderplan_unref(upb_decoderplan *p) {
+  if (!upb_atomic_dec(&p->refcount)) return;
+  upb_lock();
+  if (p->cached) upb_plancache_remove(p);
+  upb_unlock();
+  upb_decoderplan_free(p);
+}
+
+/* Precompiled decoders *******************************************************/
+
+// Maps message name -> const upb_aotdecoder*.  Guarded by the plan cache lock.
+static upb_strtable upb_aotdecoders;
+static bool upb_aotdecoders_init = false;
+
+void upb_aot_register(const upb_aotdecoder *decoder) {
+  upb_lock();
+  if (!upb_aotdecoders_init) {
+    upb_strtable_init(&upb_aotdecoders, UPB_CTYPE_PTR);
+    upb_aotdecoders_init = true;
+  }
+  upb_strtable_remove(&upb_aotdecoders, decoder->name, NULL);
+  upb_strtable_insert(&upb_aotdecoders, decoder->name,
+                      upb_value_ptr((void*)decoder));
+  upb_unlock();
+}
+
+// Returns true if the decoder was generated for exactly the fields of "m".
+static bool upb_aot_matches(const upb_aotdecoder *decoder,
+                            const upb_decoderplan_msg *m) {
+  if (decoder->field_count != m->field_count) return false;
+  for (int i = 0; i < m->field_count; i++) {
+    const upb_fielddef *f = m->fields_bynum[i]->f;
+    if (decoder->fields[i].number != upb_fielddef_number(f) ||
+        decoder->fields[i].type != upb_fielddef_type(f))
+      return false;
+  }
+  return true;
+}
+
+// Finds the precompiled decoders for the plan's messages, returning true if
+// the plan will use them.  We only use them if the top-level message has one,
+// since the JIT or bytecode is likely to do better otherwise.
+static bool upb_decoderplan_findaot(upb_decoderplan *p) {
+  upb_lock();
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; upb_aotdecoders_init && !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+    const upb_value *v = upb_strtable_lookup(
+        &upb_aotdecoders, upb_msgdef_fullname(upb_handlers_msgdef(m->h)));
+    const upb_aotdecoder *decoder = v ? upb_value_getptr(*v) : NULL;
+    if (decoder && upb_aot_matches(decoder, m)) m->aot = decoder->decode;
+  }
+  upb_unlock();
+
+  upb_decoderplan_msg *top = upb_decoderplan_getmsg(p, p->handlers);
+  p->has_aot = top->aot != NULL;
+  if (!p->has_aot) {
+    upb_inttable_begin(&i, &p->msgs);
+    for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+      upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+      m->aot = NULL;
+    }
+  }
+  return p->has_aot;
+}
+
+/* Projections ****************************************************************/
+
+// While building a projection we track, for each message, the set of field
+// numbers that some path needs.  Maps upb_handlers* -> upb_inttable* (field
+// number -> true), or NULL if every field of the message is needed.  The
+// functions that add to it return false if memory could not be allocated.
+typedef upb_inttable upb_keepset;
+
+static bool upb_keepset_all(upb_keepset *keep, const upb_handlers *h) {
+  const upb_value *v = upb_inttable_lookupptr(keep, h);
+  if (v) {
+    upb_inttable *fields = upb_value_getptr(*v);
+    if (!fields) return true;  // Already keeping everything.
+    upb_inttable_uninit(fields);
+    free(fields);
+    upb_inttable_removeptr(keep, h, NULL);
+  }
+  if (!upb_inttable_insertptr(keep, h, upb_value_ptr(NULL))) return false;
+
+  // Everything below this message is needed too.
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, upb_handlers_msgdef(h));
+      !upb_msg_done(&i);
+      upb_msg_next(&i)) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    if (!upb_fielddef_issubmsg(f)) continue;
+    const upb_handlers *subh = upb_handlers_getsubhandlers(h, f);
+    if (subh && !upb_keepset_all(keep, subh)) return false;
+  }
+  return true;
+}
+
+static bool upb_keepset_add(upb_keepset *keep, const upb_handlers *h,
+                            const upb_fielddef *f) {
+  const upb_value *v = upb_inttable_lookupptr(keep, h);
+  upb_inttable *fields;
+  if (v) {
+    fields = upb_value_getptr(*v);
+    if (!fields) return true;  // Already keeping everything.
+  } else {
+    fields = malloc(sizeof(*fields));
+    if (!fields) return false;
+    if (!upb_inttable_init(fields, UPB_CTYPE_BOOL)) {
+      free(fields);
+      return false;
+    }
+    if (!upb_inttable_insertptr(keep, h, upb_value_ptr(fields))) {
+      upb_inttable_uninit(fields);
+      free(fields);
+      return false;
+    }
+  }
+  return upb_inttable_lookup32(fields, upb_fielddef_number(f)) ||
+         upb_inttable_insert(fields, upb_fielddef_number(f),
+                             upb_value_bool(true));
+}
+
+static bool upb_keepset_addpath(upb_keepset *keep, const upb_handlers *h,
+                                const char *path, upb_status *status) {
+  char *buf = malloc(strlen(path) + 1);
+  if (!buf) {
+    upb_status_seterrliteral(status, "out of memory");
+    return false;
+  }
+  strcpy(buf, path);
+  char *name = buf;
+  bool ok = false;
+  while (1) {
+    char *dot = strchr(name, '.');
+    if (dot) *dot = '\0';
+    const upb_fielddef *f = upb_msgdef_ntof(upb_handlers_msgdef(h), name);
+    if (!f) {
+      upb_status_seterrf(status, "No field named '%s' in projection '%s'",
+                         name, path);
+      goto done;
+    }
+    if (!upb_keepset_add(keep, h, f)) goto oom;
+    const upb_handlers *subh =
+        upb_fielddef_issubmsg(f) ? upb_handlers_getsubhandlers(h, f) : NULL;
+    if (!dot) {
+      if (subh && !upb_keepset_all(keep, subh)) goto oom;
+      break;
+    }
+    if (!subh) {
+      upb_status_seterrf(status,
+                         "Field '%s' in projection '%s' is not a submessage "
+                         "with handlers", name, path);
+      goto done;
+    }
+    h = subh;
+    name = dot + 1;
+  }
+  ok = true;
+  goto done;
+
+oom:
+  upb_status_seterrliteral(status, "out of memory");
+
+done:
+  free(buf);
+  return ok;
+}
+
+static void upb_keepset_uninit(upb_keepset *keep) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, keep);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_inttable *fields = upb_value_getptr(upb_inttable_iter_value(&i));
+    if (fields) {
+      upb_inttable_uninit(fields);
+      free(fields);
+    }
+  }
+  upb_inttable_uninit(keep);
+}
+
+upb_decoderplan *upb_decoderplan_newprojection(const upb_handlers *h,
+                                               const char *const *paths, int n,
+                                               bool allowjit,
+                                               upb_status *status) {
+  upb_keepset keep;
+  if (!upb_inttable_init(&keep, UPB_CTYPE_PTR)) {
+    upb_status_seterrliteral(status, "out of memory");
+    return NULL;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!upb_keepset_addpath(&keep, h, paths[i], status)) {
+      upb_keepset_uninit(&keep);
+      return NULL;
+    }
+  }
+
+  // Mark the fields that are not kept as skipped in each message.
+  upb_decoderplan *p = upb_decoderplan_alloc(h);
+  if (!p) {
+    upb_keepset_uninit(&keep);
+    upb_status_seterrliteral(status, "out of memory");
+    return NULL;
+  }
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    upb_decoderplan_msg *m = upb_value_getptr(upb_inttable_iter_value(&i));
+    const upb_value *v = upb_inttable_lookupptr(&keep, m->h);
+    const upb_inttable *fields = v ? upb_value_getptr(*v) : NULL;
+    // Messages that no path reaches can only be reached through skipped
+    // fields, so their skip sets don't matter.
+    if (v && !fields) continue;
+    for (int j = 0; j < m->field_count; j++) {
+      upb_decoderplan_field *pf = &m->fields[j];
+      if (!fields || !upb_inttable_lookup32(fields, upb_fielddef_number(pf->f)))
+        pf->skip = true;
+    }
+  }
+  upb_keepset_uninit(&keep);
+
+  upb_decoderplan_finish(p, allowjit);
+  return p;
 }
 
 bool upb_decoderplan_hasjitcode(upb_decoderplan *p) {
@@ -89,6 +540,14 @@ bool upb_decoderplan_hasjitcode(upb_decoderplan *p) {
 #endif
 }
 
+bool upb_decoderplan_hasbytecode(upb_decoderplan *p) {
+  return p->bc_code != NULL;
+}
+
+bool upb_decoderplan_hasaot(upb_decoderplan *p) {
+  return p->has_aot;
+}
+
 
 /* upb_decoder ****************************************************************/
 
@@ -100,15 +559,26 @@ bool upb_decoderplan_hasjitcode(upb_decoderplan *p) {
 #define FORCEINLINE static inline __attribute__((always_inline))
 #define NOINLINE static __attribute__((noinline))
 
+// Errors and suspensions exit the decoder from wherever they happen.  By
+// default we longjmp() back to upb_decoder_decode().  With
+// UPB_DECODER_NO_SETJMP we instead set d->exiting and return, and every caller
+// of a function that can exit checks for it with UPB_UNWIND() before going on,
+// so that the decoder unwinds one frame at a time.  "UPB_UNWIND(d) val;"
+// returns val from the calling function if we are exiting; with setjmp() it
+// compiles to nothing, since exiting functions never return.
+#ifdef UPB_DECODER_NO_SETJMP
+#define UPB_EXITS
+#define UPB_UNWIND(d) if (__builtin_expect((d)->exiting, 0)) return
+static void upb_decoder_exitjmp(upb_decoder *d) { d->exiting = true; }
+#else
+#define UPB_EXITS UPB_NORETURN
+#define UPB_UNWIND(d) if (0) return
 UPB_NORETURN static void upb_decoder_exitjmp(upb_decoder *d) {
-  // Resumable decoder would back out to completed_ptr (and possibly get a
-  // previous buffer).
   _longjmp(d->exitjmp, 1);
 }
-UPB_NORETURN static void upb_decoder_exitjmp2(void *d) {
-  upb_decoder_exitjmp(d);
-}
-UPB_NORETURN static void upb_decoder_abortjmp(upb_decoder *d, const char *msg) {
+#endif
+
+UPB_EXITS static void upb_decoder_abortjmp(upb_decoder *d, const char *msg) {
   upb_status_seterrliteral(&d->status, msg);
   upb_decoder_exitjmp(d);
 }
@@ -139,6 +609,8 @@ uint64_t upb_decoder_bufendofs(upb_decoder *d) {
 }
 
 static bool upb_decoder_islegalend(upb_decoder *d) {
+  // A stream of records may only end between records.
+  if (d->records) return d->stack[0].end_ofs == UPB_NONDELIMITED;
   if (d->top == d->stack) return true;
   if (d->top - 1 == d->stack &&
       d->top->is_sequence && !d->top->is_packed) return true;
@@ -159,8 +631,10 @@ static void upb_decoder_setmsgend(upb_decoder *d) {
 
 static void upb_decoder_skiptonewbuf(upb_decoder *d, uint64_t ofs) {
   assert(ofs >= upb_decoder_offset(d));
-  if (ofs > upb_byteregion_endofs(d->input))
+  if (ofs > upb_byteregion_endofs(d->input)) {
     upb_decoder_abortjmp(d, "Unexpected EOF");
+    return;
+  }
   d->buf = NULL;
   d->ptr = NULL;
   d->end = NULL;
@@ -171,20 +645,42 @@ static void upb_decoder_skiptonewbuf(upb_decoder *d, uint64_t ofs) {
   d->bufstart_ofs = ofs;
 }
 
+// Backs out to the last committed offset (the discard offset of our input)
+// and exits the decoder with UPB_SUSPENDED.  Everything we decoded after the
+// last checkpoint will be decoded again when we are resumed; our stack and the
+// sink's stack already reflect the state as of the last checkpoint.
+UPB_EXITS static void upb_decoder_suspendjmp(upb_decoder *d) {
+  d->suspended = true;
+  d->buf = NULL;
+  d->ptr = NULL;
+  d->end = NULL;
+  d->delim_end = NULL;
+#ifdef UPB_USE_JIT_X64
+  d->jit_end = NULL;
+#endif
+  d->bufstart_ofs = upb_byteregion_discardofs(d->input);
+  upb_decoder_exitjmp(d);
+}
+
+// Fetches more data into our input.  Returns false on EOF, suspends on
+// WOULDBLOCK.
+static bool upb_decoder_fetch(upb_decoder *d) {
+  switch (upb_byteregion_fetch(d->input)) {
+    case UPB_BYTE_OK: return true;
+    case UPB_BYTE_EOF: return false;
+    case UPB_BYTE_WOULDBLOCK: upb_decoder_suspendjmp(d); return false;
+    case UPB_BYTE_ERROR:
+    default: upb_decoder_abortjmp(d, "I/O error in input"); return false;
+  }
+}
+
 static bool upb_trypullbuf(upb_decoder *d) {
   assert(upb_decoder_bufleft(d) == 0);
   upb_decoder_skiptonewbuf(d, upb_decoder_offset(d));
+  UPB_UNWIND(d) false;
   if (upb_byteregion_available(d->input, d->bufstart_ofs) == 0) {
-    switch (upb_byteregion_fetch(d->input)) {
-      case UPB_BYTE_OK:
-        assert(upb_byteregion_available(d->input, d->bufstart_ofs) > 0);
-        break;
-      case UPB_BYTE_EOF: return false;
-      case UPB_BYTE_ERROR: upb_decoder_abortjmp(d, "I/O error in input");
-      // Decoder resuming is not yet supported.
-      case UPB_BYTE_WOULDBLOCK:
-        upb_decoder_abortjmp(d, "Input returned WOULDBLOCK");
-    }
+    if (!upb_decoder_fetch(d)) return false;
+    assert(upb_byteregion_available(d->input, d->bufstart_ofs) > 0);
   }
   size_t len;
   d->buf = upb_byteregion_getptr(d->input, d->bufstart_ofs, &len);
@@ -204,7 +700,10 @@ static bool upb_trypullbuf(upb_decoder *d) {
 }
 
 static void upb_pullbuf(upb_decoder *d) {
-  if (!upb_trypullbuf(d)) upb_decoder_abortjmp(d, "Unexpected EOF");
+  if (!upb_trypullbuf(d)) {
+    UPB_UNWIND(d);
+    upb_decoder_abortjmp(d, "Unexpected EOF");
+  }
 }
 
 static void upb_decoder_checkpoint(upb_decoder *d) {
@@ -216,6 +715,7 @@ static void upb_decoder_discardto(upb_decoder *d, uint64_t ofs) {
     upb_decoder_advance(d, ofs - upb_decoder_offset(d));
   } else {
     upb_decoder_skiptonewbuf(d, ofs);
+    UPB_UNWIND(d);
   }
   upb_decoder_checkpoint(d);
 }
@@ -224,6 +724,28 @@ static void upb_decoder_discard(upb_decoder *d, size_t bytes) {
   upb_decoder_discardto(d, upb_decoder_offset(d) + bytes);
 }
 
+// Like upb_decoder_discardto(), but does not commit our progress and ensures
+// that the skipped bytes are fetched, so they can still be handed out in a
+// byteregion (and are not lost if we suspend before the next checkpoint).
+static void upb_decoder_skipto(upb_decoder *d, uint64_t ofs) {
+  if (ofs <= upb_decoder_bufendofs(d)) {
+    upb_decoder_advance(d, ofs - upb_decoder_offset(d));
+    return;
+  }
+  if (ofs > upb_byteregion_endofs(d->input)) {
+    upb_decoder_abortjmp(d, "Unexpected EOF");
+    return;
+  }
+  while (upb_byteregion_fetchofs(d->input) < ofs) {
+    if (!upb_decoder_fetch(d)) {
+      UPB_UNWIND(d);
+      upb_decoder_abortjmp(d, "Unexpected EOF");
+      return;
+    }
+  }
+  upb_decoder_skiptonewbuf(d, ofs);
+}
+
 
 /* Decoding of wire types *****************************************************/
 
@@ -232,12 +754,17 @@ NOINLINE uint64_t upb_decode_varint_slow(upb_decoder *d) {
   uint64_t u64 = 0;
   int bitpos;
   for(bitpos = 0; bitpos < 70 && (byte & 0x80); bitpos += 7) {
-    if (upb_decoder_bufleft(d) == 0) upb_pullbuf(d);
+    if (upb_decoder_bufleft(d) == 0) {
+      upb_pullbuf(d);
+      UPB_UNWIND(d) 0;
+    }
     u64 |= ((uint64_t)(byte = *d->ptr) & 0x7F) << bitpos;
     upb_decoder_advance(d, 1);
   }
-  if(bitpos == 70 && (byte & 0x80))
+  if(bitpos == 70 && (byte & 0x80)) {
     upb_decoder_abortjmp(d, "Unterminated varint");
+    return 0;
+  }
   return u64;
 }
 
@@ -254,7 +781,11 @@ FORCEINLINE uint32_t upb_decode_varint32(upb_decoder *d) {
   if ((*(p++) & 0x80) == 0) goto done;  // likely
 slow:
   u64 = upb_decode_varint_slow(d);
-  if (u64 > UINT32_MAX) upb_decoder_abortjmp(d, "Unterminated 32-bit varint");
+  UPB_UNWIND(d) 0;
+  if (u64 > UINT32_MAX) {
+    upb_decoder_abortjmp(d, "Unterminated 32-bit varint");
+    return 0;
+  }
   ret = (uint32_t)u64;
   p = d->ptr;  // Turn the next line into a nop.
 done:
@@ -277,7 +808,10 @@ FORCEINLINE uint64_t upb_decode_varint(upb_decoder *d) {
   if (upb_decoder_bufleft(d) >= 10) {
     // Fast case.
     upb_decoderet r = upb_vdecode_fast(d->ptr);
-    if (r.p == NULL) upb_decoder_abortjmp(d, "Unterminated varint");
+    if (r.p == NULL) {
+      upb_decoder_abortjmp(d, "Unterminated varint");
+      return 0;
+    }
     upb_decoder_advance(d, r.p - d->ptr);
     return r.val;
   } else if (upb_decoder_bufleft(d) > 0) {
@@ -310,6 +844,7 @@ FORCEINLINE void upb_decode_fixed(upb_decoder *d, char *buf, size_t bytes) {
       read += avail;
       if (read == bytes) break;
       upb_pullbuf(d);
+      UPB_UNWIND(d);
     }
   }
 }
@@ -325,12 +860,16 @@ FORCEINLINE uint64_t upb_decode_fixed64(upb_decoder *d) {
   return u64;  // TODO: proper byte swapping for big-endian machines.
 }
 
-INLINE void upb_push_msg(upb_decoder *d, const upb_fielddef *f, uint64_t end) {
+INLINE void upb_push_msg(upb_decoder *d, const upb_decoderplan_field *pf,
+                         uint64_t end) {
+  const upb_fielddef *f = pf->f;
   upb_decoder_frame *fr = d->top + 1;
   if (!upb_sink_startsubmsg(&d->sink, f) || fr > d->limit) {
     upb_decoder_abortjmp(d, "Nesting too deep.");
+    return;
   }
   fr->f = f;
+  fr->msg = pf->submsg;
   fr->is_sequence = false;
   fr->is_packed = false;
   fr->end_ofs = end;
@@ -345,8 +884,10 @@ INLINE void upb_push_seq(upb_decoder *d, const upb_fielddef *f, bool packed,
   upb_decoder_frame *fr = d->top + 1;
   if (!upb_sink_startseq(&d->sink, f) || fr > d->limit) {
     upb_decoder_abortjmp(d, "Nesting too deep.");
+    return;
   }
   fr->f = f;
+  fr->msg = d->top->msg;
   fr->is_sequence = true;
   fr->group_fieldnum = -1;
   fr->is_packed = packed;
@@ -374,9 +915,15 @@ INLINE void upb_pop_seq(upb_decoder *d) {
 // properly sign-extended.  We could detect this and error about the data loss,
 // but proto2 does not do this, so we pass.
 
+// Values are delivered straight to the handler cached in the plan, which is
+// what upb_sink_put*() would look up for this field.
 #define T(type, wt, name, convfunc) \
-  INLINE void upb_decode_ ## type(upb_decoder *d, const upb_fielddef *f) { \
-    upb_sink_put ## name(&d->sink, f, (convfunc)(upb_decode_ ## wt(d))); \
+  static void upb_decode_ ## type(upb_decoder *d, \
+                                  const upb_decoderplan_field *pf) { \
+    upb_ ## name ## _handler *h = (upb_ ## name ## _handler*)pf->handler; \
+    uint64_t val = upb_decode_ ## wt(d); \
+    UPB_UNWIND(d); \
+    if (h) h(d->sink.top->closure, pf->data, (convfunc)(val)); \
   } \
 
 static double  upb_asdouble(uint64_t n) { double d; memcpy(&d, &n, 8); return d; }
@@ -398,181 +945,1020 @@ T(SINT32,   varint,  int32,  upb_zzdec_32)
 T(SINT64,   varint,  int64,  upb_zzdec_64)
 #undef T
 
-static void upb_decode_GROUP(upb_decoder *d, const upb_fielddef *f) {
-  upb_push_msg(d, f, UPB_NONDELIMITED);
+// For fields whose value handler just stores the value into the closure (see
+// upb_handlers_setstore()), we do the store ourselves instead of calling it.
+#define T(type, wt, ctype, convfunc) \
+  static void upb_decode_ ## type ## _store(upb_decoder *d, \
+                                            const upb_decoderplan_field *pf) { \
+    const upb_stdmsg_fval *fv = pf->data; \
+    ctype val = (convfunc)(upb_decode_ ## wt(d)); \
+    UPB_UNWIND(d); \
+    char *m = d->sink.top->closure; \
+    if (fv->hasbit >= 0) m[fv->hasbit / 8] |= 1 << (fv->hasbit % 8); \
+    memcpy(m + fv->offset, &val, sizeof(val)); \
+  } \
+
+T(INT32,    varint,  int32_t,  int32_t)
+T(INT64,    varint,  int64_t,  int64_t)
+T(UINT32,   varint,  uint32_t, uint32_t)
+T(UINT64,   varint,  uint64_t, uint64_t)
+T(FIXED32,  fixed32, uint32_t, uint32_t)
+T(FIXED64,  fixed64, uint64_t, uint64_t)
+T(SFIXED32, fixed32, int32_t,  int32_t)
+T(SFIXED64, fixed64, int64_t,  int64_t)
+T(BOOL,     varint,  bool,     bool)
+T(ENUM,     varint,  int32_t,  int32_t)
+T(DOUBLE,   fixed64, double,   upb_asdouble)
+T(FLOAT,    fixed32, float,    upb_asfloat)
+T(SINT32,   varint,  int32_t,  upb_zzdec_32)
+T(SINT64,   varint,  int64_t,  upb_zzdec_64)
+#undef T
+
+// Decodes at least one and up to "max" values of the packed varint run that
+// we are in.  Values that are in the current buffer are decoded in bulk.
+static size_t upb_decode_packedvarints(upb_decoder *d, uint64_t *vals,
+                                       size_t max) {
+  uint64_t end = d->top->end_ofs;
+  // We may have overrun the end of the run with a varint that spanned a buffer
+  // seam, in which case delim_end could not catch it.
+  if (upb_decoder_offset(d) > end) {
+    upb_decoder_abortjmp(d, "Bad submessage end");
+    return 0;
+  }
+  size_t n = 0;
+  do {
+    if (upb_decoder_bufleft(d) > 0) {
+      size_t got = max - n;
+      const char *limit = d->delim_end ? d->delim_end : d->end;
+      const char *p = upb_vdecode_bulk64(d->ptr, limit, vals + n, &got);
+      if (p == NULL) {
+        upb_decoder_abortjmp(d, "Unterminated varint");
+        return 0;
+      }
+      upb_decoder_advance(d, p - d->ptr);
+      n += got;
+    }
+    // The next varint (if any) spans a buffer seam.
+    if (n < max && upb_decoder_offset(d) < end) {
+      vals[n++] = upb_decode_varint(d);
+      UPB_UNWIND(d) 0;
+    }
+  } while (n < max && upb_decoder_offset(d) < end);
+  return n;
+}
+
+// For fields with an array handler.  Inside a packed run we decode as many
+// values as we can (up to the end of the run) into a local buffer and deliver
+// them in one call; the main loop commits our progress after every chunk.  If
+// we are suspended in the middle of a chunk, none of it has been delivered yet
+// and the whole chunk is decoded again when we resume.
+#define T(type, wt, name, ctype, convfunc) \
+  static void upb_decode_ ## type ## _array( \
+      upb_decoder *d, const upb_decoderplan_field *pf) { \
+    ctype vals[UPB_DECODER_MAXARRAY]; \
+    size_t n = 0; \
+    vals[n++] = (convfunc)(upb_decode_ ## wt(d)); \
+    UPB_UNWIND(d); \
+    if (d->top_is_packed) { \
+      uint64_t end = d->top->end_ofs; \
+      while (n < UPB_DECODER_MAXARRAY && upb_decoder_offset(d) < end) { \
+        vals[n++] = (convfunc)(upb_decode_ ## wt(d)); \
+        UPB_UNWIND(d); \
+      } \
+    } \
+    upb_ ## name ## array_handler *h = \
+        (upb_ ## name ## array_handler*)pf->handler; \
+    h(d->sink.top->closure, pf->data, vals, n); \
+  } \
+
+// Packed varints go through the bulk varint decoder.
+#define V(type, name, ctype, convfunc) \
+  static void upb_decode_ ## type ## _array( \
+      upb_decoder *d, const upb_decoderplan_field *pf) { \
+    ctype vals[UPB_DECODER_MAXARRAY]; \
+    size_t n = 1; \
+    if (d->top_is_packed) { \
+      uint64_t raw[UPB_DECODER_MAXARRAY]; \
+      n = upb_decode_packedvarints(d, raw, UPB_DECODER_MAXARRAY); \
+      for (size_t i = 0; i < n; i++) vals[i] = (convfunc)(raw[i]); \
+    } else { \
+      vals[0] = (convfunc)(upb_decode_varint(d)); \
+    } \
+    UPB_UNWIND(d); \
+    upb_ ## name ## array_handler *h = \
+        (upb_ ## name ## array_handler*)pf->handler; \
+    h(d->sink.top->closure, pf->data, vals, n); \
+  } \
+
+V(INT32,    int32,  int32_t,  int32_t)
+V(INT64,    int64,  int64_t,  int64_t)
+V(UINT32,   uint32, uint32_t, uint32_t)
+V(UINT64,   uint64, uint64_t, uint64_t)
+T(FIXED32,  fixed32, uint32, uint32_t, uint32_t)
+T(FIXED64,  fixed64, uint64, uint64_t, uint64_t)
+T(SFIXED32, fixed32, int32,  int32_t,  int32_t)
+T(SFIXED64, fixed64, int64,  int64_t,  int64_t)
+V(BOOL,     bool,   bool,     bool)
+V(ENUM,     int32,  int32_t,  int32_t)
+T(DOUBLE,   fixed64, double, double,   upb_asdouble)
+T(FLOAT,    fixed32, float,  float,    upb_asfloat)
+V(SINT32,   int32,  int32_t,  upb_zzdec_32)
+V(SINT64,   int64,  int64_t,  upb_zzdec_64)
+#undef T
+#undef V
+
+#ifdef UPB_USE_JIT_X64
+// For the JIT, which finds packed fixed-size values whole in the buffer.  The
+// values are copied out in chunks first, since the buffer is not aligned for
+// them.
+#define F(type, name, ctype) \
+  static const char *upb_put_ ## type ## _array( \
+      upb_decoder *d, const upb_decoderplan_field *pf, const char *p, \
+      size_t n) { \
+    upb_ ## name ## array_handler *h = \
+        (upb_ ## name ## array_handler*)pf->handler; \
+    ctype vals[UPB_DECODER_MAXARRAY]; \
+    while (n > 0) { \
+      size_t chunk = UPB_MIN(n, UPB_DECODER_MAXARRAY); \
+      memcpy(vals, p, chunk * sizeof(ctype)); \
+      h(d->sink.top->closure, pf->data, vals, chunk); \
+      p += chunk * sizeof(ctype); \
+      n -= chunk; \
+    } \
+    return p; \
+  } \
+
+F(FIXED32,  uint32, uint32_t)
+F(FIXED64,  uint64, uint64_t)
+F(SFIXED32, int32,  int32_t)
+F(SFIXED64, int64,  int64_t)
+F(DOUBLE,   double, double)
+F(FLOAT,    float,  float)
+#undef F
+
+static upb_decoder_putarrayfunc *upb_decoder_getputarray(upb_fieldtype_t type) {
+  switch (type) {
+    case UPB_TYPE(FIXED32): return &upb_put_FIXED32_array;
+    case UPB_TYPE(FIXED64): return &upb_put_FIXED64_array;
+    case UPB_TYPE(SFIXED32): return &upb_put_SFIXED32_array;
+    case UPB_TYPE(SFIXED64): return &upb_put_SFIXED64_array;
+    case UPB_TYPE(DOUBLE): return &upb_put_DOUBLE_array;
+    case UPB_TYPE(FLOAT): return &upb_put_FLOAT_array;
+    default: return NULL;
+  }
 }
+#endif
 
-static void upb_decode_MESSAGE(upb_decoder *d, const upb_fielddef *f) {
+static void upb_decode_GROUP(upb_decoder *d, const upb_decoderplan_field *pf) {
+  upb_push_msg(d, pf, UPB_NONDELIMITED);
+}
+
+static void upb_decode_MESSAGE(upb_decoder *d,
+                               const upb_decoderplan_field *pf) {
   uint32_t len = upb_decode_varint32(d);
-  upb_push_msg(d, f, upb_decoder_offset(d) + len);
+  UPB_UNWIND(d);
+  uint64_t ofs = upb_decoder_offset(d);
+  if (pf->handler) {
+    // Hand out the submessage's bytes instead of descending into it, fetched
+    // and pinned like a string view.
+    upb_decoder_skipto(d, ofs + len);
+    UPB_UNWIND(d);
+    upb_strview view;
+    if (!upb_byteregion_getview(d->input, ofs, len, &view)) {
+      upb_decoder_abortjmp(d, "Out of memory");
+      return;
+    }
+    upb_lazysubmsg_handler *h = (upb_lazysubmsg_handler*)pf->handler;
+    if (!h(d->sink.top->closure, pf->data, &view)) {
+      upb_decoder_abortjmp(d, "Lazy submessage handler returned false");
+      return;
+    }
+    upb_decoder_checkpoint(d);
+    return;
+  }
+  upb_push_msg(d, pf, ofs + len);
 }
 
-static void upb_decode_STRING(upb_decoder *d, const upb_fielddef *f) {
-  uint32_t strlen = upb_decode_varint32(d);
+// Delivers the rest of the string that is currently in progress (d->str_f).
+// We commit our progress after every chunk, so if the input suspends in the
+// middle of a string we resume here without calling startstr() again.
+static void upb_decoder_putstr(upb_decoder *d) {
+  const upb_fielddef *f = d->str_f;
   uint64_t offset = upb_decoder_offset(d);
-  uint64_t end = offset + strlen;
-  if (end > upb_byteregion_endofs(d->input))
-    upb_decoder_abortjmp(d, "Unexpected EOF");
-  upb_sink_startstr(&d->sink, f, strlen);
-  while (strlen > 0) {
-    if (upb_byteregion_available(d->input, offset) == 0)
+  while (offset < d->str_end_ofs) {
+    if (upb_byteregion_available(d->input, offset) == 0) {
       upb_pullbuf(d);
+      UPB_UNWIND(d);
+    }
+    uint64_t strlen = d->str_end_ofs - offset;
     size_t len;
     const char *ptr = upb_byteregion_getptr(d->input, offset, &len);
     len = UPB_MIN(len, strlen);
-    len = upb_sink_putstring(&d->sink, f, ptr, len);
-    if (len > strlen)
+    len = upb_sink_putstring_sel(&d->sink, d->str_sel, ptr, len);
+    if (len > strlen) {
       upb_decoder_abortjmp(d, "Skipped too many bytes.");
+      return;
+    }
     offset += len;
-    strlen -= len;
     upb_decoder_discardto(d, offset);
+    UPB_UNWIND(d);
   }
+  d->str_f = NULL;
   upb_sink_endstr(&d->sink, f);
 }
 
+// For string fields with a string view handler: the whole string is fetched
+// and handed out pinned, instead of being pushed through startstr/endstr.
+static void upb_decode_STRING_view(upb_decoder *d,
+                                   const upb_decoderplan_field *pf) {
+  uint32_t strlen = upb_decode_varint32(d);
+  UPB_UNWIND(d);
+  uint64_t ofs = upb_decoder_offset(d);
+  upb_decoder_skipto(d, ofs + strlen);
+  UPB_UNWIND(d);
+  upb_strview view;
+  if (!upb_byteregion_getview(d->input, ofs, strlen, &view)) {
+    upb_decoder_abortjmp(d, "Out of memory");
+    return;
+  }
+  upb_stringview_handler *h = (upb_stringview_handler*)pf->handler;
+  if (!h(d->sink.top->closure, pf->data, &view)) {
+    upb_decoder_abortjmp(d, "String view handler returned false");
+    return;
+  }
+  upb_decoder_checkpoint(d);
+}
+
+static void upb_decode_STRING(upb_decoder *d,
+                              const upb_decoderplan_field *pf) {
+  const upb_fielddef *f = pf->f;
+  uint32_t strlen = upb_decode_varint32(d);
+  UPB_UNWIND(d);
+  uint64_t end = upb_decoder_offset(d) + strlen;
+  if (end > upb_byteregion_endofs(d->input)) {
+    upb_decoder_abortjmp(d, "Unexpected EOF");
+    return;
+  }
+  upb_sink_startstr(&d->sink, f, strlen);
+  d->str_f = f;
+  d->str_sel = pf->selector;
+  d->str_end_ofs = end;
+  upb_decoder_checkpoint(d);
+  upb_decoder_putstr(d);
+}
+
+
+/* Dispatch tables ************************************************************/
+
+static upb_decoder_decodefunc *const upb_decoder_decodefuncs[] = {
+  NULL,                  // ENDGROUP
+  &upb_decode_DOUBLE,
+  &upb_decode_FLOAT,
+  &upb_decode_INT64,
+  &upb_decode_UINT64,
+  &upb_decode_INT32,
+  &upb_decode_FIXED64,
+  &upb_decode_FIXED32,
+  &upb_decode_BOOL,
+  &upb_decode_STRING,
+  &upb_decode_GROUP,
+  &upb_decode_MESSAGE,
+  &upb_decode_STRING,    // BYTES
+  &upb_decode_UINT32,
+  &upb_decode_ENUM,
+  &upb_decode_SFIXED32,
+  &upb_decode_SFIXED64,
+  &upb_decode_SINT32,
+  &upb_decode_SINT64,
+};
+
+// For repeated primitive fields with an array handler.
+static upb_decoder_decodefunc *const upb_decoder_arraydecodefuncs[] = {
+  NULL,                  // ENDGROUP
+  &upb_decode_DOUBLE_array,
+  &upb_decode_FLOAT_array,
+  &upb_decode_INT64_array,
+  &upb_decode_UINT64_array,
+  &upb_decode_INT32_array,
+  &upb_decode_FIXED64_array,
+  &upb_decode_FIXED32_array,
+  &upb_decode_BOOL_array,
+  NULL,                  // STRING
+  NULL,                  // GROUP
+  NULL,                  // MESSAGE
+  NULL,                  // BYTES
+  &upb_decode_UINT32_array,
+  &upb_decode_ENUM_array,
+  &upb_decode_SFIXED32_array,
+  &upb_decode_SFIXED64_array,
+  &upb_decode_SINT32_array,
+  &upb_decode_SINT64_array,
+};
+
+// For primitive fields whose value handler is a store.
+static upb_decoder_decodefunc *const upb_decoder_storedecodefuncs[] = {
+  NULL,                  // ENDGROUP
+  &upb_decode_DOUBLE_store,
+  &upb_decode_FLOAT_store,
+  &upb_decode_INT64_store,
+  &upb_decode_UINT64_store,
+  &upb_decode_INT32_store,
+  &upb_decode_FIXED64_store,
+  &upb_decode_FIXED32_store,
+  &upb_decode_BOOL_store,
+  NULL,                  // STRING
+  NULL,                  // GROUP
+  NULL,                  // MESSAGE
+  NULL,                  // BYTES
+  &upb_decode_UINT32_store,
+  &upb_decode_ENUM_store,
+  &upb_decode_SFIXED32_store,
+  &upb_decode_SFIXED64_store,
+  &upb_decode_SINT32_store,
+  &upb_decode_SINT64_store,
+};
+
+static void upb_decoderplan_initfield(upb_decoderplan *p,
+                                      const upb_handlers *h,
+                                      const upb_fielddef *f,
+                                      upb_decoderplan_field *pf) {
+  upb_fieldtype_t type = upb_fielddef_type(f);
+  uint32_t num = upb_fielddef_number(f);
+  pf->f = f;
+  pf->native_tag = (num << 3) | upb_decoder_types[type].native_wire_type;
+  pf->packed_tag = upb_decoder_types[type].is_numeric ?
+      (num << 3) | UPB_WIRE_TYPE_DELIMITED : 0;
+  pf->decode = upb_decoder_decodefuncs[type];
+  pf->skip = false;
+  pf->bc_ofs = 0;
+#ifdef UPB_USE_JIT_X64
+  pf->jit_aftersubmsg = NULL;
+  pf->jit_resumeseq = NULL;
+  pf->jit_resumepacked = NULL;
+#endif
+  pf->submsg = NULL;
+
+  upb_handlertype_t handlertype;
+  if (upb_fielddef_issubmsg(f)) {
+    const upb_handlers *subh = upb_handlers_getsubhandlers(h, f);
+    if (subh) pf->submsg = upb_decoderplan_getmsg(p, subh);
+    handlertype = UPB_HANDLER_LAZYSUBMSG;
+  } else if (upb_fielddef_isstring(f)) {
+    handlertype = UPB_HANDLER_STRING;
+  } else {
+    handlertype = upb_handlers_getprimitivehandlertype(f);
+  }
+  pf->handler = NULL;
+  pf->data = NULL;
+  upb_selector_t array;
+  if (upb_getselector(f, UPB_HANDLER_ARRAY, &array) &&
+      upb_handlers_gethandler(h, array)) {
+    // The array handler takes the place of the value handler.
+    pf->decode = upb_decoder_arraydecodefuncs[type];
+    handlertype = UPB_HANDLER_ARRAY;
+  }
+  upb_selector_t strview;
+  if (upb_getselector(f, UPB_HANDLER_STRINGVIEW, &strview) &&
+      upb_handlers_gethandler(h, strview)) {
+    pf->decode = &upb_decode_STRING_view;
+    handlertype = UPB_HANDLER_STRINGVIEW;
+  }
+  if (upb_getselector(f, handlertype, &pf->selector)) {
+    pf->handler = upb_handlers_gethandler(h, pf->selector);
+    pf->data = upb_handlers_gethandlerdata(h, pf->selector);
+    if (handlertype != UPB_HANDLER_ARRAY &&
+        upb_handlers_getstore(h, pf->selector)) {
+      pf->decode = upb_decoder_storedecodefuncs[type];
+    }
+  }
+  if (pf->decode == upb_decoder_storedecodefuncs[type]) {
+    pf->aot = UPB_AOT_STORE;
+  } else if (pf->decode == upb_decoder_decodefuncs[type] &&
+             upb_fielddef_isprimitive(f)) {
+    pf->aot = UPB_AOT_CALL;
+  } else {
+    pf->aot = UPB_AOT_DEFER;
+  }
+}
+
+static int upb_decoderplan_cmpfields(const void *_a, const void *_b) {
+  const upb_decoderplan_field *a = *(upb_decoderplan_field*const*)_a;
+  const upb_decoderplan_field *b = *(upb_decoderplan_field*const*)_b;
+  uint32_t a_num = upb_fielddef_number(a->f);
+  uint32_t b_num = upb_fielddef_number(b->f);
+  return a_num < b_num ? -1 : (a_num > b_num);
+}
+
+// Returns false if memory could not be allocated.
+static bool upb_decoderplan_initfields(upb_decoderplan *p,
+                                       upb_decoderplan_msg *m) {
+  const upb_msgdef *md = upb_handlers_msgdef(m->h);
+  int n = upb_msgdef_numfields(md);
+  m->fields = malloc(n * sizeof(*m->fields));
+  m->fields_bynum = malloc(n * sizeof(*m->fields_bynum));
+  if (n > 0 && (!m->fields || !m->fields_bynum)) return false;
+  m->field_count = n;
+  upb_decoderplan_field *pf = m->fields;
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, md); !upb_msg_done(&i); upb_msg_next(&i), pf++) {
+    const upb_fielddef *f = upb_msg_iter_field(&i);
+    upb_decoderplan_initfield(p, m->h, f, pf);
+    pf->msg = m;
+    if (!upb_inttable_insert(&m->dispatch, upb_fielddef_number(f),
+                             upb_value_ptr(pf)))
+      return false;
+  }
+  upb_inttable_compact(&m->dispatch);
+
+  for (int j = 0; j < m->field_count; j++) m->fields_bynum[j] = &m->fields[j];
+  qsort(m->fields_bynum, m->field_count, sizeof(*m->fields_bynum),
+        &upb_decoderplan_cmpfields);
+  return true;
+}
+
+
+/* Unknown fields *************************************************************/
+
+static void upb_decoder_skipgroup(upb_decoder *d, uint32_t fieldnum, int depth);
+
+// Skips the value of an unknown field whose tag has just been read, without
+// committing our progress.
+static void upb_decoder_skipval(upb_decoder *d, uint32_t tag, int depth) {
+  switch (tag & 0x7) {
+    case UPB_WIRE_TYPE_VARINT: upb_decode_varint(d); break;
+    case UPB_WIRE_TYPE_32BIT:
+      upb_decoder_skipto(d, upb_decoder_offset(d) + 4); break;
+    case UPB_WIRE_TYPE_64BIT:
+      upb_decoder_skipto(d, upb_decoder_offset(d) + 8); break;
+    case UPB_WIRE_TYPE_DELIMITED: {
+      uint32_t len = upb_decode_varint32(d);
+      UPB_UNWIND(d);
+      upb_decoder_skipto(d, upb_decoder_offset(d) + len);
+      break;
+    }
+    case UPB_WIRE_TYPE_START_GROUP:
+      upb_decoder_skipgroup(d, tag >> 3, depth + 1);
+      break;
+    case UPB_WIRE_TYPE_END_GROUP:
+      upb_decoder_abortjmp(d, "Unmatched ENDGROUP tag");
+      break;
+    default:
+      upb_decoder_abortjmp(d, "Invalid wire type");
+      break;
+  }
+}
+
+// Skips an unknown group (and any groups nested inside it) up to and including
+// its END_GROUP tag.
+static void upb_decoder_skipgroup(upb_decoder *d, uint32_t fieldnum,
+                                  int depth) {
+  if (depth > UPB_MAX_NESTING) {
+    upb_decoder_abortjmp(d, "Nesting too deep.");
+    return;
+  }
+  while (1) {
+    uint32_t tag = upb_decode_varint32(d);
+    UPB_UNWIND(d);
+    uint32_t num = tag >> 3;
+    if (num == 0 || num > UPB_MAX_FIELDNUMBER) {
+      upb_decoder_abortjmp(d, "Invalid field number");
+      return;
+    }
+    if ((tag & 0x7) == UPB_WIRE_TYPE_END_GROUP) {
+      if (num != fieldnum) upb_decoder_abortjmp(d, "Unmatched ENDGROUP tag");
+      return;
+    }
+    upb_decoder_skipval(d, tag, depth);
+    UPB_UNWIND(d);
+  }
+}
+
+static void upb_decoder_checkskip(upb_decoder *d) {
+  if (d->top->end_ofs != UPB_NONDELIMITED &&
+      upb_decoder_offset(d) > d->top->end_ofs)
+    upb_decoder_abortjmp(d, "Bad submessage end");
+}
+
+// Skips the value of a field whose tag has just been read, without delivering
+// it anywhere.
+static void upb_decoder_skipfield(upb_decoder *d, uint32_t tag) {
+  switch (tag & 0x7) {
+    // Nobody wants the bytes, so we can skip delimited data without fetching
+    // it.
+    case UPB_WIRE_TYPE_VARINT: upb_decode_varint(d); return;
+    case UPB_WIRE_TYPE_32BIT: upb_decoder_discard(d, 4); return;
+    case UPB_WIRE_TYPE_64BIT: upb_decoder_discard(d, 8); return;
+    case UPB_WIRE_TYPE_DELIMITED: {
+      uint32_t len = upb_decode_varint32(d);
+      UPB_UNWIND(d);
+      upb_decoder_discard(d, len);
+      return;
+    }
+  }
+  upb_decoder_skipval(d, tag, 0);
+  UPB_UNWIND(d);
+  upb_decoder_checkskip(d);
+}
+
+// Handles an unknown field whose tag has just been read: delivers it to the
+// unknown field handler (if any) and skips past it.
+static void upb_decoder_unknown(upb_decoder *d, uint32_t tag) {
+  if (upb_handlers_getunknown(upb_sink_tophandlers(&d->sink)) == NULL) {
+    upb_decoder_skipfield(d, tag);
+    return;
+  }
+  uint64_t start = upb_decoder_offset(d);
+  upb_decoder_skipval(d, tag, 0);
+  UPB_UNWIND(d);
+  upb_decoder_checkskip(d);
+  UPB_UNWIND(d);
+  upb_byteregion bytes;
+  upb_byteregion_reset(&bytes, d->input, start, upb_decoder_offset(d) - start);
+  bool ok = upb_sink_putunknown(&d->sink, tag, &bytes);
+  upb_byteregion_release(&bytes);
+  if (!ok) upb_decoder_abortjmp(d, "Unknown field handler returned false");
+}
+
 
 /* The main decoding loop *****************************************************/
 
+// Returns true if we are at the end of the top frame's delimited region.
+static bool upb_decoder_atdelimend(upb_decoder *d) {
+  if (d->delim_end != NULL) {
+    if (d->ptr > d->delim_end) {
+      upb_decoder_abortjmp(d, "Bad submessage end");
+      return false;
+    }
+    return d->ptr == d->delim_end;
+  }
+  // When no buffer is loaded (eg. because we skipped past the end of the last
+  // one) delim_end is NULL even if we are at end-of-delim, so check the
+  // offset directly.
+  if (d->buf == NULL && d->top->end_ofs != UPB_NONDELIMITED) {
+    if (d->bufstart_ofs > d->top->end_ofs) {
+      upb_decoder_abortjmp(d, "Bad submessage end");
+      return false;
+    }
+    return d->bufstart_ofs == d->top->end_ofs;
+  }
+  return false;
+}
+
+// Reads the length of the next record of a record stream and starts it,
+// returning false if the stream is at its end.
+static bool upb_decoder_startrecord(upb_decoder *d) {
+  assert(d->records && d->top == d->stack);
+  assert(d->stack[0].end_ofs == UPB_NONDELIMITED);
+  uint32_t len;
+  if (!upb_trydecode_varint32(d, &len)) return false;
+  UPB_UNWIND(d) false;
+  d->stack[0].end_ofs = upb_decoder_offset(d) + len;
+  upb_decoder_setmsgend(d);
+  upb_sink_startmsg(&d->sink);
+  upb_decoder_checkpoint(d);
+  return true;
+}
+
+// Ends the current record of a record stream and starts the next one,
+// returning false if there is none.
+static bool upb_decoder_nextrecord(upb_decoder *d) {
+  assert(d->records && d->top == d->stack);
+  upb_sink_endmsg(&d->sink, &d->status);
+  d->stack[0].end_ofs = UPB_NONDELIMITED;
+  upb_decoder_setmsgend(d);
+  upb_decoder_checkpoint(d);
+  return upb_decoder_startrecord(d);
+}
+
 static void upb_decoder_checkdelim(upb_decoder *d) {
-  // TODO: This doesn't work for the case that no buffer is currently loaded
-  // (ie. d->buf == NULL) because delim_end is NULL even if we are at
-  // end-of-delim.  Need to add a test that exercises this by putting a buffer
-  // seam in the middle of the final delimited value in a proto that we skip
-  // for some reason (like because it's unknown and we have no unknown field
-  // handler).
-  while (d->delim_end != NULL && d->ptr >= d->delim_end) {
-    if (d->ptr > d->delim_end) upb_decoder_abortjmp(d, "Bad submessage end");
+  while (upb_decoder_atdelimend(d)) {
     if (d->top->is_sequence) {
       upb_pop_seq(d);
+    } else if (d->top == d->stack) {
+      // Only records delimit the top-level message.
+      if (!upb_decoder_nextrecord(d)) return;
     } else {
       upb_pop_submsg(d);
     }
   }
 }
 
-INLINE const upb_fielddef *upb_decode_tag(upb_decoder *d) {
+// Runs the precompiled decoder for the top frame's message (if any) on what
+// is left of the current buffer.
+static void upb_decoder_enteraot(upb_decoder *d) {
+  if (!d->ptr || d->top_is_packed || !d->top->msg || !d->top->msg->aot) return;
+  if (upb_decoder_bufleft(d) <= UPB_AOT_SLOP) return;
+  const char *end = d->end - UPB_AOT_SLOP;
+  if (d->delim_end && d->delim_end < end) end = d->delim_end;
+  if (d->ptr >= end) return;
+  const char *p = d->top->msg->aot(d, d->ptr, end);
+  assert(p >= d->ptr && p <= d->end);
+  d->ptr = p;
+  upb_decoder_checkpoint(d);
+}
+
+// Called once the tag of a value of "f" (NULL for a value we will not deliver)
+// has been read.  There are no explicit "startseq" or "endseq" markers in
+// protobuf streams, so we have to infer them by noticing when a repeated
+// field starts or ends.
+INLINE void upb_decoder_startval(upb_decoder *d, const upb_fielddef *f,
+                                 bool packed) {
+  upb_decoder_frame *fr = d->top;
+  if (fr->is_sequence && fr->f != f) {
+    upb_pop_seq(d);
+    fr = d->top;
+  }
+
+  if (f && upb_fielddef_isseq(f) && !fr->is_sequence) {
+    if (packed) {
+      uint32_t len = upb_decode_varint32(d);
+      UPB_UNWIND(d);
+      upb_push_seq(d, f, true, upb_decoder_offset(d) + len);
+      UPB_UNWIND(d);
+      // The main loop decodes packed values without reading a tag, so we
+      // must not back out to before the tag if we are suspended.
+      upb_decoder_checkpoint(d);
+    } else {
+      upb_push_seq(d, f, false, fr->end_ofs);
+    }
+  }
+}
+
+// Reads the next tag, returning the field whose value follows it or NULL at
+// end of input.  "last" is the field whose value was decoded last (if any):
+// if the input starts with the tag it predicts, we skip the varint decode and
+// the table lookup.
+INLINE const upb_decoderplan_field *upb_decode_tag(
+    upb_decoder *d, const upb_decoderplan_field *last) {
+  if (last && last->next && last->msg == d->top->msg &&
+      upb_decoder_bufleft(d) >= last->next_tag_len &&
+      d->ptr[0] == last->next_tag[0] &&
+      (last->next_tag_len == 1 || d->ptr[1] == last->next_tag[1])) {
+    upb_decoder_advance(d, last->next_tag_len);
+    upb_decoder_startval(d, last->next->f, false);
+    UPB_UNWIND(d) NULL;
+    return last->next;
+  }
   while (1) {
     uint32_t tag;
     if (!upb_trydecode_varint32(d, &tag)) return NULL;
+    UPB_UNWIND(d) NULL;
     uint8_t wire_type = tag & 0x7;
-    uint32_t fieldnum = tag >> 3; const upb_fielddef *f = NULL;
-    const upb_handlers *h = upb_sink_tophandlers(&d->sink);
-    f = upb_msgdef_itof(upb_handlers_msgdef(h), fieldnum);
+    uint32_t fieldnum = tag >> 3;
+    const upb_decoderplan_field *pf =
+        upb_decoderplan_getfield(d->top->msg, fieldnum);
     bool packed = false;
+    bool skip = false;
+
+    if (pf == NULL) {
+      // Unknown field.
+    } else if (pf->skip) {
+      // Outside the plan's projection.
+      pf = NULL;
+      skip = true;
+    } else if (tag == pf->native_tag) {
+      // Wire type is ok.
+    } else if (tag == pf->packed_tag) {
+      // Wire type is ok (and packed).
+      packed = true;
+    } else {
+      pf = NULL;
+    }
+    upb_decoder_startval(d, pf ? pf->f : NULL, packed);
+    UPB_UNWIND(d) NULL;
+    if (pf) return pf;
+    upb_decoder_frame *fr = d->top;
 
-    if (f) {
-      // Wire type check.
-      upb_fieldtype_t type = upb_fielddef_type(f);
-      if (wire_type == upb_decoder_types[type].native_wire_type) {
-        // Wire type is ok.
-      } else if ((wire_type == UPB_WIRE_TYPE_DELIMITED &&
-                 upb_decoder_types[type].is_numeric)) {
-        // Wire type is ok (and packed).
-        packed = true;
-      } else {
-        f = NULL;
+    // Unknown field or ENDGROUP.
+    if (fieldnum == 0 || fieldnum > UPB_MAX_FIELDNUMBER) {
+      upb_decoder_abortjmp(d, "Invalid field number");
+      return NULL;
+    }
+    if (wire_type == UPB_WIRE_TYPE_END_GROUP) {
+      if (fieldnum != fr->group_fieldnum) {
+        upb_decoder_abortjmp(d, "Unmatched ENDGROUP tag");
+        return NULL;
       }
+      upb_sink_endsubmsg(&d->sink, fr->f);
+      d->top--;
+      upb_decoder_setmsgend(d);
+    } else if (skip) {
+      upb_decoder_skipfield(d, tag);
+    } else {
+      upb_decoder_unknown(d, tag);
     }
+    UPB_UNWIND(d) NULL;
+    upb_decoder_checkpoint(d);
+    upb_decoder_checkdelim(d);
+    UPB_UNWIND(d) NULL;
+  }
+}
 
-    // There are no explicit "startseq" or "endseq" markers in protobuf
-    // streams, so we have to infer them by noticing when a repeated field
-    // starts or ends.
-    upb_decoder_frame *fr = d->top;
-    if (fr->is_sequence && fr->f != f) {
-      upb_pop_seq(d);
-      fr = d->top;
+
+/* Bytecode *******************************************************************/
+
+// Plans that allow JIT-ting but could not be JIT-ted (because the JIT is not
+// compiled in, or the host does not allow executable memory) are compiled to
+// a bytecode instead.  The bytecode contains no pointers: jumps are offsets
+// into the plan's code and fields are indexes into their message's field
+// array.  Like the JIT, it predicts that fields arrive in field number order,
+// so that well-ordered input is decoded without a varint decode and table
+// lookup for every tag.
+//
+// The code for each message starts with a prediction of its first field,
+// followed by this for each field, in field number order:
+//
+//   <op> <field index>   Decodes one value, whose tag was already read.
+//   CHECKTAG             Predicts the same field again (repeated fields only).
+//   CHECKTAG             Predicts the next field (if there is one).
+//   DISPATCH
+//
+// CHECKTAG compares the raw bytes at the input against an encoded tag and
+// jumps to that field's op if they match, otherwise it falls through.
+// DISPATCH pops any frames that have ended and reads the tag the slow way.
+
+typedef enum {
+  UPB_BC_DISPATCH = 0,
+  UPB_BC_CHECKTAG = 1,  // | (tag_len << 8), tag bytes (2 words), target.
+  UPB_BC_VALUE = 2,     // Calls the field's decode function.
+  UPB_BC_SUBMSG = 3,    // Pushes a submessage and continues in its code.
+  UPB_BC_SKIP = 4,      // Skips a field that is outside the projection.
+} upb_bcop;
+
+#define UPB_BC_CHECKTAG_WORDS 4
+#define UPB_BC_FIELD_WORDS 2
+#define UPB_BC_EOF UINT32_MAX
+
+static uint32_t *upb_bc_putchecktag(uint32_t *code,
+                                    const upb_decoderplan_field *pf) {
+  char buf[8] = {0};
+  size_t len = upb_vencode64(pf->native_tag, buf);
+  *code++ = UPB_BC_CHECKTAG | (len << 8);
+  memcpy(code, buf, sizeof(buf));
+  code += 2;
+  *code++ = pf->bc_ofs;
+  return code;
+}
+
+// Returns false if memory could not be allocated.
+static bool upb_decoderplan_bcmsg(upb_decoderplan *p, upb_decoderplan_msg *m) {
+  int n = m->field_count;
+  upb_decoderplan_field **fields = m->fields_bynum;
+
+  // Assign offsets, so that predictions can jump forward.
+  m->bc_ofs = p->bc_size;
+  uint32_t ofs = m->bc_ofs + (n > 0 ? UPB_BC_CHECKTAG_WORDS : 0) + 1;
+  for (int i = 0; i < n; i++) {
+    fields[i]->bc_ofs = ofs;
+    ofs += UPB_BC_FIELD_WORDS + 1;
+    if (upb_fielddef_isseq(fields[i]->f)) ofs += UPB_BC_CHECKTAG_WORDS;
+    if (i + 1 < n) ofs += UPB_BC_CHECKTAG_WORDS;
+  }
+
+  uint32_t *bc_code = realloc(p->bc_code, ofs * sizeof(*p->bc_code));
+  if (!bc_code) return false;
+  p->bc_code = bc_code;
+  uint32_t *code = p->bc_code + m->bc_ofs;
+  if (n > 0) code = upb_bc_putchecktag(code, fields[0]);
+  *code++ = UPB_BC_DISPATCH;
+  for (int i = 0; i < n; i++) {
+    upb_decoderplan_field *pf = fields[i];
+    assert(code == p->bc_code + pf->bc_ofs);
+    if (pf->skip) {
+      *code++ = UPB_BC_SKIP;
+    } else if (upb_fielddef_issubmsg(pf->f) && pf->submsg && !pf->handler) {
+      *code++ = UPB_BC_SUBMSG;
+    } else {
+      *code++ = UPB_BC_VALUE;
+    }
+    *code++ = pf - m->fields;
+    if (upb_fielddef_isseq(pf->f)) code = upb_bc_putchecktag(code, pf);
+    if (i + 1 < n) code = upb_bc_putchecktag(code, fields[i + 1]);
+    *code++ = UPB_BC_DISPATCH;
+  }
+  assert(code == p->bc_code + ofs);
+  p->bc_size = ofs;
+  return true;
+}
+
+// If memory runs out the plan is left to the interpreted decoder.
+static void upb_decoderplan_makebytecode(upb_decoderplan *p) {
+  upb_inttable_iter i;
+  upb_inttable_begin(&i, &p->msgs);
+  for(; !upb_inttable_done(&i); upb_inttable_next(&i)) {
+    if (!upb_decoderplan_bcmsg(p,
+                               upb_value_getptr(upb_inttable_iter_value(&i)))) {
+      free(p->bc_code);
+      p->bc_code = NULL;
+      p->bc_size = 0;
+      return;
     }
+  }
+}
 
-    if (f && upb_fielddef_isseq(f) && !fr->is_sequence) {
-      if (packed) {
-        uint32_t len = upb_decode_varint32(d);
-        upb_push_seq(d, f, true, upb_decoder_offset(d) + len);
+// Pops any frames that have ended and reads the next tag the slow way,
+// returning where the bytecode continues, or UPB_BC_EOF at end of input.
+static uint32_t upb_decoder_bcdispatch(upb_decoder *d) {
+  uint32_t pc = UPB_BC_EOF;
+  while (1) {
+    if (upb_decoder_atdelimend(d)) {
+      const upb_fielddef *f = d->top->f;
+      if (d->top->is_sequence) {
+        upb_pop_seq(d);
+      } else if (d->top == d->stack) {
+        if (!upb_decoder_nextrecord(d)) return UPB_BC_EOF;
+        pc = d->top->msg->bc_ofs;
       } else {
-        upb_push_seq(d, f, false, fr->end_ofs);
+        // Continue with the predictions that follow the submessage field.
+        upb_pop_submsg(d);
+        pc = upb_decoderplan_getfield(d->top->msg, upb_fielddef_number(f))
+            ->bc_ofs + UPB_BC_FIELD_WORDS;
       }
+      continue;
     }
+    UPB_UNWIND(d) UPB_BC_EOF;
+    if (pc != UPB_BC_EOF) return pc;
+    const upb_decoderplan_field *pf;
+    if (d->top_is_packed) {
+      // Packed values have no tags to predict, so we decode them here.
+      pf = upb_decoderplan_getfield(d->top->msg,
+                                    upb_fielddef_number(d->top->f));
+    } else {
+      pf = upb_decode_tag(d, NULL);
+      if (!pf) return UPB_BC_EOF;
+      if (!d->top_is_packed) return pf->bc_ofs;
+      // The packed sequence we just pushed could be empty.
+      if (upb_decoder_atdelimend(d)) continue;
+      UPB_UNWIND(d) UPB_BC_EOF;
+    }
+    pf->decode(d, pf);
+    UPB_UNWIND(d) UPB_BC_EOF;
+    upb_decoder_checkpoint(d);
+  }
+}
 
-    if (f) return f;
+// Runs the plan's bytecode until the end of input.
+static void upb_decoder_runbytecode(upb_decoder *d) {
+  const uint32_t *code = d->plan->bc_code;
+  const upb_decoderplan_field *pf;
+  uint32_t pc = upb_decoder_bcdispatch(d);
+  if (pc == UPB_BC_EOF) return;
+
+  // Threaded dispatch where the compiler supports it gives each op its own
+  // indirect jump, which predicts much better than a single switch.
+#ifdef __GNUC__
+  static void *const ops[] = {
+    &&op_dispatch, &&op_checktag, &&op_value, &&op_submsg, &&op_skip
+  };
+#define UPB_BC_NEXT goto *ops[code[pc] & 0xff]
+#else
+#define UPB_BC_NEXT goto next
+next:
+  switch (code[pc] & 0xff) {
+    case UPB_BC_DISPATCH: goto op_dispatch;
+    case UPB_BC_CHECKTAG: goto op_checktag;
+    case UPB_BC_VALUE: goto op_value;
+    case UPB_BC_SUBMSG: goto op_submsg;
+    case UPB_BC_SKIP: goto op_skip;
+  }
+#endif
 
-    // Unknown field or ENDGROUP.
-    if (fieldnum == 0 || fieldnum > UPB_MAX_FIELDNUMBER)
-      upb_decoder_abortjmp(d, "Invalid field number");
-    switch (wire_type) {
-      case UPB_WIRE_TYPE_VARINT:    upb_decode_varint(d); break;
-      case UPB_WIRE_TYPE_32BIT:     upb_decoder_discard(d, 4); break;
-      case UPB_WIRE_TYPE_64BIT:     upb_decoder_discard(d, 8); break;
-      case UPB_WIRE_TYPE_DELIMITED:
-        upb_decoder_discard(d, upb_decode_varint32(d)); break;
-      case UPB_WIRE_TYPE_START_GROUP:
-        upb_decoder_abortjmp(d, "Can't handle unknown groups yet");
-      case UPB_WIRE_TYPE_END_GROUP:
-        if (fieldnum != fr->group_fieldnum)
-          upb_decoder_abortjmp(d, "Unmatched ENDGROUP tag");
-        upb_sink_endsubmsg(&d->sink, fr->f);
-        d->top--;
-        upb_decoder_setmsgend(d);
-        break;
-      default:
-        upb_decoder_abortjmp(d, "Invalid wire type");
-    }
-    // TODO: deliver to unknown field callback.
-    upb_decoder_checkpoint(d);
-    upb_decoder_checkdelim(d);
+  UPB_BC_NEXT;
+
+op_dispatch:
+  pc = upb_decoder_bcdispatch(d);
+  if (pc == UPB_BC_EOF) return;
+  UPB_BC_NEXT;
+
+op_checktag: {
+  // A tag that crosses the end of the buffer or of the submessage is left to
+  // DISPATCH, which handles both.
+  size_t len = code[pc] >> 8;
+  const char *end = d->delim_end ? d->delim_end : d->end;
+  if (d->ptr && d->ptr < end && (size_t)(end - d->ptr) >= len &&
+      memcmp(d->ptr, &code[pc + 1], len) == 0) {
+    upb_decoder_advance(d, len);
+    pc = code[pc + 3];
+    pf = &d->top->msg->fields[code[pc + 1]];
+    upb_decoder_startval(d, pf->skip ? NULL : pf->f, false);
+    UPB_UNWIND(d);
+  } else {
+    pc += UPB_BC_CHECKTAG_WORDS;
   }
+  UPB_BC_NEXT;
 }
 
-upb_success_t upb_decoder_decode(upb_decoder *d) {
-  assert(d->input);
-  if (_setjmp(d->exitjmp)) {
-    assert(!upb_ok(&d->status));
-    return UPB_ERROR;
+op_value:
+  pf = &d->top->msg->fields[code[pc + 1]];
+  pf->decode(d, pf);
+  UPB_UNWIND(d);
+  upb_decoder_checkpoint(d);
+  pc += UPB_BC_FIELD_WORDS;
+  UPB_BC_NEXT;
+
+op_submsg:
+  pf = &d->top->msg->fields[code[pc + 1]];
+  pf->decode(d, pf);  // Pushes the submessage's frame.
+  UPB_UNWIND(d);
+  upb_decoder_checkpoint(d);
+  pc = pf->submsg->bc_ofs;
+  UPB_BC_NEXT;
+
+op_skip:
+  pf = &d->top->msg->fields[code[pc + 1]];
+  upb_decoder_skipfield(d, pf->native_tag);
+  UPB_UNWIND(d);
+  upb_decoder_checkpoint(d);
+  pc += UPB_BC_FIELD_WORDS;
+  UPB_BC_NEXT;
+
+#undef UPB_BC_NEXT
+}
+
+
+/* upb_decoder entry points ***************************************************/
+
+// Decodes until the end of input, unless we exit first.
+static void upb_decoder_run(upb_decoder *d) {
+  if (d->suspended) {
+    // Resuming: startmsg() was already delivered on a previous call.
+    d->suspended = false;
+  } else if (!d->records) {
+    upb_sink_startmsg(&d->sink);
   }
-  upb_sink_startmsg(&d->sink);
   // Prime the buf so we can hit the JIT immediately.
   upb_trypullbuf(d);
-  const upb_fielddef *f = d->top->f;
-  while(1) {
-#ifdef UPB_USE_JIT_X64
-    upb_decoder_enterjit(d);
+  UPB_UNWIND(d);
+  if (d->records && d->stack[0].end_ofs == UPB_NONDELIMITED) {
+    // Between records; we may also have suspended in a record's length.
+    upb_decoder_startrecord(d);
+    UPB_UNWIND(d);
+  }
+  if (d->str_f) {
+    upb_decoder_putstr(d);
+    UPB_UNWIND(d);
     upb_decoder_checkpoint(d);
-    upb_decoder_setmsgend(d);
-#endif
-    upb_decoder_checkdelim(d);
-    if (!d->top_is_packed) f = upb_decode_tag(d);
-    if (!f) {
-      // Sucessful EOF.  We may need to dispatch a top-level implicit frame.
-      if (d->top->is_sequence) {
-        assert(d->sink.top == d->sink.stack + 1);
-        upb_pop_seq(d);
+  }
+  if (d->plan->bc_code) {
+    upb_decoder_runbytecode(d);
+  } else {
+    // If we were suspended in the middle of a packed field, we resume
+    // decoding its values without reading a tag.
+    const upb_decoderplan_field *pf = d->top->is_packed ?
+        upb_decoderplan_getfield(d->top->msg, upb_fielddef_number(d->top->f)) :
+        NULL;
+    while(1) {
+#ifdef UPB_USE_JIT_X64
+      upb_decoder_enterjit(d);
+      upb_decoder_checkpoint(d);
+      upb_decoder_setmsgend(d);
+      // The JIT may have stopped in the middle of a packed run.
+      if (d->top_is_packed) {
+        pf = upb_decoderplan_getfield(d->top->msg,
+                                      upb_fielddef_number(d->top->f));
       }
-      assert(d->top == d->stack);
-      upb_sink_endmsg(&d->sink, &d->status);
-      return UPB_OK;
-    }
-
-    switch (upb_fielddef_type(f)) {
-      case UPB_TYPE(DOUBLE):   upb_decode_DOUBLE(d, f);   break;
-      case UPB_TYPE(FLOAT):    upb_decode_FLOAT(d, f);    break;
-      case UPB_TYPE(INT64):    upb_decode_INT64(d, f);    break;
-      case UPB_TYPE(UINT64):   upb_decode_UINT64(d, f);   break;
-      case UPB_TYPE(INT32):    upb_decode_INT32(d, f);    break;
-      case UPB_TYPE(FIXED64):  upb_decode_FIXED64(d, f);  break;
-      case UPB_TYPE(FIXED32):  upb_decode_FIXED32(d, f);  break;
-      case UPB_TYPE(BOOL):     upb_decode_BOOL(d, f);     break;
-      case UPB_TYPE(STRING):
-      case UPB_TYPE(BYTES):    upb_decode_STRING(d, f);   break;
-      case UPB_TYPE(GROUP):    upb_decode_GROUP(d, f);    break;
-      case UPB_TYPE(MESSAGE):  upb_decode_MESSAGE(d, f);  break;
-      case UPB_TYPE(UINT32):   upb_decode_UINT32(d, f);   break;
-      case UPB_TYPE(ENUM):     upb_decode_ENUM(d, f);     break;
-      case UPB_TYPE(SFIXED32): upb_decode_SFIXED32(d, f); break;
-      case UPB_TYPE(SFIXED64): upb_decode_SFIXED64(d, f); break;
-      case UPB_TYPE(SINT32):   upb_decode_SINT32(d, f);   break;
-      case UPB_TYPE(SINT64):   upb_decode_SINT64(d, f);   break;
-      case UPB_TYPE_NONE: assert(false); break;
+#endif
+      if (d->plan->has_aot) upb_decoder_enteraot(d);
+      upb_decoder_checkdelim(d);
+      UPB_UNWIND(d);
+      if (!d->top_is_packed) pf = upb_decode_tag(d, pf);
+      if (!pf) break;
+      pf->decode(d, pf);
+      UPB_UNWIND(d);
+      upb_decoder_checkpoint(d);
     }
-    upb_decoder_checkpoint(d);
   }
+  UPB_UNWIND(d);
+
+  // Sucessful EOF.  Every record has already been ended.
+  if (d->records) {
+    assert(d->top == d->stack);
+    return;
+  }
+  // We may need to dispatch a top-level implicit frame.
+  if (d->top->is_sequence) {
+    assert(d->sink.top == d->sink.stack + 1);
+    upb_pop_seq(d);
+  }
+  assert(d->top == d->stack);
+  upb_sink_endmsg(&d->sink, &d->status);
+}
+
+upb_success_t upb_decoder_decode(upb_decoder *d) {
+  assert(d->input);
+#ifdef UPB_DECODER_NO_SETJMP
+  d->exiting = false;
+  upb_decoder_run(d);
+  if (!d->exiting) return UPB_OK;
+#else
+  if (!_setjmp(d->exitjmp)) {
+    upb_decoder_run(d);
+    return UPB_OK;
+  }
+#endif
+  if (d->suspended) return UPB_SUSPENDED;
+  assert(!upb_ok(&d->status));
+  return UPB_ERROR;
 }
 
 void upb_decoder_init(upb_decoder *d) {
@@ -580,6 +1966,7 @@ void upb_decoder_init(upb_decoder *d) {
   d->plan = NULL;
   d->input = NULL;
   d->limit = &d->stack[UPB_MAX_NESTING];
+  d->exiting = false;
 }
 
 void upb_decoder_resetplan(upb_decoder *d, upb_decoderplan *p) {
@@ -594,8 +1981,12 @@ void upb_decoder_resetinput(upb_decoder *d, upb_byteregion *input,
   upb_status_clear(&d->status);
   upb_sink_reset(&d->sink, c);
   d->input = input;
+  d->suspended = false;
+  d->records = false;
+  d->str_f = NULL;
 
   d->top = d->stack;
+  d->top->msg = upb_decoderplan_getmsg(d->plan, d->plan->handlers);
   d->top->is_sequence = false;
   d->top->is_packed = false;
   d->top->group_fieldnum = UINT32_MAX;
@@ -608,6 +1999,12 @@ void upb_decoder_resetinput(upb_decoder *d, upb_byteregion *input,
   upb_decoder_skiptonewbuf(d, upb_byteregion_startofs(input));
 }
 
+void upb_decoder_resetrecords(upb_decoder *d, upb_byteregion *input,
+                              void *c) {
+  upb_decoder_resetinput(d, input, c);
+  d->records = true;
+}
+
 void upb_decoder_uninit(upb_decoder *d) {
   upb_status_uninit(&d->status);
 }
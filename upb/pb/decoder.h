@@ -7,12 +7,18 @@
  * upb_decoder implements a high performance, streaming decoder for protobuf
  * data that works by getting its input data from a upb_byteregion and calling
  * into a upb_handlers.
+ *
+ * Decoder plans are cached process-wide under upb_lock() (see refcounted.h).
+ * So unless upb is compiled with UPB_THREAD_UNSAFE or UPB_USE_PTHREADS, a
+ * program that uses the decoder must define upb_lock() and upb_unlock(), even
+ * without UPB_DEBUG_REFS.
  */
 
 #ifndef UPB_DECODER_H_
 #define UPB_DECODER_H_
 
 #include <setjmp.h>
+#include <string.h>
 #include "upb/bytestream.h"
 #include "upb/sink.h"
 
@@ -37,22 +43,196 @@ typedef struct _upb_decoderplan upb_decoderplan;
 // - add support for letting any message in the plan be at the top level.
 // - make this object a handlers instead (when bytesrc/bytesink are merged
 //   into handlers).
-// - add support for sharing code with previously-built plans/handlers.
+//
+// Plans are cached process-wide: while a plan for the same handlers (and the
+// same "allowjit") is still alive, upb_decoderplan_new() returns a new ref to
+// it instead of building (and JIT-ting) another one.  So a long-lived ref to
+// each plan you use is enough to build it only once.
+//
+// If "allowjit" is true but the JIT is not available (it was not compiled in,
+// or the host does not allow executable memory) the plan is compiled to a
+// portable bytecode instead, which gets most of the JIT's benefit from
+// predicting tags in schema order.
+//
+// Returns NULL if memory could not be allocated.
 upb_decoderplan *upb_decoderplan_new(const upb_handlers *h, bool allowjit);
+void upb_decoderplan_ref(upb_decoderplan *p);
 void upb_decoderplan_unref(upb_decoderplan *p);
 
+// Returns a plan that only decodes the fields named by "paths" (an array of
+// "n" strings).  Each path is a dot-separated list of field names starting
+// from the top-level message of "h", for example "a.b.c"; every message
+// field along the path must have subhandlers.  If the last field of a path is
+// a submessage, all of its contents are decoded.  Every other field is
+// skipped at the wire level: it never reaches the handlers (not even the
+// unknown field handler) and delimited values are skipped without being
+// fetched.
+//
+// Projections are computed per message type: if one message type is reached
+// by more than one path, the union of the fields those paths need from it is
+// decoded wherever it appears.
+//
+// Projections are never shared with other plans.
+//
+// Returns NULL and sets "status" if any path does not name a field, or if
+// memory could not be allocated.
+upb_decoderplan *upb_decoderplan_newprojection(const upb_handlers *h,
+                                               const char *const *paths, int n,
+                                               bool allowjit,
+                                               upb_status *status);
+
 // Returns true if the plan contains JIT-ted code.  This may not be the same as
 // the "allowjit" parameter to the constructor if support for JIT-ting was not
 // compiled in.
 bool upb_decoderplan_hasjitcode(upb_decoderplan *p);
 
+// Returns true if the plan is decoded by the bytecode interpreter.
+bool upb_decoderplan_hasbytecode(upb_decoderplan *p);
+
+// Returns true if the plan uses precompiled decoders (see below).
+bool upb_decoderplan_hasaot(upb_decoderplan *p);
+
+
+/* Precompiled decoders *******************************************************/
+
+// upbc can generate C decode functions for the messages of a .proto file
+// ahead of time (pass it --decoders).  They give JIT-like speed without any
+// startup cost or executable memory: each one predicts tags in field number
+// order, switches on the tag when the prediction misses, and inlines the
+// stores of handlers registered with upb_handlers_setstore().
+//
+// Generated decoders are registered by message name.  A plan built with
+// "allowjit" for a message that has a registered decoder uses precompiled
+// decoders (instead of the JIT or bytecode) for every message in the plan
+// that has one, as long as the message still has exactly the fields the
+// decoder was generated for.
+
+struct _upb_decoder;
+
+// Decodes values of the message on top of the decoder's stack from "p", which
+// is at the beginning of a tag, and returns where it stopped (also at the
+// beginning of a tag).  Every value before the returned pointer has been
+// delivered.  No value may start at or after "end", but at least
+// UPB_AOT_SLOP bytes after "end" are readable.  Anything the function does
+// not handle itself (strings, submessages, unknown fields, starting or ending
+// a sequence...) is left to the decoder by returning.
+typedef const char *upb_aot_decodefunc(struct _upb_decoder *d, const char *p,
+                                       const char *end);
+
+#define UPB_AOT_SLOP 20
+
+typedef struct {
+  uint32_t number;
+  upb_fieldtype_t type;
+} upb_aotfield;
+
+typedef struct {
+  const char *name;  // Full name of the message.
+  // The fields the decoder was generated for, in field number order.
+  const upb_aotfield *fields;
+  int field_count;
+  upb_aot_decodefunc *decode;
+} upb_aotdecoder;
+
+// Registers a precompiled decoder for plans built from now on.  The decoder
+// must outlive every plan that uses it.
+void upb_aot_register(const upb_aotdecoder *decoder);
+
 
 /* upb_decoder ****************************************************************/
 
 struct dasm_State;
 
+struct _upb_decoderplan_msg;
+struct _upb_decoderplan_field;
+
+// How precompiled decoders may deliver a field's values.
+typedef enum {
+  UPB_AOT_DEFER = 0,  // Leave them to the decoder proper.
+  UPB_AOT_CALL = 1,   // Call "handler" (if any) with "data".
+  UPB_AOT_STORE = 2,  // Store them as described by "data" (an upb_stdmsg_fval).
+} upb_aotdelivery;
+
+// Decodes one value of a field whose tag has just been read.
+typedef void upb_decoder_decodefunc(struct _upb_decoder *d,
+                                    const struct _upb_decoderplan_field *pf);
+
+// Per-field data in a decoderplan.  Everything the decoder needs to handle a
+// field is precomputed here, so that the non-JIT path does a single table
+// lookup per field instead of looking up the fielddef, checking its wire type,
+// switching on its type and finding the handler for its selector.
+typedef struct _upb_decoderplan_field {
+  const upb_fielddef *f;
+  uint32_t native_tag;  // Tag of a value in its native wire type.
+  uint32_t packed_tag;  // Tag of a packed sequence of values, or 0 if none.
+  upb_decoder_decodefunc *decode;
+
+  // The handler that receives the field's values (for strings the STRING
+  // handler, for submessages the LAZYSUBMSG handler), or NULL if none.
+  upb_selector_t selector;
+  upb_func *handler;
+  void *data;
+
+  // The message this field belongs to.
+  const struct _upb_decoderplan_msg *msg;
+
+  // For submessages and groups, the plan for the submessage (NULL if there are
+  // no subhandlers).
+  const struct _upb_decoderplan_msg *submsg;
+
+  // True if the field is outside the plan's projection: its values are
+  // skipped without being delivered.
+  bool skip;
+
+  // The field whose tag usually follows a value of this one: the same field
+  // again if it is repeated, otherwise the next field in field number order.
+  // Before decoding a tag the slow way, the decoder compares the input against
+  // "next_tag" (its encoding).  NULL if its tag is longer than two bytes.
+  const struct _upb_decoderplan_field *next;
+  char next_tag[2];
+  uint8_t next_tag_len;
+
+  // Offset of the field's op in the plan's bytecode (if it has any).
+  uint32_t bc_ofs;
+
+  upb_aotdelivery aot;
+
+#ifdef UPB_USE_JIT_X64
+  // Where the JIT code resumes when it is entered with a frame for this field
+  // on top of the stack, or NULL if it cannot be entered there: just after the
+  // call that parsed a submessage returns, where a sequence continues after
+  // one of its values, and where a packed run continues.
+  void *jit_aftersubmsg;
+  void *jit_resumeseq;
+  void *jit_resumepacked;
+#endif
+} upb_decoderplan_field;
+
+// Per-message data in a decoderplan, used by both the decoder and the JIT.
+typedef struct _upb_decoderplan_msg {
+  const upb_handlers *h;
+
+  // An entry for each field of the message.
+  upb_decoderplan_field *fields;
+  int field_count;
+
+  // The same fields, in field number order.
+  upb_decoderplan_field **fields_bynum;
+
+  // Maps field number -> upb_decoderplan_field*.  Compacted, so that fields
+  // with small, dense field numbers are found with a single array load.
+  upb_inttable dispatch;
+
+  // Offset of the message's code in the plan's bytecode (if it has any).
+  uint32_t bc_ofs;
+
+  // The message's precompiled decoder, or NULL if none.
+  upb_aot_decodefunc *aot;
+} upb_decoderplan_msg;
+
 typedef struct {
   const upb_fielddef *f;
+  const upb_decoderplan_msg *msg;  // The message whose fields we are parsing.
   uint64_t end_ofs;
   uint32_t group_fieldnum;  // UINT32_MAX for non-groups.
   bool is_sequence;   // frame represents seq or submsg? (f might be both).
@@ -83,6 +263,23 @@ typedef struct _upb_decoder {
   // True if the top stack frame represents a packed field.
   bool top_is_packed;
 
+  // True if the last call to upb_decoder_decode() returned UPB_SUSPENDED.  Our
+  // stack and sink reflect the state as of the input's discard offset, which
+  // is where decoding will resume.
+  bool suspended;
+
+  // True if the input is a stream of length-delimited records (see
+  // upb_decoder_resetrecords()).  The bottom stack frame is then delimited by
+  // the end of the current record, or UPB_NONDELIMITED between records.
+  bool records;
+
+  // The string field whose data we are currently delivering (strings aren't
+  // pushed), or NULL if none, its STRING selector, and the offset where its
+  // data ends.
+  const upb_fielddef *str_f;
+  upb_selector_t str_sel;
+  uint64_t str_end_ofs;
+
 #ifdef UPB_USE_JIT_X64
   // For JIT, which doesn't do bounds checks in the middle of parsing a field.
   const char *jit_end, *effective_end;  // == MIN(jit_end, delim_end)
@@ -92,7 +289,11 @@ typedef struct _upb_decoder {
   uint32_t tmp_len;
 #endif
 
-  // For exiting the decoder on error.
+  // How an error or suspension gets back to upb_decoder_decode(): with
+  // UPB_DECODER_NO_SETJMP "exiting" is set while the decoder unwinds,
+  // otherwise we longjmp() to "exitjmp".  Both are always present so that
+  // the struct's layout does not depend on how decoder.c was built.
+  bool exiting;
   jmp_buf exitjmp;
 } upb_decoder;
 
@@ -119,8 +320,27 @@ void upb_decoder_resetplan(upb_decoder *d, upb_decoderplan *p);
 // Must be called before upb_decoder_decode().
 void upb_decoder_resetinput(upb_decoder *d, upb_byteregion *input, void *c);
 
+// Like upb_decoder_resetinput(), but the input is a sequence of messages that
+// are each prefixed by their varint length (the format that proto2's
+// writeDelimitedTo() and parseDelimitedFrom() use).  Every record is delivered
+// to the top-level handlers with closure "c" as its own startmsg/endmsg pair,
+// so the startmsg and endmsg handlers mark where each record begins and ends.
+// This lets a stream of small messages be decoded without resetting the
+// decoder between them.
+//
+// The input may only end between records.  If the decoder suspends, it
+// resumes in the middle of the record it was decoding, as with
+// upb_decoder_resetinput().
+void upb_decoder_resetrecords(upb_decoder *d, upb_byteregion *input, void *c);
+
 // Decodes serialized data (calling handlers as the data is parsed), returning
 // the success of the operation (call upb_decoder_status() for details).
+//
+// If the input returns UPB_BYTE_WOULDBLOCK, returns UPB_SUSPENDED after backing
+// out to the last fully-delivered value; the input's discard offset marks how
+// far the decoder has committed.  Call upb_decoder_decode() again (without
+// resetting the input) once more data is available and decoding will continue
+// where it left off.  No handler is called twice for the same data.
 upb_success_t upb_decoder_decode(upb_decoder *d);
 
 INLINE const upb_status *upb_decoder_status(upb_decoder *d) {
@@ -130,14 +350,35 @@ INLINE const upb_status *upb_decoder_status(upb_decoder *d) {
 // Implementation details
 
 struct _upb_decoderplan {
+  // Updated atomically.
+  uint32_t refcount;
+
+  // Whether this plan is in the plan cache, and under which "allowjit".
+  // Guarded by the plan cache's lock.
+  bool cached;
+  bool allowjit;
+
   // The top-level handlers that this plan calls into.  We own a ref.
   const upb_handlers *handlers;
 
+  // Every message reachable from "handlers".
+  // Maps upb_handlers* -> upb_decoderplan_msg*.
+  upb_inttable msgs;
+
+  // Bytecode, for plans that allow JIT-ting but could not be JIT-ted (else
+  // NULL).  Contains no pointers, only offsets into itself and field indexes.
+  uint32_t *bc_code;
+  size_t bc_size;  // In words.
+
+  // True if any message in the plan has a precompiled decoder.
+  bool has_aot;
+
 #ifdef UPB_USE_JIT_X64
   // JIT-generated machine code (else NULL).
   char *jit_code;
   size_t jit_size;
   char *debug_info;
+  void *debug_entry;  // Our entry in GDB's list of JIT-ted code.
 
   // For storing upb_jitmsginfo, which contains per-msg runtime data needed
   // by the JIT.
@@ -159,6 +400,51 @@ struct _upb_decoderplan {
 #endif
 };
 
+// For precompiled decoders: the fields of the message being decoded, in field
+// number order.
+INLINE upb_decoderplan_field *const *upb_decoder_aotfields(upb_decoder *d) {
+  return d->top->msg->fields_bynum;
+}
+
+// For precompiled decoders: returns true if a value of "pf" can be delivered
+// without pushing or popping a sequence frame.
+INLINE bool upb_decoder_aotcanput(upb_decoder *d,
+                                  const upb_decoderplan_field *pf) {
+  if (pf->aot == UPB_AOT_DEFER || pf->skip) return false;
+  if (upb_fielddef_isseq(pf->f))
+    return d->top->is_sequence && d->top->f == pf->f;
+  return !d->top->is_sequence;
+}
+
+// For precompiled decoders: delivers a value of "pf".  The generated code
+// knows the value's type, so it calls the right one of these directly.  But
+// offsets and hasbits are registered on the handlers, which the generator
+// never sees, so whether to store or call a handler (and where to store) is
+// still read from the plan at runtime.
+#define UPB_AOT_PUT(name, ctype) \
+  INLINE void upb_decoder_aotput ## name(upb_decoder *d, \
+                                          const upb_decoderplan_field *pf, \
+                                          ctype val) { \
+    if (pf->aot == UPB_AOT_STORE) { \
+      const upb_stdmsg_fval *fv = (const upb_stdmsg_fval*)pf->data; \
+      char *m = (char*)d->sink.top->closure; \
+      if (fv->hasbit >= 0) m[fv->hasbit / 8] |= 1 << (fv->hasbit % 8); \
+      memcpy(m + fv->offset, &val, sizeof(val)); \
+    } else if (pf->handler) { \
+      upb_ ## name ## _handler *h = (upb_ ## name ## _handler*)pf->handler; \
+      h(d->sink.top->closure, pf->data, val); \
+    } \
+  }
+
+UPB_AOT_PUT(int32,  int32_t)
+UPB_AOT_PUT(int64,  int64_t)
+UPB_AOT_PUT(uint32, uint32_t)
+UPB_AOT_PUT(uint64, uint64_t)
+UPB_AOT_PUT(float,  float)
+UPB_AOT_PUT(double, double)
+UPB_AOT_PUT(bool,   bool)
+#undef UPB_AOT_PUT
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
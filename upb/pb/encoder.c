@@ -3,419 +3,418 @@
  *
  * Copyright (c) 2009 Google Inc.  See LICENSE for details.
  * Author: Josh Haberman <jhaberman@gmail.com>
+ *
+ * Since the length of a delimited region (submessage or string) is written
+ * before its data but is not known until the region ends, the data of the
+ * outermost open region and everything nested inside it is buffered.  The
+ * buffered data is kept as a list of segments: each segment is the data that
+ * follows one of the length prefixes that have yet to be written.  For
+ * example, the message:
+ *
+ *   a: 1
+ *   b { c: 2  d { e: 3 }  f: 4 }
+ *
+ * is buffered as:
+ *
+ *   [a: 1][b-tag] | [c: 2][d-tag] | [e: 3][f: 4]
+ *                   ^ segment 0     ^ segment 1
+ *
+ * where segment 0 holds the length of "b" and segment 1 holds the length of
+ * "d" (which only includes "e: 3").  When "b" ends, every length is known and
+ * the data is written out with the length of each segment's region before it.
  */
 
 #include "upb/pb/encoder.h"
 
 #include <stdlib.h>
-#include "upb/descriptor.h"
+#include <string.h>
+#include "upb/pb/varint.h"
 
-/* Functions for calculating sizes of wire values. ****************************/
+// Data outside of any delimited region is written to the bytesink once this
+// many bytes of it have accumulated (or the top-level message ends).
+#define UPB_ENCODER_FLUSH_BYTES 4096
 
-static size_t upb_v_uint64_t_size(uint64_t val) {
-#ifdef __GNUC__
-  int high_bit = 63 - __builtin_clzll(val);  // 0-based, undef if val == 0.
-#else
-  int high_bit = 0;
-  uint64_t tmp = val;
-  while(tmp >>= 1) high_bit++;
-#endif
-  return val == 0 ? 1 : high_bit / 7 + 1;
+// Tags are at most 5 bytes; we copy a fixed number of bytes for speed.
+#define UPB_ENCODER_MAX_TAG 8
+
+typedef struct {
+  uint32_t msglen;  // Length of the region whose length prefix precedes us.
+  uint32_t seglen;  // Bytes of buffered data in this segment.
+} upb_encoder_segment;
+
+struct upb_encoder {
+  upb_bytesink *sink;
+  upb_status status;
+
+  // Output that has not been written to the bytesink yet.
+  char *buf, *ptr, *limit;
+
+  // Bytes at the front of "buf" that precede the outermost open region.
+  size_t prefix_len;
+
+  // Start of the data that has not yet been added to a segment.
+  char *runbegin;
+
+  // The segments of the buffered regions; segptr is the one we are appending
+  // to.
+  upb_encoder_segment *segbuf, *segptr, *seglimit;
+
+  // Stack of open delimited regions, as indexes of their first segment.  NULL
+  // if no region is open (in which case nothing needs to be buffered).
+  int stack[UPB_MAX_NESTING], *top;
+
+  // Number of open submessages (delimited or groups).
+  int depth;
+};
+
+// Handler data for each field: the field's tag, already encoded as a varint.
+typedef struct {
+  uint8_t bytes;
+  char tag[UPB_ENCODER_MAX_TAG];
+} upb_encoder_tag;
+
+static bool upb_encoder_seterr(upb_encoder *e, const char *msg) {
+  upb_status_seterrliteral(&e->status, msg);
+  return false;
 }
 
-static size_t upb_v_int32_t_size(int32_t val) {
-  // v_uint32's are sign-extended to maintain wire compatibility with int64s.
-  return upb_v_uint64_t_size((int64_t)val);
+static size_t upb_encoder_varintsize(uint64_t val) {
+  size_t bytes = 1;
+  while (val >>= 7) bytes++;
+  return bytes;
 }
-static size_t upb_v_uint32_t_size(uint32_t val) {
-  return upb_v_uint64_t_size(val);
+
+
+/* Output buffer **************************************************************/
+
+// Ensures that at least "bytes" bytes can be written at e->ptr.
+static bool reserve(upb_encoder *e, size_t bytes) {
+  if ((size_t)(e->limit - e->ptr) >= bytes) return true;
+  size_t used = e->ptr - e->buf;
+  size_t size = UPB_MAX(e->limit - e->buf, 128);
+  while (size - used < bytes) size *= 2;
+  char *buf = realloc(e->buf, size);
+  if (!buf) return upb_encoder_seterr(e, "Out of memory");
+  e->runbegin = buf + (e->runbegin - e->buf);
+  e->ptr = buf + used;
+  e->buf = buf;
+  e->limit = buf + size;
+  return true;
 }
-static size_t upb_f_uint64_t_size(uint64_t val) {
-  (void)val;  // Length is independent of value.
-  return sizeof(uint64_t);
+
+static bool putbuf(upb_encoder *e, const char *buf, size_t len) {
+  if (len > 0 && upb_bytesink_write(e->sink, buf, len) < 0)
+    return upb_encoder_seterr(e, "Error writing to bytesink");
+  return true;
 }
-static size_t upb_f_uint32_t_size(uint32_t val) {
-  (void)val;  // Length is independent of value.
-  return sizeof(uint32_t);
+
+static bool flush(upb_encoder *e) {
+  assert(!e->top);
+  bool ok = putbuf(e, e->buf, e->ptr - e->buf);
+  e->ptr = e->buf;
+  return ok;
 }
 
+// Called once a handler has written all of its data.
+static bool commit(upb_encoder *e) {
+  if (!e->top && e->ptr - e->buf >= UPB_ENCODER_FLUSH_BYTES) return flush(e);
+  return true;
+}
 
-/* Functions to write wire values. ********************************************/
+// Adds the data written since the last call to the current segment and the
+// innermost open region.
+static void accumulate(upb_encoder *e) {
+  size_t run = e->ptr - e->runbegin;
+  e->segptr->seglen += run;
+  e->segbuf[*e->top].msglen += run;
+  e->runbegin = e->ptr;
+}
 
-// Since we know in advance the longest that the value could be, we always make
-// sure that our buffer is long enough.  This saves us from having to perform
-// bounds checks.
+static bool start_delim(upb_encoder *e) {
+  if (e->top) {
+    accumulate(e);
+    if (e->top + 1 == e->stack + UPB_MAX_NESTING)
+      return upb_encoder_seterr(e, "Nesting too deep");
+    e->top++;
+    e->segptr++;
+  } else {
+    e->top = e->stack;
+    e->segptr = e->segbuf;
+    e->prefix_len = e->ptr - e->buf;
+    e->runbegin = e->ptr;
+  }
 
-// Puts a varint (wire type: UPB_WIRE_TYPE_VARINT).
-static uint8_t *upb_put_v_uint64_t(uint8_t *buf, uint64_t val)
-{
-  do {
-    uint8_t byte = val & 0x7f;
-    val >>= 7;
-    if(val) byte |= 0x80;
-    *buf++ = byte;
-  } while(val);
-  return buf;
+  if (e->segptr == e->seglimit) {
+    size_t used = e->segptr - e->segbuf;
+    size_t size = UPB_MAX(used * 2, 8);
+    upb_encoder_segment *segs = realloc(e->segbuf, size * sizeof(*segs));
+    if (!segs) return upb_encoder_seterr(e, "Out of memory");
+    e->segbuf = segs;
+    e->segptr = segs + used;
+    e->seglimit = segs + size;
+  }
+
+  *e->top = e->segptr - e->segbuf;
+  e->segptr->msglen = 0;
+  e->segptr->seglen = 0;
+  return true;
 }
 
-// Puts an unsigned 32-bit varint, verbatim.  Never uses the high 64 bits.
-static uint8_t *upb_put_v_uint32_t(uint8_t *buf, uint32_t val)
-{
-  return upb_put_v_uint64_t(buf, val);
+static bool end_delim(upb_encoder *e) {
+  accumulate(e);
+  uint32_t msglen = e->segbuf[*e->top].msglen;
+
+  if (e->top != e->stack) {
+    // The enclosing region also contains our data and length prefix.
+    e->top--;
+    e->segbuf[*e->top].msglen += upb_encoder_varintsize(msglen) + msglen;
+    return true;
+  }
+
+  // The outermost region ended, so every length is now known.
+  e->top = NULL;
+  bool ok = putbuf(e, e->buf, e->prefix_len);
+  const char *data = e->buf + e->prefix_len;
+  for (upb_encoder_segment *s = e->segbuf; ok && s <= e->segptr; s++) {
+    char lenbuf[UPB_PB_VARINT_MAX_LEN];
+    ok = putbuf(e, lenbuf, upb_vencode64(s->msglen, lenbuf)) &&
+         putbuf(e, data, s->seglen);
+    data += s->seglen;
+  }
+  e->ptr = e->buf;
+  return ok;
 }
 
-// Puts a signed 32-bit varint, first sign-extending to 64-bits.  We do this to
-// maintain wire-compatibility with 64-bit signed integers.
-static uint8_t *upb_put_v_int32_t(uint8_t *buf, int32_t val)
-{
-  return upb_put_v_uint64_t(buf, (int64_t)val);
+
+/* Wire values ****************************************************************/
+
+// These assume that reserve() was already called for the value.
+
+static void put_tag(upb_encoder *e, const upb_encoder_tag *t) {
+  memcpy(e->ptr, t->tag, UPB_ENCODER_MAX_TAG);
+  e->ptr += t->bytes;
 }
 
-static void upb_put32(uint8_t *buf, uint32_t val) {
-  buf[0] = val & 0xff;
-  buf[1] = (val >> 8) & 0xff;
-  buf[2] = (val >> 16) & 0xff;
-  buf[3] = (val >> 24);
+static void put_varint(upb_encoder *e, uint64_t val) {
+  e->ptr += upb_vencode64(val, e->ptr);
 }
 
-// Puts a fixed-length 32-bit integer (wire type: UPB_WIRE_TYPE_32BIT).
-static uint8_t *upb_put_f_uint32_t(uint8_t *buf, uint32_t val)
-{
-  uint8_t *uint32_end = buf + sizeof(uint32_t);
-#if UPB_UNALIGNED_READS_OK
-  *(uint32_t*)buf = val;
+static void put_fixed32(upb_encoder *e, uint32_t val) {
+#ifdef UPB_UNALIGNED_READS_OK
+  // A single (unaligned) store of the little-endian value.
+  memcpy(e->ptr, &val, sizeof(val));
 #else
-  upb_put32(buf, val);
+  for (int i = 0; i < 4; i++) e->ptr[i] = (val >> (i * 8)) & 0xff;
 #endif
-  return uint32_end;
+  e->ptr += 4;
 }
 
-// Puts a fixed-length 64-bit integer (wire type: UPB_WIRE_TYPE_64BIT).
-static uint8_t *upb_put_f_uint64_t(uint8_t *buf, uint64_t val)
-{
-  uint8_t *uint64_end = buf + sizeof(uint64_t);
-#if UPB_UNALIGNED_READS_OK
-  *(uint64_t*)buf = val;
+static void put_fixed64(upb_encoder *e, uint64_t val) {
+#ifdef UPB_UNALIGNED_READS_OK
+  memcpy(e->ptr, &val, sizeof(val));
 #else
-  upb_put32(buf, (uint32_t)val);
-  upb_put32(buf, (uint32_t)(val >> 32));
+  for (int i = 0; i < 8; i++) e->ptr[i] = (val >> (i * 8)) & 0xff;
 #endif
-  return uint64_end;
+  e->ptr += 8;
 }
 
-/* Functions to write and calculate sizes for .proto values. ******************/
+static uint64_t dbl2uint64(double d) {
+  uint64_t ret;
+  memcpy(&ret, &d, sizeof(ret));
+  return ret;
+}
 
-// Performs zig-zag encoding, which is used by sint32 and sint64.
-static uint32_t upb_zzenc_32(int32_t n) { return (n << 1) ^ (n >> 31); }
-static uint64_t upb_zzenc_64(int64_t n) { return (n << 1) ^ (n >> 63); }
+static uint32_t flt2uint32(float d) {
+  uint32_t ret;
+  memcpy(&ret, &d, sizeof(ret));
+  return ret;
+}
 
-/* Use macros to define a set of two functions for each .proto type:
- *
- *  // Converts and writes a .proto value into buf.  "end" indicates the end
- *  // of the current available buffer (if the buffer does not contain enough
- *  // space UPB_STATUS_NEED_MORE_DATA is returned).  On success, *outbuf will
- *  // point one past the data that was written.
- *  uint8_t *upb_put_INT32(uint8_t *buf, int32_t val);
- *
- *  // Returns the number of bytes required to encode val.
- *  size_t upb_get_INT32_size(int32_t val);
- *
- *  // Given a .proto value s (source) convert it to a wire value.
- *  uint32_t upb_vtowv_INT32(int32_t s);
- */
 
-#define VTOWV(type, wire_t, val_t) \
-  static wire_t upb_vtowv_ ## type(val_t s)
+/* Handlers *******************************************************************/
 
-#define PUT(type, v_or_f, wire_t, val_t, member_name) \
-  static uint8_t *upb_put_ ## type(uint8_t *buf, val_t val) { \
-    wire_t tmp = upb_vtowv_ ## type(val); \
-    return upb_put_ ## v_or_f ## _ ## wire_t(buf, tmp); \
+#define T(type, ctype, convert, encode)                                      \
+  static bool encode_ ## type(void *c, void *d, ctype val) {                 \
+    upb_encoder *e = c;                                                      \
+    if (!reserve(e, UPB_ENCODER_MAX_TAG + UPB_PB_VARINT_MAX_LEN))            \
+      return false;                                                          \
+    put_tag(e, d);                                                           \
+    encode(e, (convert)(val));                                               \
+    return commit(e);                                                        \
   }
 
-#define T(type, v_or_f, wire_t, val_t, member_name) \
-  static size_t upb_get_ ## type ## _size(val_t val) { \
-    return upb_ ## v_or_f ## _ ## wire_t ## _size(val); \
-  } \
-  VTOWV(type, wire_t, val_t);  /* prototype for PUT below */ \
-  PUT(type, v_or_f, wire_t, val_t, member_name) \
-  VTOWV(type, wire_t, val_t)
-
-T(INT32,    v,  int32_t, int32_t,  int32)   { return (uint32_t)s;     }
-T(INT64,    v, uint64_t, int64_t,  int64)   { return (uint64_t)s;     }
-T(UINT32,   v, uint32_t, uint32_t, uint32)  { return s;               }
-T(UINT64,   v, uint64_t, uint64_t, uint64)  { return s;               }
-T(SINT32,   v, uint32_t, int32_t,  int32)   { return upb_zzenc_32(s); }
-T(SINT64,   v, uint64_t, int64_t,  int64)   { return upb_zzenc_64(s); }
-T(FIXED32,  f, uint32_t, uint32_t, uint32)  { return s;               }
-T(FIXED64,  f, uint64_t, uint64_t, uint64)  { return s;               }
-T(SFIXED32, f, uint32_t, int32_t,  int32)   { return (uint32_t)s;     }
-T(SFIXED64, f, uint64_t, int64_t,  int64)   { return (uint64_t)s;     }
-T(BOOL,     v, uint32_t, bool,     _bool)   { return (uint32_t)s;     }
-T(ENUM,     v, uint32_t, int32_t,  int32)   { return (uint32_t)s;     }
-T(DOUBLE,   f, uint64_t, double,   _double) {
-  upb_value v;
-  v._double = s;
-  return v.uint64;
-}
-T(FLOAT,    f, uint32_t, float,    _float)  {
-  upb_value v;
-  v._float = s;
-  return v.uint32;
-}
-#undef VTOWV
-#undef PUT
+T(double,   double,   dbl2uint64,  put_fixed64)
+T(float,    float,    flt2uint32,  put_fixed32)
+T(int64,    int64_t,  uint64_t,    put_varint)
+T(int32,    int32_t,  int64_t,     put_varint)  // Sign-extended.
+T(fixed64,  uint64_t, uint64_t,    put_fixed64)
+T(fixed32,  uint32_t, uint32_t,    put_fixed32)
+T(bool,     bool,     bool,        put_varint)
+T(uint32,   uint32_t, uint32_t,    put_varint)
+T(uint64,   uint64_t, uint64_t,    put_varint)
+T(sfixed32, int32_t,  uint32_t,    put_fixed32)
+T(sfixed64, int64_t,  uint64_t,    put_fixed64)
+T(sint32,   int32_t,  upb_zzenc_32, put_varint)
+T(sint64,   int64_t,  upb_zzenc_64, put_varint)
+
 #undef T
 
-static uint8_t *upb_encode_value(uint8_t *buf, upb_field_type_t ft, upb_value v)
-{
-#define CASE(t, member_name) \
-  case UPB_TYPE(t): return upb_put_ ## t(buf, v.member_name);
-  switch(ft) {
-    CASE(DOUBLE,   _double)
-    CASE(FLOAT,    _float)
-    CASE(INT32,    int32)
-    CASE(INT64,    int64)
-    CASE(UINT32,   uint32)
-    CASE(UINT64,   uint64)
-    CASE(SINT32,   int32)
-    CASE(SINT64,   int64)
-    CASE(FIXED32,  uint32)
-    CASE(FIXED64,  uint64)
-    CASE(SFIXED32, int32)
-    CASE(SFIXED64, int64)
-    CASE(BOOL,     _bool)
-    CASE(ENUM,     int32)
-    default: assert(false); return buf;
-  }
-#undef CASE
+static void *startdelim(void *c, void *d) {
+  upb_encoder *e = c;
+  if (!reserve(e, UPB_ENCODER_MAX_TAG)) return UPB_BREAK;
+  put_tag(e, d);
+  return start_delim(e) ? e : UPB_BREAK;
 }
 
-static uint32_t _upb_get_value_size(upb_field_type_t ft, upb_value v)
-{
-#define CASE(t, member_name) \
-  case UPB_TYPE(t): return upb_get_ ## t ## _size(v.member_name);
-  switch(ft) {
-    CASE(DOUBLE,   _double)
-    CASE(FLOAT,    _float)
-    CASE(INT32,    int32)
-    CASE(INT64,    int64)
-    CASE(UINT32,   uint32)
-    CASE(UINT64,   uint64)
-    CASE(SINT32,   int32)
-    CASE(SINT64,   int64)
-    CASE(FIXED32,  uint32)
-    CASE(FIXED64,  uint64)
-    CASE(SFIXED32, int32)
-    CASE(SFIXED64, int64)
-    CASE(BOOL,     _bool)
-    CASE(ENUM,     int32)
-    default: assert(false); return 0;
-  }
-#undef CASE
+static void *startstr(void *c, void *d, size_t size_hint) {
+  UPB_UNUSED(size_hint);
+  return startdelim(c, d);
 }
 
-static uint8_t *_upb_put_tag(uint8_t *buf, upb_field_number_t num,
-                             upb_wire_type_t wt)
-{
-  return upb_put_UINT32(buf, wt | (num << 3));
+static size_t putstr(void *c, void *d, const char *buf, size_t len) {
+  UPB_UNUSED(d);
+  upb_encoder *e = c;
+  if (!reserve(e, len)) return 0;
+  memcpy(e->ptr, buf, len);
+  e->ptr += len;
+  return len;
 }
 
-static uint32_t _upb_get_tag_size(upb_field_number_t num)
-{
-  return upb_get_UINT32_size(num << 3);
+static bool endstr(void *c, void *d) {
+  UPB_UNUSED(d);
+  return end_delim(c);
 }
 
-
-/* upb_sizebuilder ************************************************************/
-
-struct upb_sizebuilder {
-  // Accumulating size for the current level.
-  uint32_t size;
-
-  // Stack of sizes for our current nesting.
-  uint32_t stack[UPB_MAX_NESTING], *top;
-
-  // Vector of sizes.
-  uint32_t *sizes;
-  int sizes_len;
-  int sizes_size;
-
-  upb_status status;
-};
-
-// upb_sink callbacks.
-static upb_sink_status _upb_sizebuilder_valuecb(upb_sink *sink, upb_fielddef *f,
-                                                upb_value val,
-                                                upb_status *status)
-{
-  (void)status;
-  upb_sizebuilder *sb = (upb_sizebuilder*)sink;
-  uint32_t size = 0;
-  size += _upb_get_tag_size(f->number);
-  size += _upb_get_value_size(f->type, val);
-  sb->size += size;
-  return UPB_SINK_CONTINUE;
+static void *startsubmsg(void *c, void *d) {
+  upb_encoder *e = c;
+  e->depth++;
+  return startdelim(c, d);
 }
 
-static upb_sink_status _upb_sizebuilder_strcb(upb_sink *sink, upb_fielddef *f,
-                                              upb_strptr str,
-                                              int32_t start, uint32_t end,
-                                              upb_status *status)
-{
-  (void)status;
-  (void)str;   // String data itself is not used.
-  upb_sizebuilder *sb = (upb_sizebuilder*)sink;
-  if(start >= 0) {
-    uint32_t size = 0;
-    size += _upb_get_tag_size(f->number);
-    size += upb_get_UINT32_size(end - start);
-    sb->size += size;
-  }
-  return UPB_SINK_CONTINUE;
+static bool endsubmsg(void *c, void *d) {
+  UPB_UNUSED(d);
+  upb_encoder *e = c;
+  e->depth--;
+  return end_delim(e);
 }
 
-static upb_sink_status _upb_sizebuilder_startcb(upb_sink *sink, upb_fielddef *f,
-                                                upb_status *status)
-{
-  (void)status;
-  (void)f;  // Unused (we calculate tag size and delimiter in endcb).
-  upb_sizebuilder *sb = (upb_sizebuilder*)sink;
-  if(f->type == UPB_TYPE(MESSAGE)) {
-    *sb->top = sb->size;
-    sb->top++;
-    sb->size = 0;
-  } else {
-    assert(f->type == UPB_TYPE(GROUP));
-    sb->size += _upb_get_tag_size(f->number);
-  }
-  return UPB_SINK_CONTINUE;
+static void *startgroup(void *c, void *d) {
+  upb_encoder *e = c;
+  if (!reserve(e, UPB_ENCODER_MAX_TAG)) return UPB_BREAK;
+  put_tag(e, d);
+  e->depth++;
+  return commit(e) ? e : UPB_BREAK;
 }
 
-static upb_sink_status _upb_sizebuilder_endcb(upb_sink *sink, upb_fielddef *f,
-                                              upb_status *status)
-{
-  (void)status;
-  upb_sizebuilder *sb = (upb_sizebuilder*)sink;
-  if(f->type == UPB_TYPE(MESSAGE)) {
-    sb->top--;
-    if(sb->sizes_len == sb->sizes_size) {
-      sb->sizes_size *= 2;
-      sb->sizes = realloc(sb->sizes, sb->sizes_size * sizeof(*sb->sizes));
-    }
-    uint32_t child_size = sb->size;
-    uint32_t parent_size = *sb->top;
-    sb->sizes[sb->sizes_len++] = child_size;
-    // The size according to the parent includes the tag size and delimiter of
-    // the submessage.
-    parent_size += upb_get_UINT32_size(child_size);
-    parent_size += _upb_get_tag_size(f->number);
-    // Include size accumulated in parent before child began.
-    sb->size = child_size + parent_size;
-  } else {
-    assert(f->type == UPB_TYPE(GROUP));
-    // As an optimization, we could just add this number twice in startcb, to
-    // avoid having to recalculate it.
-    sb->size += _upb_get_tag_size(f->number);
-  }
-  return UPB_SINK_CONTINUE;
+static bool endgroup(void *c, void *d) {
+  upb_encoder *e = c;
+  if (!reserve(e, UPB_ENCODER_MAX_TAG)) return false;
+  put_tag(e, d);
+  e->depth--;
+  return commit(e);
 }
 
-upb_sink_callbacks _upb_sizebuilder_sink_vtbl = {
-  _upb_sizebuilder_valuecb,
-  _upb_sizebuilder_strcb,
-  _upb_sizebuilder_startcb,
-  _upb_sizebuilder_endcb
-};
+static void endmsg(void *c, upb_status *status) {
+  upb_encoder *e = c;
+  if (e->depth == 0 && upb_ok(&e->status)) flush(e);
+  if (!upb_ok(&e->status)) upb_status_copy(status, &e->status);
+}
 
 
-/* upb_sink callbacks *********************************************************/
+/* Public API *****************************************************************/
 
-struct upb_encoder {
-  upb_sink base;
-  //upb_bytesink *bytesink;
-  uint32_t *sizes;
-  int size_offset;
-};
+upb_encoder *upb_encoder_new() {
+  upb_encoder *e = malloc(sizeof(*e));
+  if (!e) return NULL;
+  e->buf = e->ptr = e->limit = e->runbegin = NULL;
+  e->segbuf = e->segptr = e->seglimit = NULL;
+  upb_status_init(&e->status);
+  upb_encoder_reset(e, NULL);
+  return e;
+}
 
+void upb_encoder_free(upb_encoder *e) {
+  upb_status_uninit(&e->status);
+  free(e->buf);
+  free(e->segbuf);
+  free(e);
+}
 
-// Within one callback we may need to encode up to two separate values.
-#define UPB_ENCODER_BUFSIZE (UPB_MAX_ENCODED_SIZE * 2)
-
-static upb_sink_status _upb_encoder_push_buf(upb_encoder *s, const uint8_t *buf,
-                                             size_t len, upb_status *status)
-{
-  // TODO: conjure a upb_strptr that points to buf.
-  //upb_strptr ptr;
-  (void)s;
-  (void)buf;
-  (void)status;
-  size_t written = 5;// = upb_bytesink_onbytes(s->bytesink, ptr);
-  if(written < len) {
-    // TODO: mark to skip "written" bytes next time.
-    return UPB_SINK_STOP;
-  } else {
-    return UPB_SINK_CONTINUE;
-  }
+void upb_encoder_reset(upb_encoder *e, upb_bytesink *sink) {
+  e->sink = sink;
+  e->ptr = e->runbegin = e->buf;
+  e->prefix_len = 0;
+  e->segptr = e->segbuf;
+  e->top = NULL;
+  e->depth = 0;
+  upb_status_clear(&e->status);
 }
 
-static upb_sink_status _upb_encoder_valuecb(upb_sink *sink, upb_fielddef *f,
-                                            upb_value val, upb_status *status)
-{
-  upb_encoder *s = (upb_encoder*)sink;
-  uint8_t buf[UPB_ENCODER_BUFSIZE], *ptr = buf;
-  upb_wire_type_t wt = upb_types[f->type].expected_wire_type;
-  // TODO: handle packed encoding.
-  ptr = _upb_put_tag(ptr, f->number, wt);
-  ptr = upb_encode_value(ptr, f->type, val);
-  return _upb_encoder_push_buf(s, buf, ptr - buf, status);
+const upb_status *upb_encoder_status(const upb_encoder *e) {
+  return &e->status;
 }
 
-static upb_sink_status _upb_encoder_strcb(upb_sink *sink, upb_fielddef *f,
-                                          upb_strptr str,
-                                          int32_t start, uint32_t end,
-                                          upb_status *status)
-{
-  upb_encoder *s = (upb_encoder*)sink;
-  uint8_t buf[UPB_ENCODER_BUFSIZE], *ptr = buf;
-  if(start >= 0) {
-    ptr = _upb_put_tag(ptr, f->number, UPB_WIRE_TYPE_DELIMITED);
-    ptr = upb_put_UINT32(ptr, end - start);
-  }
-  // TODO: properly handle partially consumed strings and partially supplied
-  // strings.
-  _upb_encoder_push_buf(s, buf, ptr - buf, status);
-  return _upb_encoder_push_buf(s, (uint8_t*)upb_string_getrobuf(str), end - start, status);
+static upb_encoder_tag *newtag(const upb_fielddef *f, upb_wiretype_t wt) {
+  upb_encoder_tag *t = malloc(sizeof(*t));
+  if (!t) return NULL;
+  t->bytes = upb_vencode64((upb_fielddef_number(f) << 3) | wt, t->tag);
+  return t;
 }
 
-static upb_sink_status _upb_encoder_startcb(upb_sink *sink, upb_fielddef *f,
-                                            upb_status *status)
-{
-  upb_encoder *s = (upb_encoder*)sink;
-  uint8_t buf[UPB_ENCODER_BUFSIZE], *ptr = buf;
-  if(f->type == UPB_TYPE(GROUP)) {
-    ptr = _upb_put_tag(ptr, f->number, UPB_WIRE_TYPE_START_GROUP);
-  } else {
-    ptr = _upb_put_tag(ptr, f->number, UPB_WIRE_TYPE_DELIMITED);
-    ptr = upb_put_UINT32(ptr, s->sizes[--s->size_offset]);
+static void onmreg(void *c, upb_handlers *h) {
+  UPB_UNUSED(c);
+  const upb_msgdef *m = upb_handlers_msgdef(h);
+  upb_handlers_setendmsg(h, endmsg);
+  upb_msg_iter i;
+  for(upb_msg_begin(&i, m); !upb_msg_done(&i); upb_msg_next(&i)) {
+    upb_fielddef *f = upb_msg_iter_field(&i);
+    switch (upb_fielddef_type(f)) {
+#define VALUE(type, settype, wt, func) \
+      case UPB_TYPE_ ## type: \
+        upb_handlers_set ## settype( \
+            h, f, func, newtag(f, UPB_WIRE_TYPE_ ## wt), free); \
+        break;
+      VALUE(DOUBLE,   double, 64BIT,  encode_double)
+      VALUE(FLOAT,    float,  32BIT,  encode_float)
+      VALUE(INT64,    int64,  VARINT, encode_int64)
+      VALUE(INT32,    int32,  VARINT, encode_int32)
+      VALUE(ENUM,     int32,  VARINT, encode_int32)
+      VALUE(FIXED64,  uint64, 64BIT,  encode_fixed64)
+      VALUE(FIXED32,  uint32, 32BIT,  encode_fixed32)
+      VALUE(BOOL,     bool,   VARINT, encode_bool)
+      VALUE(UINT32,   uint32, VARINT, encode_uint32)
+      VALUE(UINT64,   uint64, VARINT, encode_uint64)
+      VALUE(SFIXED32, int32,  32BIT,  encode_sfixed32)
+      VALUE(SFIXED64, int64,  64BIT,  encode_sfixed64)
+      VALUE(SINT32,   int32,  VARINT, encode_sint32)
+      VALUE(SINT64,   int64,  VARINT, encode_sint64)
+#undef VALUE
+      case UPB_TYPE_STRING:
+      case UPB_TYPE_BYTES:
+        upb_handlers_setstartstr(
+            h, f, startstr, newtag(f, UPB_WIRE_TYPE_DELIMITED), free);
+        upb_handlers_setstring(h, f, putstr, NULL, NULL);
+        upb_handlers_setendstr(h, f, endstr, NULL, NULL);
+        break;
+      case UPB_TYPE_MESSAGE:
+        upb_handlers_setstartsubmsg(
+            h, f, startsubmsg, newtag(f, UPB_WIRE_TYPE_DELIMITED), free);
+        upb_handlers_setendsubmsg(h, f, endsubmsg, NULL, NULL);
+        break;
+      case UPB_TYPE_GROUP:
+        upb_handlers_setstartsubmsg(
+            h, f, startgroup, newtag(f, UPB_WIRE_TYPE_START_GROUP), free);
+        upb_handlers_setendsubmsg(
+            h, f, endgroup, newtag(f, UPB_WIRE_TYPE_END_GROUP), free);
+        break;
+      default:
+        assert(false);
+        break;
+    }
   }
-  return _upb_encoder_push_buf(s, buf, ptr - buf, status);
 }
 
-static upb_sink_status _upb_encoder_endcb(upb_sink *sink, upb_fielddef *f,
-                                          upb_status *status)
-{
-  upb_encoder *s = (upb_encoder*)sink;
-  uint8_t buf[UPB_ENCODER_BUFSIZE], *ptr = buf;
-  if(f->type != UPB_TYPE(GROUP)) return UPB_SINK_CONTINUE;
-  ptr = _upb_put_tag(ptr, f->number, UPB_WIRE_TYPE_END_GROUP);
-  return _upb_encoder_push_buf(s, buf, ptr - buf, status);
+const upb_handlers *upb_encoder_newhandlers(const void *owner,
+                                            const upb_msgdef *m) {
+  return upb_handlers_newfrozen(m, owner, &onmreg, NULL);
 }
-
-upb_sink_callbacks _upb_encoder_sink_vtbl = {
-  _upb_encoder_valuecb,
-  _upb_encoder_strcb,
-  _upb_encoder_startcb,
-  _upb_encoder_endcb
-};
-
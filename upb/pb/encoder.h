@@ -7,16 +7,24 @@
  * Implements a set of upb_handlers that write protobuf data to the binary wire
  * format.
  *
- * For messages that have any submessages, the encoder needs a buffer
- * containing the submessage sizes, so they can be properly written at the
- * front of each message.  Note that groups do *not* have this requirement.
+ * This encoder is only somewhat optimized, and does not use any JIT.  Since
+ * submessages and strings are length-delimited, and their lengths are not
+ * known until they end, everything inside a delimited region is buffered
+ * until the outermost region ends; the lengths are then prepended as the
+ * buffered data is written out.  Data outside of any delimited region is
+ * written to the bytesink as the buffer fills, and when the top-level message
+ * ends.  Groups are not delimited, so their contents are never held back.
+ *
+ * Because the handlers can be attached to a upb_decoder, piping a decoder
+ * into an encoder transcodes one serialized message into another without
+ * materializing it (eg. to re-canonicalize it).
  */
 
 #ifndef UPB_ENCODER_H_
 #define UPB_ENCODER_H_
 
-#include "upb/upb.h"
 #include "upb/bytestream.h"
+#include "upb/handlers.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,32 +32,26 @@ extern "C" {
 
 /* upb_encoder ****************************************************************/
 
-// A upb_encoder is a upb_sink that emits data to a upb_bytesink in the protocol
-// buffer binary wire format.
 struct upb_encoder;
 typedef struct upb_encoder upb_encoder;
 
-upb_encoder *upb_encoder_new(upb_msgdef *md);
+upb_encoder *upb_encoder_new();
 void upb_encoder_free(upb_encoder *e);
 
-// Resets the given upb_encoder such that is is ready to begin encoding,
-// outputting data to "bytesink" (which must live until the encoder is
-// reset or destroyed).
-void upb_encoder_reset(upb_encoder *e, upb_bytesink *bytesink);
-
-// Returns the upb_sink to which data can be written.  The sink is invalidated
-// when the encoder is reset or destroyed.  Note that if the client wants to
-// encode any length-delimited submessages it must first call
-// upb_encoder_buildsizes() below.
-upb_sink *upb_encoder_sink(upb_encoder *e);
-
-// Call prior to pushing any data with embedded submessages.  "src" must yield
-// exactly the same data as what will next be encoded, but in reverse order.
-// The encoder iterates over this data in order to determine the sizes of the
-// submessages.  If any errors are returned by the upb_src, the status will
-// be saved in *status.  If the client is sure that the upb_src will not throw
-// any errors, "status" may be NULL.
-void upb_encoder_buildsizes(upb_encoder *e, upb_src *src, upb_status *status);
+// Resets the encoder so that it is ready to encode a new message, writing its
+// output to "sink" (which must live until the encoder is reset or freed).
+// Any data that was buffered for a previous message is discarded.
+void upb_encoder_reset(upb_encoder *e, upb_bytesink *sink);
+
+// Returns handlers that encode messages of type "m" when they are called with
+// a upb_encoder as their closure.  The handlers are frozen and may be shared
+// between any number of encoders.
+const upb_handlers *upb_encoder_newhandlers(const void *owner,
+                                            const upb_msgdef *m);
+
+// Describes the error (if any) that stopped the last encode, eg. the
+// bytesink failing or the encoder running out of memory.
+const upb_status *upb_encoder_status(const upb_encoder *e);
 
 #ifdef __cplusplus
 }  /* extern "C" */
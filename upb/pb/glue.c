@@ -14,17 +14,59 @@
 #include "upb/descriptor/reader.h"
 #include "upb/pb/decoder.h"
 
+// The handlers for parsing descriptors are built once and shared by every
+// call.  Building a plan from the same handlers gets a hit in the plan cache
+// while another load is using it.  The handlers are released at exit, so that
+// leak checkers do not report them.
+static const upb_handlers *upb_deschandlers;
+
+static void upb_deschandlers_free() {
+  upb_handlers_unref(upb_deschandlers, &upb_deschandlers);
+  upb_deschandlers = NULL;
+}
+
+// Returns NULL if the handlers could not be built; a later call will try
+// again.
+static const upb_handlers *upb_getdeschandlers() {
+  upb_lock();
+  const upb_handlers *h = upb_deschandlers;
+  upb_unlock();
+  if (h) return h;
+
+  // The handlers are built without holding upb_lock(), because building them
+  // takes it too in UPB_DEBUG_REFS builds.  If another thread gets there
+  // first, its handlers are used and ours are dropped.
+  const upb_handlers *built = upb_descreader_newhandlers(&upb_deschandlers);
+  if (!built) return NULL;
+  upb_lock();
+  bool installed = (upb_deschandlers == NULL);
+  if (installed) upb_deschandlers = built;
+  h = upb_deschandlers;
+  upb_unlock();
+  if (installed) {
+    // If this fails, the handlers are just never released.
+    atexit(&upb_deschandlers_free);
+  } else {
+    upb_handlers_unref(built, &upb_deschandlers);
+  }
+  return h;
+}
+
 upb_def **upb_load_defs_from_descriptor(const char *str, size_t len, int *n,
                                         void *owner, upb_status *status) {
   upb_stringsrc strsrc;
   upb_stringsrc_init(&strsrc);
   upb_stringsrc_reset(&strsrc, str, len);
 
-  const upb_handlers *h = upb_descreader_newhandlers(&h);
-  upb_decoderplan *p = upb_decoderplan_new(h, false);
+  const upb_handlers *h = upb_getdeschandlers();
+  upb_decoderplan *p = h ? upb_decoderplan_new(h, false) : NULL;
+  if (!p) {
+    if (status) upb_status_seterrliteral(status, "Out of memory");
+    upb_stringsrc_uninit(&strsrc);
+    return NULL;
+  }
   upb_decoder d;
   upb_decoder_init(&d);
-  upb_handlers_unref(h, &h);
   upb_descreader r;
   upb_descreader_init(&r);
   upb_decoder_resetplan(&d, p);
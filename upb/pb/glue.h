@@ -16,11 +16,11 @@
  * which could be undesirable if you're trying to use a trimmed-down build of
  * upb.
  *
- * While these routines are convenient, they do not reuse any encoding/decoding
- * state.  For example, if a decoder is JIT-based, it will be re-JITted every
- * time these functions are called.  For this reason, if you are parsing lots
- * of data and efficiency is an issue, these may not be the best functions to
- * use (though they are useful for prototyping, before optimizing).
+ * While these routines are convenient, they reuse little encoding/decoding
+ * state (only the handlers for descriptors are shared between calls).  For
+ * this reason, if you are parsing lots of data and efficiency is an issue,
+ * these may not be the best functions to use (though they are useful for
+ * prototyping, before optimizing).
  */
 
 #ifndef UPB_GLUE_H
@@ -0,0 +1,267 @@
+/*
+ * upb - a minimalist implementation of protocol buffers.
+ *
+ * Copyright (c) 2012 Google Inc.  See LICENSE for details.
+ * Author: Josh Haberman <jhaberman@gmail.com>
+ */
+
+#include <stdlib.h>
+#ifndef UPB_THREAD_UNSAFE
+#include <pthread.h>
+#endif
+#include "upb/bytestream.h"
+#include "upb/pb/parallel.h"
+
+typedef struct upb_recordchunk {
+  const char *buf;
+  size_t len;
+  uint64_t first_record;
+  size_t num_records;
+  void *closure;
+  upb_status status;
+  bool done;
+  struct upb_recordchunk *next_pending;  // Unordered mode's delivery queue.
+} upb_recordchunk;
+
+typedef struct {
+  upb_decoderplan *plan;
+  const upb_parallel_opts *opts;
+  upb_recordchunk *chunks;
+  size_t num_chunks;
+  size_t next;       // The next chunk to be decoded.
+  size_t delivered;  // Ordered: chunks before this have had endchunk called.
+  upb_recordchunk *pending;  // Unordered: done chunks awaiting endchunk.
+  bool delivering;   // Some thread is making endchunk calls.
+  bool failed;       // No more chunks are started once one has failed.
+#ifndef UPB_THREAD_UNSAFE
+  pthread_mutex_t mutex;  // Guards everything above (but is not held while
+                          // calling endchunk).
+#endif
+} upb_parallel;
+
+#ifdef UPB_THREAD_UNSAFE
+static void upb_parallel_lock(upb_parallel *par) { UPB_UNUSED(par); }
+static void upb_parallel_unlock(upb_parallel *par) { UPB_UNUSED(par); }
+#else
+static void upb_parallel_lock(upb_parallel *par) {
+  pthread_mutex_lock(&par->mutex);
+}
+static void upb_parallel_unlock(upb_parallel *par) {
+  pthread_mutex_unlock(&par->mutex);
+}
+#endif
+
+void upb_parallel_opts_init(upb_parallel_opts *opts) {
+  opts->num_threads = 1;
+  opts->chunk_bytes = 64 * 1024;
+  opts->ordered = true;
+  opts->startchunk = NULL;
+  opts->endchunk = NULL;
+  opts->ud = NULL;
+}
+
+static bool upb_parallel_addchunk(upb_parallel *par, size_t *size,
+                                  const char *buf, size_t len,
+                                  uint64_t first_record, size_t num_records) {
+  if (par->num_chunks == *size) {
+    size_t new_size = UPB_MAX(*size * 2, 8);
+    upb_recordchunk *chunks =
+        realloc(par->chunks, new_size * sizeof(upb_recordchunk));
+    if (!chunks) return false;
+    par->chunks = chunks;
+    *size = new_size;
+  }
+  upb_recordchunk *c = &par->chunks[par->num_chunks++];
+  c->buf = buf;
+  c->len = len;
+  c->first_record = first_record;
+  c->num_records = num_records;
+  c->closure = NULL;
+  upb_status_init(&c->status);
+  c->done = false;
+  c->next_pending = NULL;
+  return true;
+}
+
+// Finds the record boundaries in [buf, buf+len) and cuts the stream into
+// chunks of whole records.  Only the length prefixes are read; the records
+// themselves are checked when they are decoded.
+static bool upb_parallel_split(upb_parallel *par, const char *buf, size_t len,
+                               upb_status *status) {
+  size_t chunk_bytes = UPB_MAX(par->opts->chunk_bytes, 1);
+  size_t size = 0;
+  const char *p = buf, *end = buf + len;
+  const char *chunk_start = p;
+  uint64_t records = 0, chunk_first = 0;
+  while (p < end) {
+    // Record lengths are 32-bit varints, like the decoder's delimited lengths.
+    uint64_t reclen = 0;
+    int bitpos = 0;
+    uint8_t byte;
+    do {
+      if (p == end) {
+        upb_status_seterrliteral(status, "Unexpected EOF in record length");
+        return false;
+      }
+      if (bitpos == 35) {
+        upb_status_seterrliteral(status, "Unterminated record length");
+        return false;
+      }
+      byte = *p++;
+      reclen |= (uint64_t)(byte & 0x7f) << bitpos;
+      bitpos += 7;
+    } while (byte & 0x80);
+    if (reclen > UINT32_MAX || reclen > (size_t)(end - p)) {
+      upb_status_seterrliteral(status, "Record extends past end of stream");
+      return false;
+    }
+    p += reclen;
+    records++;
+    if ((size_t)(p - chunk_start) >= chunk_bytes || p == end) {
+      if (!upb_parallel_addchunk(par, &size, chunk_start, p - chunk_start,
+                                 chunk_first, records - chunk_first)) {
+        upb_status_seterrliteral(status, "Out of memory");
+        return false;
+      }
+      chunk_start = p;
+      chunk_first = records;
+    }
+  }
+  return true;
+}
+
+// Returns the next chunk to decode, or NULL if there are none left.
+static upb_recordchunk *upb_parallel_getchunk(upb_parallel *par) {
+  upb_parallel_lock(par);
+  upb_recordchunk *c = NULL;
+  if (!par->failed && par->next < par->num_chunks)
+    c = &par->chunks[par->next++];
+  upb_parallel_unlock(par);
+  return c;
+}
+
+static void upb_parallel_endchunk(upb_parallel *par, upb_recordchunk *c) {
+  const upb_parallel_opts *opts = par->opts;
+  if (opts->endchunk)
+    opts->endchunk(opts->ud, c - par->chunks, c->closure, &c->status);
+}
+
+// Returns the next chunk that is ready for its endchunk call, or NULL if
+// there is none.  Must be called with the lock held.
+static upb_recordchunk *upb_parallel_nextdelivery(upb_parallel *par) {
+  if (!par->opts->ordered) {
+    upb_recordchunk *c = par->pending;
+    if (c) par->pending = c->next_pending;
+    return c;
+  }
+  // Chunks are started in order, so if the next one in line is not done,
+  // whoever is decoding it will deliver it and any that finished after it.
+  if (par->delivered < par->num_chunks && par->chunks[par->delivered].done)
+    return &par->chunks[par->delivered++];
+  return NULL;
+}
+
+// Marks the chunk done and makes any endchunk calls that are now due.  Only
+// one thread at a time delivers chunks, so endchunk calls are serialized, but
+// the lock is dropped during each call so that a slow endchunk does not stop
+// the other threads from starting new chunks.  A thread that finishes a chunk
+// while another is delivering leaves it to that thread, which checks for more
+// chunks before it stops.
+static void upb_parallel_finishchunk(upb_parallel *par, upb_recordchunk *c) {
+  upb_parallel_lock(par);
+  c->done = true;
+  if (!upb_ok(&c->status)) par->failed = true;
+  if (!par->opts->ordered) {
+    c->next_pending = par->pending;
+    par->pending = c;
+  }
+  if (!par->delivering) {
+    par->delivering = true;
+    upb_recordchunk *d;
+    while ((d = upb_parallel_nextdelivery(par)) != NULL) {
+      upb_parallel_unlock(par);
+      upb_parallel_endchunk(par, d);
+      upb_parallel_lock(par);
+    }
+    par->delivering = false;
+  }
+  upb_parallel_unlock(par);
+}
+
+static void *upb_parallel_worker(void *_par) {
+  upb_parallel *par = _par;
+  const upb_parallel_opts *opts = par->opts;
+  upb_decoder d;
+  upb_decoder_init(&d);
+  upb_decoder_resetplan(&d, par->plan);
+  upb_stringsrc src;
+  upb_stringsrc_init(&src);
+  upb_recordchunk *c;
+  while ((c = upb_parallel_getchunk(par)) != NULL) {
+    c->closure = opts->startchunk(opts->ud, c - par->chunks, c->first_record,
+                                  c->num_records);
+    upb_stringsrc_reset(&src, c->buf, c->len);
+    upb_decoder_resetrecords(&d, upb_stringsrc_allbytes(&src), c->closure);
+    // A string source never blocks, so we cannot be suspended.
+    upb_success_t success = upb_decoder_decode(&d);
+    assert(success != UPB_SUSPENDED);
+    UPB_UNUSED(success);
+    upb_status_copy(&c->status, upb_decoder_status(&d));
+    upb_parallel_finishchunk(par, c);
+  }
+  upb_stringsrc_uninit(&src);
+  upb_decoder_uninit(&d);
+  return NULL;
+}
+
+bool upb_decode_records_parallel(upb_decoderplan *p, const char *buf,
+                                 size_t len, const upb_parallel_opts *opts,
+                                 upb_status *status) {
+  assert(opts->startchunk);
+  upb_parallel par;
+  par.plan = p;
+  par.opts = opts;
+  par.chunks = NULL;
+  par.num_chunks = 0;
+  par.next = 0;
+  par.delivered = 0;
+  par.pending = NULL;
+  par.delivering = false;
+  par.failed = false;
+
+  bool ok = upb_parallel_split(&par, buf, len, status);
+  if (ok) {
+#ifdef UPB_THREAD_UNSAFE
+    upb_parallel_worker(&par);
+#else
+    pthread_mutex_init(&par.mutex, NULL);
+    // The calling thread is one of the workers.  If we cannot create as many
+    // threads as were asked for, we make do with the ones we have.
+    int num_threads = UPB_MIN((size_t)UPB_MAX(opts->num_threads, 1),
+                              UPB_MAX(par.num_chunks, 1));
+    pthread_t *threads = malloc((num_threads - 1) * sizeof(pthread_t));
+    int started = 0;
+    while (threads && started < num_threads - 1 &&
+           pthread_create(&threads[started], NULL, &upb_parallel_worker,
+                          &par) == 0) {
+      started++;
+    }
+    upb_parallel_worker(&par);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&par.mutex);
+#endif
+    for (size_t i = 0; i < par.next; i++) {
+      if (!upb_ok(&par.chunks[i].status)) {
+        upb_status_copy(status, &par.chunks[i].status);
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < par.num_chunks; i++)
+    upb_status_uninit(&par.chunks[i].status);
+  free(par.chunks);
+  return ok;
+}
@@ -0,0 +1,75 @@
+/*
+ * upb - a minimalist implementation of protocol buffers.
+ *
+ * Copyright (c) 2012 Google Inc.  See LICENSE for details.
+ * Author: Josh Haberman <jhaberman@gmail.com>
+ *
+ * A driver that decodes a stream of length-delimited records (see
+ * upb_decoder_resetrecords()) on several threads at once.  The stream must be
+ * in memory (eg. read or mmap'd from a file).  It is first scanned for record
+ * boundaries, which only reads the length prefixes, and split into chunks of
+ * whole records.  Each worker thread then takes chunks in turn and decodes them
+ * with its own upb_decoder, sharing the upb_decoderplan (which is thread-safe).
+ *
+ * Handlers for a chunk's records are called on whichever thread decodes the
+ * chunk, with the closure that startchunk returned for it, so the handlers
+ * must not share mutable state between closures without synchronization.
+ */
+
+#ifndef UPB_PB_PARALLEL_H_
+#define UPB_PB_PARALLEL_H_
+
+#include "upb/pb/decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the closure that the records of chunk number "chunk" will be
+// delivered to.  The chunk holds records [first_record, first_record +
+// num_records) of the stream.  May be called on any worker thread, and
+// concurrently with other calls.
+typedef void *upb_startchunk_func(void *ud, size_t chunk, uint64_t first_record,
+                                  size_t num_records);
+
+// Called once a chunk has been decoded (successfully or not, see "status").
+// Calls are never concurrent with each other, and are made in chunk order if
+// the options ask for ordered delivery.  No lock is held during the call, so
+// other threads keep decoding while it runs.
+typedef void upb_endchunk_func(void *ud, size_t chunk, void *closure,
+                               const upb_status *status);
+
+typedef struct {
+  // Number of threads to decode on, including the calling thread.  Builds with
+  // UPB_THREAD_UNSAFE always decode on the calling thread only.
+  int num_threads;
+
+  // Chunks are cut at the first record boundary after this many bytes.
+  size_t chunk_bytes;
+
+  // If true, endchunk is called for chunks in the order they appear in the
+  // stream, even if a later chunk finished decoding first.
+  bool ordered;
+
+  upb_startchunk_func *startchunk;
+  upb_endchunk_func *endchunk;  // May be NULL.
+  void *ud;
+} upb_parallel_opts;
+
+// Sets defaults: one thread, 64kB chunks, ordered delivery, no callbacks.
+void upb_parallel_opts_init(upb_parallel_opts *opts);
+
+// Decodes the records in "buf" with plan "p", returning false if the stream
+// is malformed or any of its records fails to decode.  In that case "status"
+// describes the error in the earliest chunk that failed, and chunks after it
+// may not have been decoded (but every chunk for which startchunk was called
+// also gets its endchunk call).
+bool upb_decode_records_parallel(upb_decoderplan *p, const char *buf,
+                                 size_t len, const upb_parallel_opts *opts,
+                                 upb_status *status);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* UPB_PB_PARALLEL_H_ */
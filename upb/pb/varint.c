@@ -7,6 +7,21 @@
 
 #include "upb/pb/varint.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The SSSE3 bulk decoder is compiled in wherever the compiler can target it,
+// and used if the CPU we are running on supports it.
+#if defined(__SSE2__) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(UPB_NO_SSSE3)
+#define UPB_VDECODE_SSSE3
+#include <tmmintrin.h>
+#ifndef UPB_THREAD_UNSAFE
+#include <pthread.h>
+#endif
+#endif
+
 // A basic branch-based decoder, uses 32-bit values to get good performance
 // on 32-bit architectures (but performs well on 64-bits also).
 // This scheme comes from the original Google Protobuf implementation (proto2).
@@ -101,3 +116,226 @@ upb_decoderet upb_vdecode_max8_wright(upb_decoderet r) {
                         r.val | (b << 14)};
   return my_r;
 }
+
+// Decodes a varint that may run into "end" without reading at or past it.
+// Returns r.p == p if the varint continues past "end", or NULL if it is
+// unterminated.
+static upb_decoderet upb_vdecode_tail(const char *p, const char *end) {
+  upb_decoderet r = {p, 0};
+  int bitpos;
+  for (bitpos = 0; bitpos < 70; bitpos += 7) {
+    const char *b = p + bitpos / 7;
+    if (b == end) return r;  // Continues past end.
+    r.val |= ((uint64_t)(*b & 0x7fU)) << bitpos;
+    if ((*b & 0x80) == 0) {
+      r.p = b + 1;
+      return r;
+    }
+  }
+  r.p = NULL;
+  return r;
+}
+
+#ifdef __SSE2__
+// Zero-extends the 16 bytes of "v" into vals[0..15].
+INLINE void upb_vstore16_32(uint32_t *vals, __m128i v) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero);
+  __m128i hi = _mm_unpackhi_epi8(v, zero);
+  _mm_storeu_si128((__m128i*)vals,        _mm_unpacklo_epi16(lo, zero));
+  _mm_storeu_si128((__m128i*)(vals + 4),  _mm_unpackhi_epi16(lo, zero));
+  _mm_storeu_si128((__m128i*)(vals + 8),  _mm_unpacklo_epi16(hi, zero));
+  _mm_storeu_si128((__m128i*)(vals + 12), _mm_unpackhi_epi16(hi, zero));
+}
+
+INLINE void upb_vstore4_64(uint64_t *vals, __m128i v32) {
+  __m128i zero = _mm_setzero_si128();
+  _mm_storeu_si128((__m128i*)vals,       _mm_unpacklo_epi32(v32, zero));
+  _mm_storeu_si128((__m128i*)(vals + 2), _mm_unpackhi_epi32(v32, zero));
+}
+
+INLINE void upb_vstore16_64(uint64_t *vals, __m128i v) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero);
+  __m128i hi = _mm_unpackhi_epi8(v, zero);
+  upb_vstore4_64(vals,      _mm_unpacklo_epi16(lo, zero));
+  upb_vstore4_64(vals + 4,  _mm_unpackhi_epi16(lo, zero));
+  upb_vstore4_64(vals + 8,  _mm_unpacklo_epi16(hi, zero));
+  upb_vstore4_64(vals + 12, _mm_unpackhi_epi16(hi, zero));
+}
+
+// Looks at the next 16 bytes at once: if none of them has its continuation
+// bit set they are 16 one-byte varints, otherwise the bytes before the first
+// continuation bit are one-byte varints and the varint that follows is left
+// to the scalar code.
+#define UPB_VDECODE_BULK_SSE2(bits) \
+    if (max - i >= 16 && end - p >= 16) { \
+      __m128i v = _mm_loadu_si128((const __m128i*)p); \
+      int mask = _mm_movemask_epi8(v); \
+      if (mask == 0) { \
+        upb_vstore16_ ## bits(vals + i, v); \
+        p += 16; \
+        i += 16; \
+        continue; \
+      } \
+      int k = __builtin_ctz(mask); \
+      for (int j = 0; j < k; j++) vals[i + j] = (uint8_t)p[j]; \
+      p += k; \
+      i += k; \
+    }
+#else
+#define UPB_VDECODE_BULK_SSE2(bits)
+#endif
+
+#ifdef UPB_VDECODE_SSSE3
+// How to decode the varints in the first eight bytes of a window, given the
+// continuation bits of those bytes.  Only varints of up to four bytes are
+// decoded (the others, and varints that run past the eighth byte, are left
+// to the scalar code), so each value fits in a 32-bit lane.
+typedef struct {
+  uint8_t count;  // Number of varints decoded; 0 if the first is too long.
+  uint8_t bytes;  // Number of bytes they take up.
+  // Shuffles that gather the bytes of varint j into 32-bit lane j % 4 of
+  // vector j / 4, zero-filling the rest of the lane.
+  uint8_t shuf[2][16];
+} upb_vdecode_pattern;
+
+static upb_vdecode_pattern upb_vdecode_patterns[256];
+static bool upb_vdecode_use_ssse3;
+
+static void upb_vdecode_initsimd() {
+  for (int mask = 0; mask < 256; mask++) {
+    upb_vdecode_pattern *pat = &upb_vdecode_patterns[mask];
+    memset(pat->shuf, 0x80, sizeof(pat->shuf));  // 0x80 selects zero.
+    int start = 0, count = 0;
+    for (int i = 0; i < 8; i++) {
+      if (mask & (1 << i)) continue;  // Continuation byte.
+      int len = i + 1 - start;
+      if (len > 4) break;
+      for (int j = 0; j < len; j++)
+        pat->shuf[count / 4][(count % 4) * 4 + j] = start + j;
+      count++;
+      start = i + 1;
+    }
+    pat->count = count;
+    pat->bytes = start;
+  }
+  upb_vdecode_use_ssse3 = __builtin_cpu_supports("ssse3");
+}
+
+static bool upb_vdecode_hasssse3() {
+#ifdef UPB_THREAD_UNSAFE
+  static bool initialized = false;
+  if (!initialized) {
+    upb_vdecode_initsimd();
+    initialized = true;
+  }
+#else
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, &upb_vdecode_initsimd);
+#endif
+  return upb_vdecode_use_ssse3;
+}
+
+// Decodes the four varints that "shuf" gathers from "v" into 32-bit lanes.
+__attribute__((target("ssse3")))
+static inline __m128i upb_vdecode4_ssse3(__m128i v, const uint8_t *shuf) {
+  v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*)shuf));
+  v = _mm_and_si128(v, _mm_set1_epi8(0x7f));
+  // Pairs of bytes to 14-bit values: b0 + (b1 << 7).
+  v = _mm_maddubs_epi16(_mm_set1_epi16(0x8001), v);
+  // Pairs of 14-bit values to 28-bit values: lo + (hi << 14).
+  return _mm_madd_epi16(v, _mm_set1_epi32(0x40000001));
+}
+
+INLINE void upb_vstore8_32(uint32_t *vals, __m128i lo, __m128i hi) {
+  _mm_storeu_si128((__m128i*)vals,       lo);
+  _mm_storeu_si128((__m128i*)(vals + 4), hi);
+}
+
+INLINE void upb_vstore8_64(uint64_t *vals, __m128i lo, __m128i hi) {
+  upb_vstore4_64(vals,     lo);
+  upb_vstore4_64(vals + 4, hi);
+}
+
+// Decodes varints eight bytes at a time while at least eight values fit in
+// "vals" and sixteen bytes can be loaded; sixteen one-byte varints in a row
+// are stored directly.  Stops at the first varint that is longer than four
+// bytes.  May write past vals[*n] up to vals[max].
+#define UPB_VDECODE_SSSE3_FUNC(bits) \
+  __attribute__((target("ssse3"))) \
+  static const char *upb_vdecode_ssse3_ ## bits( \
+      const char *p, const char *end, uint ## bits ## _t *vals, size_t *n, \
+      size_t max) { \
+    /* A local count, since stores to "vals" could alias "*n". */ \
+    size_t i = *n; \
+    while (max - i >= 8 && end - p >= 16) { \
+      __m128i v = _mm_loadu_si128((const __m128i*)p); \
+      int mask = _mm_movemask_epi8(v); \
+      if (mask == 0 && max - i >= 16) { \
+        upb_vstore16_ ## bits(vals + i, v); \
+        i += 16; \
+        p += 16; \
+        continue; \
+      } \
+      const upb_vdecode_pattern *pat = &upb_vdecode_patterns[mask & 0xff]; \
+      if (pat->count == 0) break; \
+      upb_vstore8_ ## bits(vals + i, upb_vdecode4_ssse3(v, pat->shuf[0]), \
+                           upb_vdecode4_ssse3(v, pat->shuf[1])); \
+      i += pat->count; \
+      p += pat->bytes; \
+    } \
+    *n = i; \
+    return p; \
+  }
+
+UPB_VDECODE_SSSE3_FUNC(32)
+UPB_VDECODE_SSSE3_FUNC(64)
+#undef UPB_VDECODE_SSSE3_FUNC
+
+// Runs the SSSE3 loop from the start of the input.  Once a long varint stops
+// it, the rest of the run is left to the plain scalar loop (without the SSE2
+// check), since inputs with long varints (eg. negative int32 and int64
+// values) decode faster that way.
+#define UPB_VDECODE_BULK_SSSE3(bits) \
+    if (upb_vdecode_hasssse3()) { \
+      p = upb_vdecode_ssse3_ ## bits(p, end, vals, &i, max); \
+      sse2 = false; \
+    }
+#else
+#define UPB_VDECODE_BULK_SSSE3(bits)
+#endif
+
+#define UPB_VDECODE_BULK(bits) \
+  const char *upb_vdecode_bulk ## bits(const char *p, const char *end, \
+                                       uint ## bits ## _t *vals, size_t *n) { \
+    size_t max = *n; \
+    size_t i = 0; \
+    bool sse2 = true; \
+    UPB_UNUSED(sse2); \
+    UPB_VDECODE_BULK_SSSE3(bits) \
+    while (i < max && p < end) { \
+      if (sse2) { \
+        UPB_VDECODE_BULK_SSE2(bits) \
+      } \
+      upb_decoderet r; \
+      if (end - p >= UPB_PB_VARINT_MAX_LEN) { \
+        r = upb_vdecode_fast(p); \
+        if (r.p == NULL) return NULL; \
+      } else { \
+        r = upb_vdecode_tail(p, end); \
+        if (r.p == NULL) return NULL; \
+        if (r.p == p) break; \
+      } \
+      vals[i++] = (uint ## bits ## _t)r.val; \
+      p = r.p; \
+    } \
+    *n = i; \
+    return p; \
+  }
+
+UPB_VDECODE_BULK(32)
+UPB_VDECODE_BULK(64)
+#undef UPB_VDECODE_BULK
+#undef UPB_VDECODE_BULK_SSE2
+#undef UPB_VDECODE_BULK_SSSE3
@@ -92,6 +92,26 @@ INLINE upb_decoderet upb_vdecode_max8_fast(upb_decoderet r) {
   return upb_vdecode_max8_massimino(r);
 }
 
+// Decodes up to "*n" consecutive varints from [p, end) into "vals", for
+// decoding packed fields in bulk.  On return "*n" holds the number of values
+// that were decoded and the return value points just past the last of them.
+// Decoding stops early at "end"; a varint that continues past "end" is left
+// for the caller, who may need to fetch more data before decoding it.
+// Returns NULL if the input contains an unterminated (>10 byte) varint.
+//
+// Unlike the functions above these never read at or past "end", but they may
+// write to any of the "*n" slots of "vals".  On CPUs with SSSE3 (detected at
+// runtime; -DUPB_NO_SSSE3 disables it) varints of up to four bytes are
+// decoded eight input bytes at a time with a shuffle table, until the first
+// longer varint; the rest of the run is decoded one varint at a time.
+// Otherwise, where SSE2 is available, runs of one-byte varints are decoded 16
+// at a time.  The 32-bit version truncates values that do not fit in 32 bits,
+// just as 32-bit fields are decoded.
+const char *upb_vdecode_bulk32(const char *p, const char *end, uint32_t *vals,
+                               size_t *n);
+const char *upb_vdecode_bulk64(const char *p, const char *end, uint64_t *vals,
+                               size_t *n);
+
 
 /* Encoding *******************************************************************/
 
@@ -29,21 +29,42 @@ uint32_t static_refcount = 1;
 
 #ifdef UPB_THREAD_UNSAFE  //////////////////////////////////////////////////////
 
-static void atomic_inc(uint32_t *a) { (*a)++; }
-static bool atomic_dec(uint32_t *a) { return --(*a) == 0; }
+void upb_atomic_inc(uint32_t *a) { (*a)++; }
+bool upb_atomic_dec(uint32_t *a) { return --(*a) == 0; }
+bool upb_atomic_incnonzero(uint32_t *a) {
+  if (*a == 0) return false;
+  (*a)++;
+  return true;
+}
 
 #elif (__GNUC__ == 4 && __GNUC_MINOR__ >= 1) || __GNUC__ > 4 ///////////////////
 
-static void atomic_inc(uint32_t *a) { __sync_fetch_and_add(a, 1); }
-static bool atomic_dec(uint32_t *a) { return __sync_sub_and_fetch(a, 1) == 0; }
+void upb_atomic_inc(uint32_t *a) { __sync_fetch_and_add(a, 1); }
+bool upb_atomic_dec(uint32_t *a) { return __sync_sub_and_fetch(a, 1) == 0; }
+bool upb_atomic_incnonzero(uint32_t *a) {
+  uint32_t n = *a;
+  while (n != 0) {
+    uint32_t seen = __sync_val_compare_and_swap(a, n, n + 1);
+    if (seen == n) return true;
+    n = seen;
+  }
+  return false;
+}
 
 #elif defined(WIN32) ///////////////////////////////////////////////////////////
 
 #include <Windows.h>
 
-static void atomic_inc(upb_atomic_t *a) { InterlockedIncrement(&a->val); }
-static bool atomic_dec(upb_atomic_t *a) {
-  return InterlockedDecrement(&a->val) == 0;
+void upb_atomic_inc(uint32_t *a) { InterlockedIncrement((LONG*)a); }
+bool upb_atomic_dec(uint32_t *a) { return InterlockedDecrement((LONG*)a) == 0; }
+bool upb_atomic_incnonzero(uint32_t *a) {
+  LONG n = *(volatile LONG*)a;
+  while (n != 0) {
+    LONG seen = InterlockedCompareExchange((LONG*)a, n + 1, n);
+    if (seen == n) return true;
+    n = seen;
+  }
+  return false;
 }
 
 #else
@@ -51,24 +72,20 @@ static bool atomic_dec(upb_atomic_t *a) {
        Implement them or compile with UPB_THREAD_UNSAFE.
 #endif
 
+#if defined(UPB_USE_PTHREADS) && !defined(UPB_THREAD_UNSAFE)
 
-/* Reference tracking (debug only) ********************************************/
+#include <pthread.h>
 
-#ifdef UPB_DEBUG_REFS
+static pthread_mutex_t upb_mutex = PTHREAD_MUTEX_INITIALIZER;
+void upb_lock() { pthread_mutex_lock(&upb_mutex); }
+void upb_unlock() { pthread_mutex_unlock(&upb_mutex); }
 
-#ifdef UPB_THREAD_UNSAFE
-
-static void upb_lock() {}
-static void upb_unlock() {}
+#endif
 
-#else
 
-// User must define functions that lock/unlock a global mutex and link this
-// file against them.
-void upb_lock();
-void upb_unlock();
+/* Reference tracking (debug only) ********************************************/
 
-#endif
+#ifdef UPB_DEBUG_REFS
 
 // UPB_DEBUG_REFS mode counts on being able to malloc() memory in some
 // code-paths that can normally never fail, like upb_refcounted_ref().  Since
@@ -495,7 +512,7 @@ static void crossref(const upb_refcounted *r, const upb_refcounted *subobj,
   if (color(t, subobj) > BLACK && r->group != subobj->group) {
     // Previously this ref was not reflected in subobj->group because they
     // were in the same group; now that they are split a ref must be taken.
-    atomic_inc(subobj->group);
+    upb_atomic_inc(subobj->group);
   }
 }
 
@@ -682,7 +699,7 @@ static void release_ref2(const upb_refcounted *obj,
 }
 
 static void unref(const upb_refcounted *r) {
-  if (atomic_dec(r->group)) {
+  if (upb_atomic_dec(r->group)) {
     free(r->group);
 
     // In two passes, since release_ref2 needs a guarantee that any subobjs
@@ -724,7 +741,7 @@ bool upb_refcounted_isfrozen(const upb_refcounted *r) {
 void upb_refcounted_ref(const upb_refcounted *r, const void *owner) {
   if (!r->is_frozen)
     ((upb_refcounted*)r)->individual_count++;
-  atomic_inc(r->group);
+  upb_atomic_inc(r->group);
   track(r, owner, false);
 }
 
@@ -738,7 +755,7 @@ void upb_refcounted_unref(const upb_refcounted *r, const void *owner) {
 void upb_refcounted_ref2(const upb_refcounted *r, upb_refcounted *from) {
   assert(!from->is_frozen);  // Non-const pointer implies this.
   if (r->is_frozen) {
-    atomic_inc(r->group);
+    upb_atomic_inc(r->group);
   } else {
     merge((upb_refcounted*)r, from);
   }
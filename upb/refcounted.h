@@ -152,6 +152,28 @@ bool upb_refcounted_freeze(upb_refcounted *const*roots, int n, upb_status *s);
 // Shared by all compiled-in refcounted objects.
 extern uint32_t static_refcount;
 
+// Atomic operations on a refcount, which are plain increments and decrements
+// with UPB_THREAD_UNSAFE.  upb_atomic_dec() returns true if the count reached
+// zero, and upb_atomic_incnonzero() only increments a count that is not zero,
+// returning false otherwise.
+void upb_atomic_inc(uint32_t *a);
+bool upb_atomic_dec(uint32_t *a);
+bool upb_atomic_incnonzero(uint32_t *a);
+
+// Locks and unlocks a global mutex, which upb uses to guard its few
+// process-wide structures (like the decoder plan cache and, in
+// UPB_DEBUG_REFS builds, the ref tracking).  Compiling with UPB_USE_PTHREADS
+// defines them with a pthread mutex; otherwise the user must define them and
+// link upb against them.  This is required by every thread-safe build that
+// uses the decoder, not only by UPB_DEBUG_REFS builds.
+#ifdef UPB_THREAD_UNSAFE
+INLINE void upb_lock() {}
+INLINE void upb_unlock() {}
+#else
+void upb_lock();
+void upb_unlock();
+#endif
+
 #define UPB_REFCOUNT_INIT {&static_refcount, NULL, NULL, 0, true}
 
 #ifdef __cplusplus
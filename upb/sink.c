@@ -7,6 +7,8 @@
 
 #include "upb/sink.h"
 
+#include "upb/bytestream.h"
+
 static bool chkstack(upb_sink *s) {
   if (s->top + 1 >= s->limit) {
     upb_status_seterrliteral(&s->status, "Nesting too deep.");
@@ -28,6 +30,7 @@ void upb_sink_init(upb_sink *s, const upb_handlers *h) {
   s->limit = &s->stack[UPB_MAX_NESTING];
   s->top = NULL;
   s->stack[0].h = h;
+  s->stack[0].fh = upb_handlers_fieldhandlers(h);
   upb_status_init(&s->status);
 }
 
@@ -57,13 +60,7 @@ void upb_sink_endmsg(upb_sink *s, upb_status *status) {
   bool upb_sink_put ## type(upb_sink *s, const upb_fielddef *f, ctype val) { \
     upb_selector_t selector; \
     if (!upb_getselector(f, UPB_HANDLER_ ## htype, &selector)) return false; \
-    upb_ ## type ## _handler *handler = (upb_ ## type ## _handler*) \
-        upb_handlers_gethandler(s->top->h, selector); \
-    if (handler) { \
-      void *data = upb_handlers_gethandlerdata(s->top->h, selector); \
-      if (!handler(s->top->closure, data, val)) return false; \
-    } \
-    return true; \
+    return upb_sink_put ## type ## _sel(s, selector, val); \
   }
 
 PUTVAL(int32,  int32_t,         INT32);
@@ -79,13 +76,7 @@ size_t upb_sink_putstring(upb_sink *s, const upb_fielddef *f,
                           const char *buf, size_t n) {
   upb_selector_t selector;
   if (!upb_getselector(f, UPB_HANDLER_STRING, &selector)) return false;
-  upb_string_handler *handler = (upb_string_handler*)
-      upb_handlers_gethandler(s->top->h, selector);
-  if (handler) {
-    void *data = upb_handlers_gethandlerdata(s->top->h, selector); \
-    return handler(s->top->closure, data, buf, n);
-  }
-  return n;
+  return upb_sink_putstring_sel(s, selector, buf, n);
 }
 
 bool upb_sink_startseq(upb_sink *s, const upb_fielddef *f) {
@@ -106,6 +97,7 @@ bool upb_sink_startseq(upb_sink *s, const upb_fielddef *f) {
   ++s->top;
   s->top->end = getselector(f, UPB_HANDLER_ENDSEQ);
   s->top->h = h;
+  s->top->fh = s->top[-1].fh;
   s->top->closure = subc;
   return true;
 }
@@ -142,6 +134,7 @@ bool upb_sink_startstr(upb_sink *s, const upb_fielddef *f, size_t size_hint) {
   ++s->top;
   s->top->end = getselector(f, UPB_HANDLER_ENDSTR);
   s->top->h = h;
+  s->top->fh = s->top[-1].fh;
   s->top->closure = subc;
   return true;
 }
@@ -179,6 +172,7 @@ bool upb_sink_startsubmsg(upb_sink *s, const upb_fielddef *f) {
   ++s->top;
   s->top->end = getselector(f, UPB_HANDLER_ENDSUBMSG);
   s->top->h = upb_handlers_getsubhandlers(h, f);
+  s->top->fh = upb_handlers_fieldhandlers(s->top->h);
   s->top->closure = subc;
   upb_sink_startmsg(s);
   return true;
@@ -200,6 +194,40 @@ bool upb_sink_endsubmsg(upb_sink *s, const upb_fielddef *f) {
       true;
 }
 
+bool upb_sink_putunknown(upb_sink *s, uint32_t tag, upb_byteregion *bytes) {
+  upb_unknown_handler *unknown = upb_handlers_getunknown(s->top->h);
+  return unknown ? unknown(s->top->closure, tag, bytes) : true;
+}
+
+bool upb_sink_putstrview(upb_sink *s, const upb_fielddef *f,
+                         upb_strview *view) {
+  upb_selector_t selector;
+  if (!upb_getselector(f, UPB_HANDLER_STRINGVIEW, &selector)) return false;
+  upb_stringview_handler *handler = (upb_stringview_handler*)
+      upb_handlers_gethandler(s->top->h, selector);
+  if (handler) {
+    void *data = upb_handlers_gethandlerdata(s->top->h, selector);
+    return handler(s->top->closure, data, view);
+  }
+  // The view belongs to the handler, so release it if there is none.
+  upb_strview_release(view);
+  return true;
+}
+
+bool upb_sink_putlazysubmsg(upb_sink *s, const upb_fielddef *f,
+                            upb_strview *view) {
+  upb_selector_t selector;
+  if (!upb_getselector(f, UPB_HANDLER_LAZYSUBMSG, &selector)) return false;
+  upb_lazysubmsg_handler *handler = (upb_lazysubmsg_handler*)
+      upb_handlers_gethandler(s->top->h, selector);
+  if (handler) {
+    void *data = upb_handlers_gethandlerdata(s->top->h, selector);
+    return handler(s->top->closure, data, view);
+  }
+  upb_strview_release(view);
+  return true;
+}
+
 const upb_handlers *upb_sink_tophandlers(upb_sink *s) {
   return s->top->h;
 }
@@ -32,6 +32,7 @@ extern "C" {
 typedef struct {
   upb_selector_t end;  // From the enclosing message (unused at top-level).
   const upb_handlers *h;
+  const upb_fieldhandler *fh;  // upb_handlers_fieldhandlers(h).
   void *closure;
 } upb_sink_frame;
 
@@ -70,10 +71,44 @@ bool upb_sink_startstr(upb_sink *s, const upb_fielddef *f, size_t size_hint);
 size_t upb_sink_putstring(upb_sink *s, const upb_fielddef *f, const char *buf,
                           size_t len);
 bool upb_sink_endstr(upb_sink *s, const upb_fielddef *f);
+bool upb_sink_putstrview(upb_sink *s, const upb_fielddef *f,
+                         upb_strview *view);
 bool upb_sink_startsubmsg(upb_sink *s, const upb_fielddef *f);
 bool upb_sink_endsubmsg(upb_sink *s, const upb_fielddef *f);
+bool upb_sink_putlazysubmsg(upb_sink *s, const upb_fielddef *f,
+                            upb_strview *view);
 bool upb_sink_startseq(upb_sink *s, const upb_fielddef *f);
 bool upb_sink_endseq(upb_sink *s, const upb_fielddef *f);
+bool upb_sink_putunknown(upb_sink *s, uint32_t tag, upb_byteregion *bytes);
+
+// Versions of the above that take the handler's selector instead of the
+// field.  These skip upb_getselector() and its type checks, so they are meant
+// for hot paths (like a decoder) that look up the selectors ahead of time.
+// "sel" must be a selector of the right type for the handlers at the top of
+// the stack.
+#define UPB_SINK_PUTVAL_SEL(type, ctype) \
+  INLINE bool upb_sink_put ## type ## _sel( \
+      upb_sink *s, upb_selector_t sel, ctype val) { \
+    const upb_fieldhandler *fh = &s->top->fh[sel]; \
+    upb_ ## type ## _handler *h = (upb_ ## type ## _handler*)fh->handler; \
+    return h ? h(s->top->closure, fh->data, val) : true; \
+  }
+
+UPB_SINK_PUTVAL_SEL(int32,  int32_t)
+UPB_SINK_PUTVAL_SEL(int64,  int64_t)
+UPB_SINK_PUTVAL_SEL(uint32, uint32_t)
+UPB_SINK_PUTVAL_SEL(uint64, uint64_t)
+UPB_SINK_PUTVAL_SEL(float,  float)
+UPB_SINK_PUTVAL_SEL(double, double)
+UPB_SINK_PUTVAL_SEL(bool,   bool)
+#undef UPB_SINK_PUTVAL_SEL
+
+INLINE size_t upb_sink_putstring_sel(upb_sink *s, upb_selector_t sel,
+                                     const char *buf, size_t n) {
+  const upb_fieldhandler *fh = &s->top->fh[sel];
+  upb_string_handler *h = (upb_string_handler*)fh->handler;
+  return h ? h(s->top->closure, fh->data, buf, n) : n;
+}
 
 #ifdef __cplusplus
 }  /* extern "C" */
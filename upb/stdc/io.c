@@ -19,98 +19,167 @@
 
 int upb_stdio_cmpbuf(const void *_key, const void *_elem) {
   const uint64_t *ofs = _key;
-  const upb_stdio_buf *buf = _elem;
-  return (*ofs / BUF_SIZE) - (buf->ofs / BUF_SIZE);
+  const upb_stdio_buf *buf = *(upb_stdio_buf *const*)_elem;
+  if (*ofs < buf->ofs) return -1;
+  if (*ofs >= buf->ofs + buf->len) return 1;
+  return 0;
 }
 
-static upb_stdio_buf *upb_stdio_findbuf(const upb_stdio *s, uint64_t ofs) {
+// Returns the slot in s->bufs of the buffer that holds "ofs", or NULL if the
+// byte has not been read (or has been freed).
+static upb_stdio_buf **upb_stdio_findbuf(const upb_stdio *s, uint64_t ofs) {
   // TODO: it is probably faster to linear search short lists, and to
   // special-case the last one or two bufs.
   return bsearch(&ofs, s->bufs, s->nbuf, sizeof(*s->bufs), &upb_stdio_cmpbuf);
 }
 
-static upb_stdio_buf *upb_stdio_rotatebufs(upb_stdio *s) {
-  upb_stdio_buf **reuse = NULL;  // XXX
-  int num_reused = 0, num_inuse = 0;
-
-  // Could sweep only a subset of bufs if this was a hotspot.
-  for (int i = 0; i < s->nbuf; i++) {
+// Frees the buffers that are entirely discarded and not pinned, keeping one
+// of them as the spare.
+static void upb_stdio_sweepbufs(upb_stdio *s) {
+  int i = 0, n = 0;
+  for (; i < s->nbuf && s->bufs[i]->ofs + s->bufs[i]->len <= s->discard; i++) {
     upb_stdio_buf *buf = s->bufs[i];
     if (buf->refcount > 0) {
-      s->bufs[num_inuse++] = buf;
+      s->bufs[n++] = buf;
+    } else if (!s->spare) {
+      s->spare = buf;
     } else {
-      reuse[num_reused++] = buf;
+      free(buf);
     }
   }
-  assert(num_reused + num_inuse == s->nbuf);
-  memcpy(s->bufs + num_inuse, reuse, num_reused * sizeof(upb_stdio_buf*));
-  if (num_reused == 0) {
-    ++s->nbuf;
-    s->bufs = realloc(s->bufs, s->nbuf * sizeof(*s->bufs));
-    s->bufs[s->nbuf-1] = malloc(sizeof(upb_stdio_buf) + BUF_SIZE);
-    return s->bufs[s->nbuf-1];
+  memmove(s->bufs + n, s->bufs + i, (s->nbuf - i) * sizeof(*s->bufs));
+  s->nbuf -= i - n;
+}
+
+// Returns an empty buffer for the data at s->ofs, which is appended to
+// s->bufs.  Reuses the spare if there is one.  Returns NULL if out of memory.
+static upb_stdio_buf *upb_stdio_rotatebufs(upb_stdio *s) {
+  if (s->nbuf == s->szbuf) {
+    int szbuf = UPB_MAX(4, s->szbuf * 2);
+    upb_stdio_buf **bufs = realloc(s->bufs, szbuf * sizeof(*s->bufs));
+    if (!bufs) return NULL;
+    s->bufs = bufs;
+    s->szbuf = szbuf;
+  }
+  upb_stdio_buf *buf = s->spare;
+  if (buf) {
+    s->spare = NULL;
+  } else {
+    buf = malloc(sizeof(upb_stdio_buf) + BUF_SIZE);
+    if (!buf) return NULL;
   }
-  return s->bufs[s->nbuf-num_reused];
+  buf->ofs = s->ofs;
+  buf->len = 0;
+  buf->refcount = 0;
+  s->bufs[s->nbuf++] = buf;
+  return buf;
+}
+
+static void upb_stdio_freebufs(upb_stdio *s) {
+  for (int i = 0; i < s->nbuf; i++) {
+    assert(s->bufs[i]->refcount == 0);
+    free(s->bufs[i]);
+  }
+  s->nbuf = 0;
 }
 
 void upb_stdio_discard(void *src, uint64_t ofs) {
-  (void)src;
-  (void)ofs;
+  upb_stdio *stdio = (upb_stdio*)src;
+  if (ofs <= stdio->discard) return;
+  stdio->discard = ofs;
+  upb_stdio_sweepbufs(stdio);
 }
 
 upb_bytesuccess_t upb_stdio_fetch(void *src, uint64_t ofs, size_t *bytes_read) {
-  (void)ofs;
   upb_stdio *stdio = (upb_stdio*)src;
-  upb_stdio_buf *buf = upb_stdio_rotatebufs(stdio);
-retry:
-  *bytes_read = fread(&buf->data, 1, BUF_SIZE, stdio->file);
-  buf->len = *bytes_read;
-  if (*bytes_read < (size_t)BUF_SIZE) {
-    // Error or EOF.
-    if (feof(stdio->file)) {
-      upb_status_seteof(&stdio->src.status);
-      return UPB_BYTE_EOF;
+  assert(ofs >= stdio->discard);
+  // Bytes that were read before can be fetched again until they are
+  // discarded; bytes that were discarded before being read are read and
+  // dropped.
+  while (ofs >= stdio->ofs) {
+    upb_stdio_buf *buf = upb_stdio_rotatebufs(stdio);
+    if (!buf) {
+      upb_status_seterrliteral(&stdio->src.status, "out of memory");
+      return UPB_BYTE_ERROR;
     }
-    if (ferror(stdio->file)) {
+retry:
+    buf->len = fread(&buf->data, 1, BUF_SIZE, stdio->file);
+    if (buf->len == 0) {
 #ifdef EINTR
-      // If we encounter a client who doesn't want to retry EINTR, we can easily
-      // add a boolean property of the stdio that controls this behavior.
-      if (errno == EINTR) {
+      // If we encounter a client who doesn't want to retry EINTR, we can
+      // easily add a boolean property of the stdio that controls this
+      // behavior.
+      if (ferror(stdio->file) && errno == EINTR) {
         clearerr(stdio->file);
         goto retry;
       }
 #endif
-      upb_status_fromerrno(&stdio->src.status, errno);
-      return upb_errno_is_wouldblock(errno) ?
-          UPB_BYTE_WOULDBLOCK : UPB_BYTE_ERROR;
+      // Error or EOF; the empty buffer goes back to being the spare.
+      stdio->spare = stdio->bufs[--stdio->nbuf];
+      if (feof(stdio->file)) {
+        upb_status_seteof(&stdio->src.status);
+        return UPB_BYTE_EOF;
+      }
+      if (ferror(stdio->file)) {
+        upb_status_fromerrno(&stdio->src.status, errno);
+        return upb_errno_is_wouldblock(errno) ?
+            UPB_BYTE_WOULDBLOCK : UPB_BYTE_ERROR;
+      }
+      assert(false);
     }
-    assert(false);
+    stdio->ofs += buf->len;
+    upb_stdio_sweepbufs(stdio);
   }
+  *bytes_read = stdio->ofs - ofs;
   return UPB_BYTE_OK;
 }
 
 void upb_stdio_copy(const void *src, uint64_t ofs, size_t len, char *dst) {
-  upb_stdio_buf *buf = upb_stdio_findbuf(src, ofs);
-  ofs -= buf->ofs;
-  memcpy(dst, buf->data + ofs, BUF_SIZE - ofs);
-  len -= (BUF_SIZE - ofs);
-  dst += (BUF_SIZE - ofs);
+  const upb_stdio *stdio = (const upb_stdio*)src;
+  upb_stdio_buf **slot = upb_stdio_findbuf(stdio, ofs);
   while (len > 0) {
-    ++buf;
-    size_t bytes = UPB_MIN(len, BUF_SIZE);
-    memcpy(dst, buf->data, bytes);
-    len -= bytes;
+    // The bytes after the discard offset are in consecutive buffers.
+    const upb_stdio_buf *buf = *slot++;
+    assert(ofs >= buf->ofs && ofs < buf->ofs + buf->len);
+    size_t bufofs = ofs - buf->ofs;
+    size_t bytes = UPB_MIN(len, buf->len - bufofs);
+    memcpy(dst, buf->data + bufofs, bytes);
+    ofs += bytes;
     dst += bytes;
+    len -= bytes;
   }
 }
 
 const char *upb_stdio_getptr(const void *src, uint64_t ofs, size_t *len) {
-  upb_stdio_buf *buf = upb_stdio_findbuf(src, ofs);
+  upb_stdio_buf **slot = upb_stdio_findbuf(src, ofs);
+  if (!slot) {
+    *len = 0;
+    return NULL;
+  }
+  upb_stdio_buf *buf = *slot;
   ofs -= buf->ofs;
-  *len = BUF_SIZE - ofs;
+  *len = buf->len - ofs;
   return &buf->data[ofs];
 }
 
+// A pin is a ref on the buffer that holds the region, which keeps the buffer
+// from being freed or reused when it is discarded.  Regions that span buffers
+// cannot be pinned.
+bool upb_stdio_pin(void *src, uint64_t ofs, size_t len) {
+  upb_stdio_buf **slot = upb_stdio_findbuf(src, ofs);
+  if (!slot || ofs + len > (*slot)->ofs + (*slot)->len) return false;
+  (*slot)->refcount++;
+  return true;
+}
+
+void upb_stdio_unpin(void *src, uint64_t ofs, size_t len) {
+  upb_stdio *stdio = (upb_stdio*)src;
+  UPB_UNUSED(len);
+  upb_stdio_buf **slot = upb_stdio_findbuf(stdio, ofs);
+  assert(slot && (*slot)->refcount > 0);
+  if (--(*slot)->refcount == 0) upb_stdio_sweepbufs(stdio);
+}
+
 #if 0
 upb_strlen_t upb_stdio_putstr(upb_bytesink *sink, upb_string *str, upb_status *status) {
   upb_stdio *stdio = (upb_stdio*)((char*)sink - offsetof(upb_stdio, sink));
@@ -141,8 +210,19 @@ void upb_stdio_init(upb_stdio *stdio) {
     &upb_stdio_discard,
     &upb_stdio_copy,
     &upb_stdio_getptr,
+    &upb_stdio_pin,
+    &upb_stdio_unpin,
   };
   upb_bytesrc_init(&stdio->src, &bytesrc_vtbl);
+  stdio->file = NULL;
+  stdio->should_close = false;
+  stdio->bufs = NULL;
+  stdio->nbuf = 0;
+  stdio->szbuf = 0;
+  stdio->spare = NULL;
+  stdio->byteregion.bytesrc = &stdio->src;
+  stdio->byteregion.toplevel = true;
+  upb_stdio_reset(stdio, NULL);
 
   //static upb_bytesink_vtbl bytesink_vtbl = {
   //  upb_stdio_putstr,
@@ -152,8 +232,15 @@ void upb_stdio_init(upb_stdio *stdio) {
 }
 
 void upb_stdio_reset(upb_stdio* stdio, FILE *file) {
+  upb_stdio_freebufs(stdio);
   stdio->file = file;
   stdio->should_close = false;
+  stdio->ofs = 0;
+  stdio->discard = 0;
+  stdio->byteregion.start = 0;
+  stdio->byteregion.discard = 0;
+  stdio->byteregion.fetch = 0;
+  stdio->byteregion.end = UPB_NONDELIMITED;
 }
 
 void upb_stdio_open(upb_stdio *stdio, const char *filename, const char *mode,
@@ -163,7 +250,7 @@ void upb_stdio_open(upb_stdio *stdio, const char *filename, const char *mode,
     upb_status_fromerrno(s, errno);
     return;
   }
-  setvbuf(stdio->file, NULL, _IONBF, 0);  // Disable buffering; we do our own.
+  setvbuf(f, NULL, _IONBF, 0);  // Disable buffering; we do our own.
   upb_stdio_reset(stdio, f);
   stdio->should_close = true;
 }
@@ -172,7 +259,13 @@ void upb_stdio_uninit(upb_stdio *stdio) {
   // Can't report status; caller should flush() to ensure data is written.
   if (stdio->should_close) fclose(stdio->file);
   stdio->file = NULL;
+  upb_stdio_freebufs(stdio);
+  free(stdio->bufs);
+  free(stdio->spare);
 }
 
 upb_bytesrc* upb_stdio_bytesrc(upb_stdio *stdio) { return &stdio->src; }
 upb_bytesink* upb_stdio_bytesink(upb_stdio *stdio) { return &stdio->sink; }
+upb_byteregion* upb_stdio_allbytes(upb_stdio *stdio) {
+  return &stdio->byteregion;
+}
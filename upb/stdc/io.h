@@ -30,7 +30,7 @@ extern "C" {
 typedef struct {
   uint64_t ofs;
   size_t len;
-  uint32_t refcount;
+  uint32_t refcount;  // Number of pins.
   char data[];
 } upb_stdio_buf;
 
@@ -42,9 +42,16 @@ typedef struct {
   upb_bytesink sink;
   FILE *file;
   bool should_close;
+
+  // The buffers that have been read and not yet freed, sorted by offset.
+  // Buffers that are entirely discarded are only kept while they are pinned.
   upb_stdio_buf **bufs;
   int nbuf;
-  uint32_t szbuf;
+  int szbuf;
+  upb_stdio_buf *spare;  // Kept for the next read instead of being freed.
+  uint64_t ofs;          // Stream offset of the next byte to read.
+  uint64_t discard;      // Stream offset that has been discarded up to.
+  upb_byteregion byteregion;
 } upb_stdio;
 
 void upb_stdio_init(upb_stdio *stdio);
@@ -54,7 +61,8 @@ void upb_stdio_init(upb_stdio *stdio);
 void upb_stdio_uninit(upb_stdio *stdio);
 
 // Resets the object to read/write to the given "file."  The caller is
-// responsible for closing the file, which must outlive this object.
+// responsible for closing the file, which must outlive this object.  No
+// regions of the previous file may be pinned.
 void upb_stdio_reset(upb_stdio *stdio, FILE *file);
 
 // As an alternative to upb_stdio_reset(), initializes the object by opening a
@@ -64,6 +72,9 @@ void upb_stdio_open(upb_stdio *stdio, const char *filename, const char *mode,
                     upb_status *s);
 
 upb_bytesrc *upb_stdio_bytesrc(upb_stdio *stdio);
+// Returns the top-level upb_byteregion* for reading the file, which is
+// non-delimited.  Invalidated when the stdio is reset.
+upb_byteregion *upb_stdio_allbytes(upb_stdio *stdio);
 upb_bytesink *upb_stdio_bytesink(upb_stdio *stdio);
 
 #ifdef __cplusplus
@@ -226,11 +226,14 @@ typedef enum {
 } upb_ctype_t;
 
 #ifdef __cplusplus
-namespace upb { class ByteRegion; }
+namespace upb { class ByteRegion; class StringView; }
 typedef upb::ByteRegion upb_byteregion;
+typedef upb::StringView upb_strview;
 #else
 struct upb_byteregion;
 typedef struct upb_byteregion upb_byteregion;
+struct upb_strview;
+typedef struct upb_strview upb_strview;
 #endif
 
 // A single .proto value.  The owner must have an out-of-band way of knowing